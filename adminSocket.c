@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "adminSocket.h"
+#include "statsSnapshot.h"
+#include "textBuffer.h"
+
+/* Longest request line read from an admin connection */
+#define MAX_REQUEST 1024
+/* Seconds an admin connection has to send its request or read the reply */
+#define ADMIN_TIMEOUT 2
+
+/* Names of the commands counted by a server, indexed by StatIndices */
+static const char *commandNames[] = {
+        "say", "kick", "list", "auth", "name", "leave"
+        };
+
+/*
+ * Formats of stats an admin connection may ask for
+ */
+typedef enum {
+    FORMAT_PROMETHEUS,
+    FORMAT_JSON,
+    FORMAT_UNKNOWN
+} AdminFormat;
+
+/*
+ * Struct containing data passed to the thread serving an admin socket.
+ */
+typedef struct {
+    /* ClientList of all clients in the server */
+    ClientList *clients;
+    /* Listening Unix domain socket */
+    int fdListen;
+} AdminData;
+
+/*
+ * Appends a string to a TextBuffer with the characters which must be escaped
+ * in both Prometheus label values and JSON strings escaped with '\'.
+ * Other control characters are replaced by '?'.
+ */
+static void append_escaped(TextBuffer *buffer, char *text) {
+    char escaped[3] = {'\\', '\0', '\0'};
+    char plain[2] = {'\0', '\0'};
+
+    for (char *c = text; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            escaped[1] = *c;
+            text_buffer_append(buffer, escaped);
+        } else if (*c == '\n') {
+            text_buffer_append(buffer, "\\n");
+        } else {
+            plain[0] = (unsigned char) *c < ' ' ? '?' : *c;
+            text_buffer_append(buffer, plain);
+        }
+    }
+}
+
+/*
+ * Appends the HELP and TYPE lines introducing a Prometheus metric.
+ */
+static void prometheus_header(TextBuffer *buffer, char *name, char *type,
+        char *help) {
+    text_buffer_printf(buffer, "# HELP %s %s\n# TYPE %s %s\n", name, help,
+            name, type);
+}
+
+/*
+ * Appends a latency summary to a Prometheus exposition, as quantiles in
+ * seconds of the chat_latency_seconds metric labelled with a given stage.
+ */
+static void prometheus_latency(TextBuffer *buffer, char *stage,
+        LatencySnapshot *latency) {
+    long long quantiles[] = {latency->p50, latency->p90, latency->p99,
+            latency->p999};
+    char *labels[] = {"0.5", "0.9", "0.99", "0.999"};
+
+    for (int i = 0; i < 4; ++i) {
+        text_buffer_printf(buffer,
+                "chat_latency_seconds{stage=\"%s\",quantile=\"%s\"} %.9f\n",
+                stage, labels[i], quantiles[i] / 1e9);
+    }
+    text_buffer_printf(buffer, "chat_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+            "chat_latency_seconds_count{stage=\"%s\"} %lld\n",
+            stage, latency->sum / 1e9, stage, latency->count);
+}
+
+/*
+ * Appends a per client metric with one line per client in a snapshot.
+ * The value of each line is given by a callback.
+ */
+static void prometheus_per_client(TextBuffer *buffer, StatsSnapshot *snapshot,
+        char *name, long long (*value)(ClientSnapshot *)) {
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        text_buffer_printf(buffer, "%s{client=\"", name);
+        append_escaped(buffer, snapshot->clients[i].name);
+        text_buffer_printf(buffer, "\"} %lld\n",
+                value(&snapshot->clients[i]));
+    }
+}
+
+/* Callbacks giving the value of per client metrics */
+static long long queued_bytes(ClientSnapshot *client) {
+    return client->queuedBytes;
+}
+
+static long long queued_messages(ClientSnapshot *client) {
+    return client->queuedMessages;
+}
+
+static long long dropped_messages(ClientSnapshot *client) {
+    return client->dropped;
+}
+
+static long long is_slow(ClientSnapshot *client) {
+    return client->slow;
+}
+
+/*
+ * Formats a StatsSnapshot in the Prometheus text exposition format.
+ */
+static void format_prometheus(TextBuffer *buffer, StatsSnapshot *snapshot) {
+    prometheus_header(buffer, "chat_clients", "gauge",
+            "Clients which have entered the chat.");
+    text_buffer_printf(buffer, "chat_clients %d\n", snapshot->numClients);
+    prometheus_header(buffer, "chat_connections", "gauge",
+            "Open client connections, including those still handshaking.");
+    text_buffer_printf(buffer, "chat_connections %ld\n",
+            snapshot->connections);
+
+    prometheus_header(buffer, "chat_commands_total", "counter",
+            "Commands handled from all clients.");
+    for (int i = 0; i < SERVER_STAT_NUM; ++i) {
+        text_buffer_printf(buffer, "chat_commands_total{command=\"%s\"} "
+                "%lld\n", commandNames[i], snapshot->commands[i]);
+    }
+    prometheus_header(buffer, "chat_client_commands_total", "counter",
+            "Commands sent by each client.");
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        for (int j = 0; j < CLIENT_STAT_NUM; ++j) {
+            text_buffer_append(buffer, "chat_client_commands_total{client=\"");
+            append_escaped(buffer, snapshot->clients[i].name);
+            text_buffer_printf(buffer, "\",command=\"%s\"} %lld\n",
+                    commandNames[j], snapshot->clients[i].commands[j]);
+        }
+    }
+
+    prometheus_header(buffer, "chat_client_queued_bytes", "gauge",
+            "Bytes of output waiting to be written to each client.");
+    prometheus_per_client(buffer, snapshot, "chat_client_queued_bytes",
+            queued_bytes);
+    prometheus_header(buffer, "chat_client_queued_messages", "gauge",
+            "Messages waiting to be written to each client.");
+    prometheus_per_client(buffer, snapshot, "chat_client_queued_messages",
+            queued_messages);
+    prometheus_header(buffer, "chat_client_dropped_total", "counter",
+            "Messages to each client dropped by the slow consumer policy.");
+    prometheus_per_client(buffer, snapshot, "chat_client_dropped_total",
+            dropped_messages);
+    prometheus_header(buffer, "chat_client_slow", "gauge",
+            "Whether each client is currently a slow consumer.");
+    prometheus_per_client(buffer, snapshot, "chat_client_slow", is_slow);
+
+    QueueStats *queues = &snapshot->queues;
+    prometheus_header(buffer, "chat_queue_slow", "gauge",
+            "Clients which are currently slow consumers.");
+    text_buffer_printf(buffer, "chat_queue_slow %ld\n", queues->slow);
+    prometheus_header(buffer, "chat_queue_slow_events_total", "counter",
+            "Times a client became a slow consumer.");
+    text_buffer_printf(buffer, "chat_queue_slow_events_total %ld\n",
+            queues->slowEvents);
+    prometheus_header(buffer, "chat_queue_evicted_total", "counter",
+            "Clients disconnected for being slow consumers.");
+    text_buffer_printf(buffer, "chat_queue_evicted_total %ld\n",
+            queues->evicted);
+    prometheus_header(buffer, "chat_queue_dropped_total", "counter",
+            "Messages dropped by the slow consumer policy.");
+    text_buffer_printf(buffer, "chat_queue_dropped_total %ld\n",
+            queues->dropped);
+
+    prometheus_header(buffer, "chat_writer_writes_total", "counter",
+            "System calls writing queued output.");
+    text_buffer_printf(buffer, "chat_writer_writes_total %ld\n",
+            queues->writes);
+    prometheus_header(buffer, "chat_writer_messages_total", "counter",
+            "Messages written in full.");
+    text_buffer_printf(buffer, "chat_writer_messages_total %ld\n",
+            queues->messages);
+    prometheus_header(buffer, "chat_writer_bytes_total", "counter",
+            "Bytes of output written.");
+    text_buffer_printf(buffer, "chat_writer_bytes_total %ld\n",
+            queues->bytes);
+
+    LineStats *lines = &snapshot->lines;
+    prometheus_header(buffer, "chat_lines_oversized_total", "counter",
+            "Lines discarded for exceeding the maximum line length.");
+    text_buffer_printf(buffer, "chat_lines_oversized_total %ld\n",
+            lines->oversized);
+    prometheus_header(buffer, "chat_lines_discarded_bytes_total", "counter",
+            "Bytes of oversized lines discarded.");
+    text_buffer_printf(buffer, "chat_lines_discarded_bytes_total %ld\n",
+            lines->discardedBytes);
+    prometheus_header(buffer, "chat_lines_disconnected_total", "counter",
+            "Clients disconnected for sending too many oversized lines.");
+    text_buffer_printf(buffer, "chat_lines_disconnected_total %ld\n",
+            lines->disconnected);
+
+    CompressStats *compress = &snapshot->compress;
+    prometheus_header(buffer, "chat_compress_streams_total", "counter",
+            "Clients which negotiated compressed output.");
+    text_buffer_printf(buffer, "chat_compress_streams_total %ld\n",
+            compress->streams);
+    prometheus_header(buffer, "chat_compress_dict_streams_total", "counter",
+            "Compressed clients using a preset name dictionary.");
+    text_buffer_printf(buffer, "chat_compress_dict_streams_total %ld\n",
+            compress->dictStreams);
+    prometheus_header(buffer, "chat_compress_in_bytes_total", "counter",
+            "Bytes of output compressed.");
+    text_buffer_printf(buffer, "chat_compress_in_bytes_total %ld\n",
+            compress->bytesIn);
+    prometheus_header(buffer, "chat_compress_out_bytes_total", "counter",
+            "Compressed bytes output became.");
+    text_buffer_printf(buffer, "chat_compress_out_bytes_total %ld\n",
+            compress->bytesOut);
+    prometheus_header(buffer, "chat_compress_cpu_seconds_total", "counter",
+            "Thread CPU time spent compressing output.");
+    text_buffer_printf(buffer, "chat_compress_cpu_seconds_total %.9f\n",
+            compress->cpuNanos / 1e9);
+
+    prometheus_header(buffer, "chat_latency_seconds", "summary",
+            "Time from read to dispatch, in handlers and in broadcast "
+            "fan-out.");
+    prometheus_latency(buffer, "dispatch", &snapshot->dispatch);
+    prometheus_latency(buffer, "handler", &snapshot->handler);
+    prometheus_latency(buffer, "fanout", &snapshot->fanout);
+}
+
+/*
+ * Appends a latency summary to a JSON object as a member with a given name,
+ * with values in nanoseconds.
+ */
+static void json_latency(TextBuffer *buffer, char *name,
+        LatencySnapshot *latency, bool last) {
+    text_buffer_printf(buffer, "\"%s\":{\"count\":%lld,\"sum\":%lld,"
+            "\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,"
+            "\"max\":%lld}%s", name, latency->count, latency->sum,
+            latency->p50, latency->p90, latency->p99, latency->p999,
+            latency->max, last ? "" : ",");
+}
+
+/*
+ * Formats a StatsSnapshot as a JSON object. Latencies are in nanoseconds.
+ */
+static void format_json(TextBuffer *buffer, StatsSnapshot *snapshot) {
+    text_buffer_printf(buffer, "{\"clients\":%d,\"connections\":%ld,"
+            "\"commands\":{", snapshot->numClients, snapshot->connections);
+    for (int i = 0; i < SERVER_STAT_NUM; ++i) {
+        text_buffer_printf(buffer, "\"%s\":%lld%s", commandNames[i],
+                snapshot->commands[i], i < SERVER_STAT_NUM - 1 ? "," : "");
+    }
+
+    text_buffer_append(buffer, "},\"client_stats\":[");
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        ClientSnapshot *client = &snapshot->clients[i];
+        text_buffer_append(buffer, i > 0 ? ",{\"name\":\"" : "{\"name\":\"");
+        append_escaped(buffer, client->name);
+        text_buffer_append(buffer, "\"");
+        for (int j = 0; j < CLIENT_STAT_NUM; ++j) {
+            text_buffer_printf(buffer, ",\"%s\":%lld", commandNames[j],
+                    client->commands[j]);
+        }
+        text_buffer_printf(buffer, ",\"queued_bytes\":%zu,"
+                "\"queued_messages\":%d,\"dropped\":%ld,\"slow\":%s}",
+                client->queuedBytes, client->queuedMessages, client->dropped,
+                client->slow ? "true" : "false");
+    }
+
+    QueueStats *queues = &snapshot->queues;
+    text_buffer_printf(buffer, "],\"queues\":{\"slow\":%ld,"
+            "\"slow_events\":%ld,\"evicted\":%ld,\"dropped\":%ld},"
+            "\"writer\":{\"writes\":%ld,\"messages\":%ld,\"bytes\":%ld},"
+            "\"lines\":{\"oversized\":%ld,\"discarded_bytes\":%ld,"
+            "\"disconnected\":%ld},\"compress\":{\"streams\":%ld,"
+            "\"dict_streams\":%ld,\"bytes_in\":%ld,\"bytes_out\":%ld,"
+            "\"cpu_ns\":%ld},\"latency_ns\":{", queues->slow,
+            queues->slowEvents, queues->evicted, queues->dropped,
+            queues->writes, queues->messages, queues->bytes,
+            snapshot->lines.oversized, snapshot->lines.discardedBytes,
+            snapshot->lines.disconnected, snapshot->compress.streams,
+            snapshot->compress.dictStreams, snapshot->compress.bytesIn,
+            snapshot->compress.bytesOut, snapshot->compress.cpuNanos);
+    json_latency(buffer, "dispatch", &snapshot->dispatch, false);
+    json_latency(buffer, "handler", &snapshot->handler, false);
+    json_latency(buffer, "fanout", &snapshot->fanout, true);
+    text_buffer_append(buffer, "}}\n");
+}
+
+/*
+ * Reads a line from an admin connection into a buffer of a given size,
+ * dropping any trailing "\r". Returns false if the connection closed or
+ * timed out before a full line was read.
+ */
+static bool read_request_line(int fd, char *line, size_t size) {
+    size_t length = 0;
+    char next;
+
+    while (read(fd, &next, 1) == 1) {
+        if (next == '\n') {
+            if (length > 0 && line[length - 1] == '\r') {
+                length--;
+            }
+            line[length] = '\0';
+            return true;
+        }
+        if (length < size - 1) {
+            line[length++] = next;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns the format asked for by the path of an HTTP request or a plain
+ * request line: "/metrics" or "metrics" for Prometheus, "/json" or "json"
+ * for JSON. An empty plain request asks for Prometheus.
+ */
+static AdminFormat parse_format(char *request) {
+    if (*request == '/') {
+        request++;
+    }
+
+    if (*request == '\0' || !strcmp(request, "metrics")) {
+        return FORMAT_PROMETHEUS;
+    } else if (!strcmp(request, "json")) {
+        return FORMAT_JSON;
+    }
+
+    return FORMAT_UNKNOWN;
+}
+
+/*
+ * Writes the whole of a buffer to a socket. Returns false on error.
+ */
+static bool write_all(int fd, char *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        length -= written;
+    }
+
+    return true;
+}
+
+/*
+ * Serves a single admin connection.
+ *
+ * The request is either a plain line ("metrics" or "json") or an HTTP GET
+ * of "/metrics" or "/json", whose reply is given HTTP headers so monitoring
+ * agents can scrape the socket directly. The stats are formatted from a
+ * snapshot, so no lock of the server is held while the reply is written.
+ */
+static void serve_admin(ClientList *clients, int fd) {
+    char request[MAX_REQUEST];
+    if (!read_request_line(fd, request, sizeof(request))) {
+        return;
+    }
+
+    bool http = !strncmp(request, "GET ", strlen("GET "));
+    char *target = request;
+    if (http) {
+        // Skip the rest of the request's headers
+        char header[MAX_REQUEST];
+        while (read_request_line(fd, header, sizeof(header))
+                && header[0] != '\0') {
+            ;
+        }
+        target = request + strlen("GET ");
+        char *end = strchr(target, ' ');
+        if (end != NULL) {
+            *end = '\0';
+        }
+    }
+
+    AdminFormat format = parse_format(target);
+    TextBuffer body;
+    init_text_buffer(&body);
+    if (format != FORMAT_UNKNOWN) {
+        StatsSnapshot *snapshot = take_stats_snapshot(clients);
+        if (format == FORMAT_PROMETHEUS) {
+            format_prometheus(&body, snapshot);
+        } else {
+            format_json(&body, snapshot);
+        }
+        free_stats_snapshot(snapshot);
+    } else {
+        text_buffer_append(&body, "unknown request\n");
+    }
+
+    if (http) {
+        TextBuffer head;
+        init_text_buffer(&head);
+        text_buffer_printf(&head, "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+                "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                format == FORMAT_UNKNOWN ? "404 Not Found" : "200 OK",
+                format == FORMAT_JSON ? "application/json"
+                : "text/plain; version=0.0.4", body.length);
+        write_all(fd, head.text, head.length);
+        free_text_buffer(&head);
+    }
+    write_all(fd, body.text, body.length);
+    free_text_buffer(&body);
+}
+
+/*
+ * Thread function which accepts connections to an admin socket one at a time
+ * and serves each. Connections which are slow to send their request or read
+ * the reply are timed out.
+ */
+static void *run_admin_socket(void *arg) {
+    AdminData *data = (AdminData *) arg;
+    struct timeval timeout;
+    timeout.tv_sec = ADMIN_TIMEOUT;
+    timeout.tv_usec = 0;
+
+    while (1) {
+        int fd = accept(data->fdListen, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                sizeof(struct timeval));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                sizeof(struct timeval));
+
+        serve_admin(data->clients, fd);
+        close(fd);
+    }
+
+    return 0;
+}
+
+/*
+ * Removes a stale socket left at a given path, e.g. by a server which was
+ * killed. Anything other than a socket is left alone.
+ *
+ * Returns true if nothing is at the path any more, else false.
+ */
+static bool remove_stale_socket(char *path) {
+    struct stat info;
+    if (lstat(path, &info)) {
+        return true;
+    }
+
+    return S_ISSOCK(info.st_mode) && !unlink(path);
+}
+
+/*
+ * Creates a Unix domain socket at a given path, replacing any socket already
+ * there, and starts a thread serving the server's stats to connections to it.
+ * (see serve_admin())
+ *
+ * Returns false if the socket could not be created, including if something
+ * other than a socket is at the path, which is never removed.
+ */
+bool start_admin_socket(ClientList *clients, char *path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(struct sockaddr_un));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path);
+    if (!remove_stale_socket(path)) {
+        return false;
+    }
+
+    int fdListen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fdListen < 0 || bind(fdListen, (struct sockaddr *) &address,
+            sizeof(struct sockaddr_un)) || listen(fdListen, SOMAXCONN)) {
+        if (fdListen >= 0) {
+            close(fdListen);
+        }
+        return false;
+    }
+
+    AdminData *data = (AdminData *) malloc(sizeof(AdminData));
+    data->clients = clients;
+    data->fdListen = fdListen;
+
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, run_admin_socket, data);
+    pthread_detach(threadId);
+
+    return true;
+}
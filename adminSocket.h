@@ -0,0 +1,9 @@
+#ifndef ADMINSOCKET_H
+#define ADMINSOCKET_H
+
+#include <stdbool.h>
+#include "clientList.h"
+
+bool start_admin_socket(ClientList *clients, char *path);
+
+#endif
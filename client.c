@@ -9,28 +9,48 @@
 #include "clientData.h"
 #include "errors.h"
 
+/* Prefix all client option arguments start with */
+#define OPTION_PREFIX "--"
+
 int connect_to_server(const char *serverPort);
 
+/*
+ * Usage: client [--assign] [--framed] [--compress] name authfile port
+ *
+ * Options opt in to protocol extensions which the server must support (see
+ * apply_client_option()). Without them the client speaks the plain protocol.
+ */
 int main(int argc, char **argv) {
+    ClientOptions options = {0};
+    int argNo = 1;
+    while (argNo < argc && !strncmp(argv[argNo], OPTION_PREFIX,
+            strlen(OPTION_PREFIX))) {
+        if (!apply_client_option(&options, argv[argNo])) {
+            exit_with_msg(USAGE, CLIENT);
+        }
+        argNo++;
+    }
+    char **args = argv + argNo - 1;
 
-    if (argc != 4) {
+    if (argc - argNo != 3) {
         exit_with_msg(USAGE, CLIENT);
     }
 
     bool invalidAuthFile = false;
-    char *password = get_password(argv[2], &invalidAuthFile);
+    char *password = get_password(args[2], &invalidAuthFile);
     if (invalidAuthFile) {
         free(password);
         exit_with_msg(USAGE, CLIENT);
     }
 
-    int fdServer = connect_to_server(argv[3]);
+    int fdServer = connect_to_server(args[3]);
     if (fdServer < 0) {
         free(password);
         exit_with_msg(COMMS, CLIENT);
     }
 
-    ClientData *data = init_client_data(argv[1], password, fdServer);
+    ClientData *data = init_client_data(args[1], password, fdServer,
+            &options);
     suppress_sigpipe();
     start_client(data);
 
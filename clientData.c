@@ -6,16 +6,46 @@
 #include <string.h>
 #include <stdarg.h>
 #include "lineList.h"
+#include "commands.h"
 #include "clientData.h"
 
+/*
+ * Applies a single option argument a client was run with to its
+ * ClientOptions:
+ *
+ * - "--assign" has the client ask the server to assign its name (see
+ *   name_negotiate() in clientUtils.c).
+ *
+ * - "--framed" has the client ask to switch to framing (see start_framing()).
+ *
+ * - "--compress" has the client ask for compression (see
+ *   request_compression()).
+ *
+ * Returns true if the option was recognised, else false.
+ */
+bool apply_client_option(ClientOptions *options, char *option) {
+    if (!strcmp(option, "--assign")) {
+        options->assign = true;
+    } else if (!strcmp(option, "--framed")) {
+        options->framed = true;
+    } else if (!strcmp(option, "--compress")) {
+        options->compress = true;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 /* 
  * Initializes a new ClientData struct given the name of the client, the
- * password from its authfile and file descriptor for the server it is 
- * connected to.
+ * password from its authfile, file descriptor for the server it is 
+ * connected to and the options it was run with.
  *
  * Returns a pointer to the new struct.
  */
-ClientData *init_client_data(char *name, char *password, int fdServer) {
+ClientData *init_client_data(char *name, char *password, int fdServer,
+        ClientOptions *options) {
     ClientData *data = (ClientData *) calloc(1, sizeof(ClientData));
     data->isActive = true;
     data->authenticated = false;
@@ -23,11 +53,14 @@ ClientData *init_client_data(char *name, char *password, int fdServer) {
     data->password = password;
     data->exitCode = -1; // Default error code is -1, for an unset code
     data->clientNo = -1;
+    data->options = *options;
+    data->askedCompress = false;
+    data->assignedName = NULL;
     data->lock = calloc(1, sizeof(pthread_mutex_t));
     pthread_mutex_init(data->lock, 0);
-    // Create read and write file pointers to the server
-    data->readFrom = fdopen(fdServer, "r");
-    data->writeTo = fdopen(dup(fdServer), "w");
+    data->sendLock = calloc(1, sizeof(pthread_mutex_t));
+    pthread_mutex_init(data->sendLock, 0);
+    data->server = init_connection(fdServer, NULL);
 
     return data;
 }
@@ -37,42 +70,153 @@ void next_client_no(ClientData *data) {
     data->clientNo++;
 }
 
+/*
+ * Sets the name of a client to one assigned by the server, replacing the
+ * default name and clientNo scheme of get_name().
+ */
+void set_assigned_name(ClientData *data, char *name) {
+    free(data->assignedName);
+    data->assignedName = calloc(strlen(name) + 1, sizeof(char));
+    strcpy(data->assignedName, name);
+}
+
+/*
+ * Formats a command given as a formatting string and va_list of arguments in
+ * the manner of vprintf() and sends it through a Connection as a frame (see
+ * connection_send_frame()).
+ *
+ * Strings which are not commands a server accepts are not sent, as the
+ * server would ignore them anyway.
+ */
+static void vsend_frame(Connection *conn, char *format, va_list args) {
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(NULL, 0, format, argsCopy);
+    va_end(argsCopy);
+    if (length < 0) {
+        return;
+    }
+
+    char *cmd = (char *) calloc(length + 1, sizeof(char));
+    vsnprintf(cmd, length + 1, format, args);
+    CmdView view;
+    if (parse_cmd(cmd, length, SERVER, &view)) {
+        connection_send_frame(conn, &view);
+    }
+    free(cmd);
+}
+
 /* 
  * Sends a string to the server a client is connected to.
  * The string is given as a formatting string and a variable number of 
- * arguments in a similar manner to printf() as vfprintf is used.
+ * arguments in a similar manner to printf(). (see vconnection_send())
  *
  * Note that a new line character is appended to the end of the string before
- * it is sent.
+ * it is sent. Once the client has switched to framing (see start_framing()),
+ * the string is sent as a frame instead.
  */
 void send_to_server(ClientData *data, char *format, ...) {
     // Retrive string formatting arguments
     va_list args;
     va_start(args, format);
 
-    vfprintf(data->writeTo, format, args);
-    fprintf(data->writeTo, "\n");
-    fflush(data->writeTo);
+    pthread_mutex_lock(data->sendLock);
+    if (data->server->writeFramed) {
+        vsend_frame(data->server, format, args);
+    } else {
+        vconnection_send(data->server, format, args);
+    }
+    pthread_mutex_unlock(data->sendLock);
 
     va_end(args);
 }
 
 /*
- * Reads a single line of messages a server has sent to a client and returns
- * the message as a string.
+ * Sends a message typed by the user to the server a client is connected to
+ * as a SAY: command.
+ *
+ * Once framing is in use, the frame is built straight from the message, so
+ * it may contain ':' and is sent without being formatted and parsed first.
+ */
+void send_say_to_server(ClientData *data, char *msg) {
+    if (!data->server->writeFramed) {
+        send_to_server(data, "SAY:%s", msg);
+        return;
+    }
+
+    CmdView view;
+    view.cmdNo = get_cmd_no("SAY", strlen("SAY"), SERVER);
+    view.numFields = 1;
+    // An empty message is sent without a body, as it would be as a line
+    if (msg[0] != '\0') {
+        view.fields[1].start = msg;
+        view.fields[1].length = strlen(msg);
+        view.numFields++;
+    }
+
+    pthread_mutex_lock(data->sendLock);
+    connection_send_frame(data->server, &view);
+    pthread_mutex_unlock(data->sendLock);
+}
+
+/*
+ * Asks a server to switch to framing with FRAMED:, after which every command
+ * the client sends is a frame. The server acknowledges with a final FRAMED: line, after
+ * which it sends frames too (see name_negotiate() in clientUtils.c).
+ */
+void start_framing(ClientData *data) {
+    pthread_mutex_lock(data->sendLock);
+    char *reply = "FRAMED:\n";
+    data->server->writeFramed = connection_write(data->server, reply,
+            strlen(reply)) && connection_flush(data->server);
+    pthread_mutex_unlock(data->sendLock);
+}
+
+/*
+ * Asks a server with COMPRESS:DICT for everything it sends after
+ * acknowledging the request to be compressed, starting with a dictionary of
+ * the names in the server (see start_inflating()). A server which does not
+ * offer compression ignores the request.
+ */
+void request_compression(ClientData *data) {
+    send_to_server(data, "COMPRESS:DICT");
+    data->askedCompress = true;
+}
+
+/*
+ * Handles a server's COMPRESS:<names> reply to request_compression(),
+ * inflating everything the server sends from now on. The stream's preset
+ * dictionary is built from the names, as the server built it.
  *
- * Sets a given bool flag to true if the line read was empty (just contains
- * EOF). (see read_file_line() in lineList.c)
+ * Must be called right after the reply is read (see
+ * connection_start_inflating()).
+ */
+void start_inflating(ClientData *data, CmdView *reply) {
+    char dictionary[MAX_DICT_SIZE];
+    char *names = reply->numFields > 1 ? reply->fields[1].start : "";
+    size_t namesLength = fit_dictionary_names(names, strlen(names));
+    size_t dictLength = build_dictionary(dictionary, names, namesLength);
+
+    connection_start_inflating(data->server, dictionary, dictLength);
+}
+
+/*
+ * Reads a single line of messages a server has sent to a client and returns
+ * the message as a string, setting *length to its length. The string is a
+ * view into the client's read buffer which is only valid until the next
+ * read, and must not be freed. Once the server sends frames, the message is
+ * the body of a frame instead (see parse_server_cmd()).
  *
- * Moreover, if the socket connect to the server has errors (i.e. if due to
- * unexpected server closure) and a line cannot be read from the server, NULL 
- * is returned instead and the given bool flag is set to true as well.
+ * If the server closed the connection, or the socket connected to the server
+ * has errors (i.e. if due to unexpected server closure) and a line cannot be
+ * read from the server, NULL is returned instead and the given bool flag is
+ * set to true.
  */
-char *read_server_line(ClientData *data, bool *serverLeft) {
+char *read_server_line(ClientData *data, size_t *length, bool *serverLeft) {
     // Setup getsockopt to check if the server socket fd has any errors
     int error = 0;
     socklen_t len = sizeof(error);
-    getsockopt(fileno(data->readFrom), SOL_SOCKET, SO_ERROR, &error, &len);
+    getsockopt(data->server->fd, SOL_SOCKET, SO_ERROR, &error, &len);
 
     // Toggle isLineEmpty if there is an error
     if (error != 0) {
@@ -81,16 +225,46 @@ char *read_server_line(ClientData *data, bool *serverLeft) {
         return NULL;
     }
 
-    return read_file_line(data->readFrom, serverLeft);
+    char *line;
+    if (connection_read_line(data->server, &line, length) != READ_LINE) {
+        *serverLeft = true;
+        return NULL;
+    }
+
+    return line;
+}
+
+/*
+ * Parses a message of a given length read from a server with
+ * read_server_line() in place into a CmdView, as a frame body (see
+ * parse_frame()) if the server sends frames, else as a line (see
+ * parse_cmd()).
+ *
+ * Returns true if the message is a valid command, else false.
+ */
+bool parse_server_cmd(ClientData *data, char *msg, size_t length,
+        CmdView *view) {
+    if (data->server->readFramed) {
+        return parse_frame(msg, length, CLIENT, view);
+    }
+
+    return parse_cmd(msg, length, CLIENT, view);
 }
 
 /* Returns the name of the client as a string given data of the client.
- * If clientNo in data is <0, the default name of the client is returned.
+ * If the server assigned the client a name, that name is returned.
+ * Else if clientNo in data is <0, the default name of the client is returned.
  * Else the returned name is the default name with the clientNo appended to the
  * end of it, i.e. client0, client1
  *
  */
 char *get_name(ClientData *data) {
+    if (data->assignedName != NULL) {
+        char *name = calloc(strlen(data->assignedName) + 1, sizeof(char));
+        strcpy(name, data->assignedName);
+        return name;
+    }
+
     char *defaultName = data->name;
     int clientNo = data->clientNo;
     // Allocate memory for the name and 9 digits for the clientNo 
@@ -124,9 +298,12 @@ void disable_client(ClientData *data, int exitCode) {
 /* Frees memory allocated to a ClientData structure */
 void free_client_data(ClientData *data) {
     free(data->password);
-    fclose(data->writeTo);
-    fclose(data->readFrom);
+    free(data->assignedName);
+    close(data->server->fd);
+    free_connection(data->server);
     pthread_mutex_destroy(data->lock);
     free(data->lock);
+    pthread_mutex_destroy(data->sendLock);
+    free(data->sendLock);
     free(data);
 }
@@ -4,6 +4,34 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include "connection.h"
+
+/*
+ * Struct storing the protocol extensions a client was run with options to
+ * use, i.e.
+ *
+ * client [--assign] [--framed] [--compress] name authfile port
+ *
+ * Each must be supported by the server. A client run without options speaks
+ * the plain protocol.
+ */
+typedef struct {
+    /*
+     * Whether the client asks the server to assign its name rather than
+     * negotiating it (--assign)
+     */
+    bool assign;
+    /*
+     * Whether the client switches to sending and reading frames (see
+     * frame.h) rather than lines (--framed)
+     */
+    bool framed;
+    /*
+     * Whether the client asks for the server's output to be compressed (see
+     * compress.h) (--compress)
+     */
+    bool compress;
+} ClientOptions;
 
 /*
  * Struct to store information pertaining to a client instance
@@ -37,16 +65,17 @@ typedef struct {
      * client receives a NAME_TAKEN command.
      */
     int clientNo;
+    /* Protocol extensions the client uses */
+    ClientOptions options;
+    /* Whether the client has asked for compression */
+    bool askedCompress;
+    /* Name assigned to the client by the server, or NULL if none was */
+    char *assignedName;
     /*
-     * File pointer wrapping a file descriptor used to send messages to a 
-     * server.
+     * Buffered connection over the socket used to send messages to and read
+     * messages from a server.
      */
-    FILE *writeTo;
-    /*
-     * File pointer wrapping a file descriptor used to read messages from 
-     * a server.
-     */
-    FILE *readFrom;
+    Connection *server;
     /* Thread id of the thread used to handle server input */
     pthread_t serverHandler;
     /* Thread id of the thread used to handle user input */
@@ -56,12 +85,26 @@ typedef struct {
      * multiple threads.
      */
     pthread_mutex_t *lock;
+    /*
+     * Mutex held while sending to the server, as both the server and user
+     * input handling threads send to it.
+     */
+    pthread_mutex_t *sendLock;
 } ClientData;
 
-ClientData *init_client_data(char *name, char *password, int fdServer);
+bool apply_client_option(ClientOptions *options, char *option);
+ClientData *init_client_data(char *name, char *password, int fdServer,
+        ClientOptions *options);
 void next_client_no(ClientData *data);
+void set_assigned_name(ClientData *data, char *name);
 void send_to_server(ClientData *data, char *format, ...);
-char *read_server_line(ClientData *data, bool *serverLeft);
+void send_say_to_server(ClientData *data, char *msg);
+void start_framing(ClientData *data);
+void request_compression(ClientData *data);
+void start_inflating(ClientData *data, CmdView *reply);
+char *read_server_line(ClientData *data, size_t *length, bool *serverLeft);
+bool parse_server_cmd(ClientData *data, char *msg, size_t length,
+        CmdView *view);
 void free_client_data(ClientData *data);
 char *get_name(ClientData *data);
 void disable_client(ClientData *data, int exitCode);
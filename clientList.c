@@ -3,14 +3,15 @@
 #include <string.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <time.h>
 #include "lineList.h"
 #include "clientThread.h"
 #include "clientList.h"
+#include "timing.h"
+#include "trace.h"
 
-/* Number of digits in the largest number an int can store (65535) */
-#define MAX_DIGS 5
-/* Number of different commands a server should store statistics for */
-#define SERVER_STAT_NUM 6
+/* Number of digits in the largest suffix an assigned name can have */
+#define MAX_INT_DIGS 10
 
 /* 
  * Allocates memory for and initializes a new ClientNode.
@@ -21,6 +22,12 @@ ClientNode *init_node(ClientThread *client) {
     node->client = client;
     node->next = NULL;
     node->prev = NULL;
+    node->height = 1;
+    node->skipNext = NULL;
+    node->skipPrev = NULL;
+    node->hashNext = NULL;
+    node->retireNext = NULL;
+    node->retireEpoch = 0;
 
     return node;
 }
@@ -30,6 +37,7 @@ ClientNode *init_node(ClientThread *client) {
  */
 void free_node(ClientNode *node) {
     free_client_thread(node->client);
+    free(node->skipNext);
     free(node);
 }
 
@@ -41,53 +49,144 @@ int compare_node_names(ClientNode *node1, ClientNode *node2) {
     return strcmp(node1->client->name, node2->client->name);
 }
 
+/*
+ * Returns the node following a given node at a level of a ClientList's skip
+ * list, or the first node at that level if node is NULL.
+ */
+static ClientNode *level_next(ClientList *clients, ClientNode *node,
+        int level) {
+    if (node == NULL) {
+        return level == 0 ? clients->head : clients->skipHeads[level - 1];
+    }
+
+    return level == 0 ? node->next : node->skipNext[level - 1];
+}
+
+/*
+ * Sets the node following a given node at a level of a ClientList's skip
+ * list, or the first node at that level if node is NULL.
+ *
+ * The bottom level is read without the list's lock (see first_client_node()),
+ * so it is updated with atomic stores which publish the node being linked.
+ */
+static void set_level_next(ClientList *clients, ClientNode *node, int level,
+        ClientNode *next) {
+    if (node == NULL && level == 0) {
+        __atomic_store_n(&clients->head, next, __ATOMIC_RELEASE);
+    } else if (node == NULL) {
+        clients->skipHeads[level - 1] = next;
+    } else if (level == 0) {
+        __atomic_store_n(&node->next, next, __ATOMIC_RELEASE);
+    } else {
+        node->skipNext[level - 1] = next;
+    }
+}
+
+/*
+ * Sets the node preceding a given node at a level of a ClientList's skip
+ * list. Does nothing if node is NULL.
+ */
+static void set_level_prev(ClientNode *node, int level, ClientNode *prev) {
+    if (node == NULL) {
+        return;
+    }
+
+    if (level == 0) {
+        node->prev = prev;
+    } else {
+        node->skipPrev[level - 1] = prev;
+    }
+}
+
+/*
+ * Returns the node preceding a given node at a level of a ClientList's skip
+ * list, or NULL if it is the first node at that level.
+ */
+static ClientNode *level_prev(ClientNode *node, int level) {
+    return level == 0 ? node->prev : node->skipPrev[level - 1];
+}
+
+/*
+ * Finds the last node at each level of a ClientList's skip list which sorts
+ * before a given node, descending from the top level so O(log n) nodes are
+ * visited. preds[level] is set to NULL if no node at that level sorts before
+ * the given node.
+ */
+static void find_preds(ClientList *clients, ClientNode *node,
+        ClientNode **preds) {
+    ClientNode *pred = NULL;
+
+    for (int level = clients->skipHeight - 1; level >= 0; --level) {
+        ClientNode *next = level_next(clients, pred, level);
+        while (next != NULL && compare_node_names(next, node) < 0) {
+            pred = next;
+            next = level_next(clients, pred, level);
+        }
+        preds[level] = pred;
+    }
+}
+
+/*
+ * Discards a ClientList's cached LIST: command after a client joined or
+ * left. Must be called with the list's lock held.
+ */
+static void invalidate_list_payload(ClientList *clients) {
+    if (clients->listPayload != NULL) {
+        unref_payload(clients->listPayload);
+        clients->listPayload = NULL;
+    }
+}
+
+/*
+ * Chooses the skip list height of a new node of a ClientList: each level
+ * above the bottom one is added with probability 1/2.
+ */
+static int random_height(ClientList *clients) {
+    int height = 1;
+    while (height < MAX_SKIP_HEIGHT && (rand_r(&clients->skipSeed) & 1)) {
+        height++;
+    }
+
+    return height;
+}
+
 /*
  * Adds a ClientNode to a ClientList - a linked list of ClientNodes.
  * ClientLists are sorted lexiographically by client name and nodes are added
  * following this by the name of their ClientThread member.
+ *
+ * The node's place is found through the list's skip list, so adding a node
+ * takes O(log n) time. The node is also added to the list's NameIndex, and
+ * becomes its client's handle to the list.
  */
 void add_node(ClientList *clients, ClientNode *node) {
     pthread_mutex_lock(clients->lock);
-    // If the list is empty, make the given node the head
-    if (clients->head == NULL) {
-        clients->head = node;
-        pthread_mutex_unlock(clients->lock);
-        return;
+    name_index_add(&clients->names, node);
+    node->client->node = node;
+    invalidate_list_payload(clients);
+
+    ClientNode *preds[MAX_SKIP_HEIGHT];
+    find_preds(clients, node, preds);
+
+    node->height = random_height(clients);
+    if (node->height > 1) {
+        node->skipNext = (ClientNode **) malloc(2 * (node->height - 1)
+                * sizeof(ClientNode *));
+        node->skipPrev = node->skipNext + (node->height - 1);
     }
-
-    ClientNode *currentNode = clients->head;
-
-    // Check if the node should be before the head
-    if (compare_node_names(node, currentNode) < 0) {
-        currentNode->prev = node;
-        node->next = currentNode;
-        clients->head = node;
-        pthread_mutex_unlock(clients->lock);
-        return;
+    // Levels not yet in use are entered from their (empty) heads
+    while (clients->skipHeight < node->height) {
+        preds[clients->skipHeight++] = NULL;
     }
 
-    /*
-     * Iterate over the list and insert the node just before the first
-     * node found that is lexiographically greater
-     */
-    while (currentNode->next != NULL) {
-        currentNode = currentNode->next;
-        if (compare_node_names(node, currentNode) < 0) {
-            node->next = currentNode;
-            node->prev = currentNode->prev;
-            currentNode->prev->next = node;
-            currentNode->prev = node;
-            pthread_mutex_unlock(clients->lock);
-            return;
-        }
+    for (int level = 0; level < node->height; ++level) {
+        ClientNode *next = level_next(clients, preds[level], level);
+        set_level_next(clients, node, level, next);
+        set_level_prev(next, level, node);
+        set_level_next(clients, preds[level], level, node);
+        set_level_prev(node, level, preds[level]);
     }
 
-    /* 
-     * No node was found that was lexiographically greater than the given node,
-     * so add the node to the list's end.
-     */
-    currentNode->next = node;
-    node->prev = currentNode;
     pthread_mutex_unlock(clients->lock);
 }
 
@@ -101,49 +200,153 @@ void add_client(ClientList *clients, ClientThread *client) {
 }
 
 /*
- * Removes a ClientNode from the linked list it is part of and frees memory
- * allocated to it.
+ * Removes a ClientNode from the linked list it is part of, its skip list
+ * levels and the list's NameIndex. Must be called with the list's lock held.
+ *
+ * As every level is doubly linked, no search of the list is needed. The
+ * node's own links are left intact so readers currently at the node can
+ * still move on from it; it must not be freed until they are done (see
+ * remove_client()).
  */
 void remove_node(ClientList *clients, ClientNode *node) {
-    // Check if the node is the head of the list.
-    if (clients->head == node) {
-        // Make the next node the head
-        clients->head = node->next;
-    } else {
-        // Set the node's next as the next of its prev node
-        node->prev->next = node->next;
-        // If the node is not as the end of the list, set the node's prev as 
-        // the prev value of the next node
-        if (node->next != NULL) {
-            node->next->prev = node->prev;
-        }
+    name_index_remove(&clients->names, node);
+    invalidate_list_payload(clients);
+
+    for (int level = 0; level < node->height; ++level) {
+        ClientNode *prev = level_prev(node, level);
+        ClientNode *next = level_next(clients, node, level);
+        set_level_next(clients, prev, level, next);
+        set_level_prev(next, level, prev);
+    }
+    while (clients->skipHeight > 1 &&
+            clients->skipHeads[clients->skipHeight - 2] == NULL) {
+        clients->skipHeight--;
     }
-
-    free_node(node);
 }
 
 /*
  * Removes a ClientThread and the ClientNode it belongs to from a ClientList.
- * Memory allocated to that ClientNode and ClientThread is also freed.
+ * Memory allocated to that ClientNode and ClientThread is also freed, though
+ * not necessarily before this function returns.
  *
- * If the ClientThread is not in the ClientList, this function does nothing.
+ * The node is found through the client's handle to it, so this takes
+ * constant time. If the ClientThread is not in the ClientList, this function
+ * does nothing. A client which was assigned its name releases its entry of
+ * the list's SuffixTable.
+ *
+ * Once unlinked, the node is only freed after every reader which may have
+ * reached it has finished (see begin_client_read()). This function does not
+ * wait for them: the node is retired, to be freed by a later call to
+ * reclaim_clients(), so a slow reader never stalls the caller. Must not be
+ * called during a read.
  */
 void remove_client(ClientList *clients, ClientThread *client) {
-    ClientThread *currentClient = NULL;
+    ClientNode *node = client->node;
+    if (node == NULL) {
+        return;
+    }
+
+    if (client->suffixEntry != NULL) {
+        pthread_mutex_lock(clients->nameLock);
+        release_suffix_entry(&clients->suffixes, client->suffixEntry);
+        client->suffixEntry = NULL;
+        pthread_mutex_unlock(clients->nameLock);
+    }
+
     pthread_mutex_lock(clients->lock);
+    remove_node(clients, node);
+    node->retireEpoch = epoch_retire_target(&clients->epoch);
+    node->retireNext = clients->retired;
+    clients->retired = node;
+    pthread_mutex_unlock(clients->lock);
 
-    ClientNode *currentNode = clients->head;
-    while (currentNode != NULL) {
-        currentClient = currentNode->client;
-        if (currentClient == client) {
-        // Remove and free the matched node and client
-            remove_node(clients, currentNode);
-            break;
+    reclaim_clients(clients);
+}
+
+/*
+ * Frees every node retired from a ClientList by remove_client() which no
+ * reader can still be at, along with its ClientThread. Never waits for
+ * readers; nodes they may still be at are left for a later call.
+ *
+ * Returns whether any retired nodes remain to be freed.
+ */
+bool reclaim_clients(ClientList *clients) {
+    ClientNode *freeable = NULL;
+
+    pthread_mutex_lock(clients->lock);
+    ClientNode **link = &clients->retired;
+    while (*link != NULL) {
+        ClientNode *node = *link;
+        if (epoch_reached(&clients->epoch, node->retireEpoch)) {
+            *link = node->retireNext;
+            node->retireNext = freeable;
+            freeable = node;
+        } else {
+            link = &node->retireNext;
         }
-        currentNode = currentNode->next;
     }
-
+    bool remaining = clients->retired != NULL;
     pthread_mutex_unlock(clients->lock);
+
+    // Freeing a ClientThread takes its own locks, so it is done unlocked
+    while (freeable != NULL) {
+        ClientNode *next = freeable->retireNext;
+        free_node(freeable);
+        freeable = next;
+    }
+
+    return remaining;
+}
+
+/*
+ * Waits until every reader of a ClientList which started before this call
+ * has finished, then frees the nodes retired from the list which they may
+ * have been at, including any retired by the calling thread.
+ *
+ * For threads which may wait, unlike event loop threads. Must not be called
+ * during a read.
+ */
+void sync_removed_clients(ClientList *clients) {
+    epoch_synchronize(&clients->epoch);
+    reclaim_clients(clients);
+}
+
+/*
+ * Starts a read of the clients in a ClientList without taking its lock.
+ *
+ * Until the matching end_client_read(), the nodes of the list may be
+ * iterated with first_client_node() and next_client_node(), and no node or
+ * ClientThread reached is freed. Clients may join or leave during the read;
+ * each is either seen or not.
+ *
+ * Returns a value to be given to end_client_read().
+ */
+int begin_client_read(ClientList *clients) {
+    return epoch_enter(&clients->epoch);
+}
+
+/*
+ * Ends a read of the clients in a ClientList started by begin_client_read(),
+ * given the value it returned.
+ */
+void end_client_read(ClientList *clients, int readSlot) {
+    epoch_exit(&clients->epoch, readSlot);
+}
+
+/*
+ * Returns the first node of a ClientList during a read started by
+ * begin_client_read(), or NULL if the list is empty.
+ */
+ClientNode *first_client_node(ClientList *clients) {
+    return __atomic_load_n(&clients->head, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Returns the node following a given node of a ClientList during a read
+ * started by begin_client_read(), or NULL if it is the last.
+ */
+ClientNode *next_client_node(ClientNode *node) {
+    return __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
 }
 
 /*
@@ -153,10 +356,31 @@ void remove_client(ClientList *clients, ClientThread *client) {
 ClientList *init_client_list() {
     ClientList *clients = (ClientList *) malloc(sizeof(ClientList));
     clients->password = NULL;
-    clients->stats = calloc(SERVER_STAT_NUM, sizeof(int));
+    clients->config = NULL;
+    init_token_bucket(&clients->globalBucket, 0, 0);
+    init_stat_counters(&clients->stats, SERVER_STAT_SHARDS);
+    init_histogram(&clients->dispatchLatency);
+    init_histogram(&clients->handlerLatency);
+    init_histogram(&clients->fanoutLatency);
+    memset(&clients->queueLimits, 0, sizeof(QueueLimits));
+    memset(&clients->queueStats, 0, sizeof(QueueStats));
+    memset(&clients->lineLimits, 0, sizeof(LineLimits));
+    memset(&clients->lineStats, 0, sizeof(LineStats));
+    clients->lineLimits.stats = &clients->lineStats;
+    memset(&clients->compressStats, 0, sizeof(CompressStats));
     clients->head = NULL;
+    memset(clients->skipHeads, 0, sizeof(clients->skipHeads));
+    clients->skipHeight = 1;
+    clients->skipSeed = (unsigned int) time(NULL);
+    init_epoch(&clients->epoch);
+    clients->retired = NULL;
+    init_name_index(&clients->names);
+    clients->listPayload = NULL;
     clients->lock = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
     pthread_mutex_init(clients->lock, 0);
+    clients->nameLock = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(clients->nameLock, 0);
+    init_suffix_table(&clients->suffixes);
 
     return clients;
 }
@@ -171,25 +395,90 @@ void set_password(ClientList *clients, char *password) {
     pthread_mutex_unlock(clients->lock);
 }
 
+/*
+ * Sets the config member of a ClientList to a given ServerConfig and sets up
+ * the server wide rate limit, output queue limits and maximum line length
+ * it specifies.
+ */
+void set_config(ClientList *clients, ServerConfig *config) {
+    pthread_mutex_lock(clients->lock);
+    clients->config = config;
+    init_token_bucket(&clients->globalBucket, config->globalRate,
+            config->globalBurst);
+    clients->queueLimits.highWater = config->queueHigh;
+    clients->queueLimits.lowWater = config->queueLow;
+    clients->queueLimits.policy = config->slowPolicy;
+    clients->lineLimits.maxLength = config->maxLineLength;
+    clients->lineLimits.maxOversized = config->maxOversized;
+    pthread_mutex_unlock(clients->lock);
+}
+
 /*
  * Returns a LineList struct containing the names of all clients stored in a
  * ClientList
  */
 LineList *get_names(ClientList *clients) {
-    pthread_mutex_lock(clients->lock);
+    int readSlot = begin_client_read(clients);
     LineList *names = init_line_list();
 
-    ClientNode *currentNode = clients->head;
+    ClientNode *currentNode = first_client_node(clients);
     while (currentNode != NULL) {
         // Append each client name to the list
         add_to_lines(names, currentNode->client->name);
-        currentNode = currentNode->next;
+        currentNode = next_client_node(currentNode);
     }
-    pthread_mutex_unlock(clients->lock);
+    end_client_read(clients, readSlot);
 
     return names;
 }
 
+/*
+ * Builds the LIST:<names> command for a ClientList, where names is a comma
+ * separated list of the printable names of every client in list order.
+ * Must be called with the list's lock held.
+ *
+ * The names are measured first, so the command is built with a single
+ * allocation.
+ */
+static Payload *build_list_payload(ClientList *clients) {
+    size_t length = strlen("LIST:\n");
+    for (ClientNode *node = clients->head; node != NULL; node = node->next) {
+        // Every name but the first is preceded by a comma
+        length += strlen(node->client->printableName)
+                + (node != clients->head);
+    }
+
+    Payload *payload = init_payload(length);
+    char *end = payload->bytes;
+    end += sprintf(end, "LIST:");
+    for (ClientNode *node = clients->head; node != NULL; node = node->next) {
+        end += sprintf(end, node == clients->head ? "%s" : ",%s",
+                node->client->printableName);
+    }
+    *end = '\n';
+
+    return payload;
+}
+
+/*
+ * Returns a reference to the LIST: command naming every client in a
+ * ClientList, to be released by the caller with unref_payload().
+ *
+ * The command is cached until a client joins or leaves, so repeated LIST:
+ * requests share the same bytes without building them again.
+ */
+Payload *get_list_payload(ClientList *clients) {
+    pthread_mutex_lock(clients->lock);
+    if (clients->listPayload == NULL) {
+        clients->listPayload = build_list_payload(clients);
+    }
+    Payload *payload = clients->listPayload;
+    ref_payload(payload);
+    pthread_mutex_unlock(clients->lock);
+
+    return payload;
+}
+
 /*
  * Frees all memory in a ClientList struct as well as the corresponding
  * linked list. (i.e. memory allocated to each node connected to the head
@@ -209,7 +498,16 @@ void free_client_list(ClientList *clients) {
             currentNode = nextNode;
         }
     }
+    while (clients->retired != NULL) {
+        ClientNode *nextNode = clients->retired->retireNext;
+        free_node(clients->retired);
+        clients->retired = nextNode;
+    }
 
+    free_name_index(&clients->names);
+    if (clients->listPayload != NULL) {
+        unref_payload(clients->listPayload);
+    }
     if (clients->password != NULL) {
         free(clients->password);
     }
@@ -218,29 +516,69 @@ void free_client_list(ClientList *clients) {
     pthread_mutex_unlock(clients->lock);
     pthread_mutex_destroy(clients->lock);
     free(clients->lock);
-    free(clients->stats);
+    pthread_mutex_destroy(clients->nameLock);
+    free(clients->nameLock);
+    free_suffix_table(&clients->suffixes);
+    free_stat_counters(&clients->stats);
 
     free(clients);
 }
 
 /*
- * Finds and returns the first client in a ClientList with a given name.
- * If such a client is not found, NULL is returned.
+ * Returns a name for a client asking to be named after a given base name
+ * which no client in a ClientList has, following the same scheme as clients
+ * negotiating a name themselves: the base name, then the base name with 0,
+ * 1, 2... appended. An empty base name is never assigned bare.
+ *
+ * The search starts from the suffix after the last one assigned for the base
+ * name, so a burst of clients with the same base name are each assigned a
+ * name in one lookup rather than trying every taken suffix in turn. The
+ * client holds the base name's SuffixEntry until it is removed from the list
+ * (see remove_client()).
+ *
+ * The caller must hold the list's nameLock, and add the client to the list
+ * under the returned name before releasing it. The returned string should
+ * be freed by the caller.
+ */
+char *assign_client_name(ClientList *clients, ClientThread *client,
+        char *base) {
+    SuffixEntry *entry = hold_suffix_entry(&clients->suffixes, base);
+    client->suffixEntry = entry;
+    int suffix = entry->nextSuffix;
+    if (suffix < 0 && *base == '\0') {
+        suffix = 0;
+    }
+    char *name = (char *) calloc(strlen(base) + MAX_INT_DIGS + 1,
+            sizeof(char));
+
+    while (1) {
+        if (suffix < 0) {
+            strcpy(name, base);
+        } else {
+            sprintf(name, "%s%d", base, suffix);
+        }
+        // A client named it may have chosen the name without assignment
+        if (get_client_by_name(clients, name) == NULL) {
+            break;
+        }
+        suffix++;
+    }
+    entry->nextSuffix = suffix + 1;
+
+    return name;
+}
+
+/*
+ * Finds and returns the client in a ClientList with a given name using the
+ * list's NameIndex. If such a client is not found, NULL is returned.
  */
 ClientThread *get_client_by_name(ClientList *clients, char *name) {
     ClientThread *client = NULL;
     pthread_mutex_lock(clients->lock);
 
-    ClientNode *currentNode = clients->head;
-    while (currentNode != NULL) {
-        // Iterate over the linked list and break if a client with a matching 
-        // name is found
-        char *currentName = currentNode->client->name;
-        if (currentName != NULL && !strcmp(currentName, name)) {
-            client = currentNode->client;
-            break;
-        }
-        currentNode = currentNode->next;
+    ClientNode *node = name_index_find(&clients->names, name);
+    if (node != NULL) {
+        client = node->client;
     }
 
     pthread_mutex_unlock(clients->lock);
@@ -258,52 +596,49 @@ ClientThread *get_client_by_name(ClientList *clients, char *name) {
  *
  * Note that a new line character is appended to the end of the string before 
  * it is sent.
+ *
+ * The string is formatted only once, and shared by every client's output
+ * queue. (see broadcast_payload())
  */
 void send_all_clients(ClientList *clients, char *format, ...) {
-    pthread_mutex_lock(clients->lock);
-    ClientNode *currentNode = clients->head;
+    va_list args;
+    va_start(args, format);
+    Payload *payload = vformat_payload(format, args);
+    va_end(args);
 
-    // Iterate of the linked list, sending the message to each client
+    broadcast_payload(clients, payload);
+    unref_payload(payload);
+}
+
+/*
+ * Queues an already formatted Payload for all ACTIVE clients in a ClientList
+ * with a name that is not NULL. Each client's queue takes a reference to the
+ * payload rather than a copy of it. The caller keeps its own reference.
+ *
+ * The list is read without taking its lock (see begin_client_read()), so
+ * broadcasts run concurrently with each other and with joins and leaves.
+ * The time taken is recorded in the list's fanoutLatency.
+ */
+void broadcast_payload(ClientList *clients, Payload *payload) {
+    long long start = now_ns();
+    long reached = 0;
+    trace_event(TRACE_BROADCAST_START, 0);
+    int readSlot = begin_client_read(clients);
+    ClientNode *currentNode = first_client_node(clients);
+
+    // Iterate of the linked list, queueing the message for each client
     while (currentNode != NULL) {
         ClientThread *client = currentNode->client;
         pthread_mutex_lock(client->lock);
         if (client->isActive && client->name != NULL) {
-            va_list args;
-            va_start(args, format);
-            vfprintf(currentNode->client->writeTo, format, args);
-            fprintf(currentNode->client->writeTo, "\n");
-            fflush(currentNode->client->writeTo);
-            va_end(args);
+            send_client_payload(client, payload);
+            reached++;
         }
         pthread_mutex_unlock(client->lock);
-        currentNode = currentNode->next;
+        currentNode = next_client_node(currentNode);
     }
     
-    pthread_mutex_unlock(clients->lock);
+    end_client_read(clients, readSlot);
+    trace_event(TRACE_BROADCAST_END, reached);
+    histogram_record(&clients->fanoutLatency, now_ns() - start);
 }
-
-/*
- * Creates and returns a string representation of a ClientLists' statistics.
- * The format of this string (ignore spaces) is:
- *
- * "server:AUTH:<#AUTH>:NAME:<#NAME>:SAY:<#SAY>:KICK:<#KICK>:LIST:<#LIST>:
- * LEAVE:<#LEAVE>\n"
- *
- * where #SAY etc. are the number of times the client has called the respective
- * commands.
- *
- */
-char *server_stat_line(ClientList *clients) {
-    char *statLine = calloc(
-            strlen("server:AUTH::NAME::SAY::KICK::LIST::LEAVE:\n") 
-            + MAX_DIGS * 6 + 1, sizeof(char));
-
-    int *stats = clients->stats;
-    sprintf(statLine,
-            "server:AUTH:%d:NAME:%d:SAY:%d:KICK:%d:LIST:%d:LEAVE:%d\n",
-            stats[AUTH_COUNT], stats[NAME_COUNT], stats[SAY_COUNT],
-            stats[KICK_COUNT], stats[LIST_COUNT], stats[LEAVE_COUNT]);
-
-    return statLine;
-}
-
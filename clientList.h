@@ -4,6 +4,16 @@
 #include "clientThread.h"
 #include "clientList.h"
 #include "lineList.h"
+#include "serverConfig.h"
+#include "rateLimit.h"
+#include "outQueue.h"
+#include "lineLimit.h"
+#include "compress.h"
+#include "nameIndex.h"
+#include "suffixTable.h"
+#include "epoch.h"
+#include "statCounters.h"
+#include "histogram.h"
 
 /* 
  * Indices for the statistics values of the stats member of a ClientList or
@@ -18,11 +28,20 @@ typedef enum {
     LEAVE_COUNT
 } StatIndices;
 
-typedef struct ClientNode ClientNode;
+/* Number of different commands a server should store statistics for */
+#define SERVER_STAT_NUM 6
+
+/* Maximum number of levels of a ClientList's skip list */
+#define MAX_SKIP_HEIGHT 24
 
 /*
  * Struct representing a node in a doubly linked list used to store
  * ClientThread structs.
+ *
+ * The list is the bottom level of a skip list: nodes may also be linked into
+ * higher, sparser levels which let a node's place in the list be found in
+ * O(log n) steps. Every level is doubly linked, so a node can be unlinked
+ * in O(1) expected time once it is known.
  */
 struct ClientNode {
     /* ClientThread struct of the node */
@@ -31,10 +50,34 @@ struct ClientNode {
     ClientNode *prev;
     /* Pointer to the next node */
     ClientNode *next;
+    /* Number of skip list levels the node is in, including the bottom one */
+    int height;
+    /*
+     * Next node at each skip list level above the bottom one, i.e.
+     * skipNext[0] is the next node at level 1. (height - 1 entries)
+     */
+    ClientNode **skipNext;
+    /*
+     * Previous node at each skip list level above the bottom one, NULL for
+     * the first node of a level. Shares skipNext's allocation.
+     */
+    ClientNode **skipPrev;
+    /* Next node in the same bucket of the list's NameIndex */
+    ClientNode *hashNext;
+    /* Next node in the list's retired nodes, once removed from the list */
+    ClientNode *retireNext;
+    /* Epoch the list's EpochSync must reach before a removed node is freed */
+    long retireEpoch;
 };
 
 /*
- * Struct representing a linked list of ClientNodes.
+ * Struct representing a linked list of ClientNodes, sorted by client name
+ * and indexed by a skip list and a NameIndex.
+ *
+ * Changes to the list are serialised by its lock. Readers which only
+ * iterate it (broadcasts, LIST: and the SIGHUP dump) do so without the lock
+ * within begin_client_read() and end_client_read(); removed nodes are freed
+ * once such readers are done with them.
  */
 typedef struct {
     /* 
@@ -42,28 +85,96 @@ typedef struct {
      * This is set by the authfile given to the server.
      */
     char *password;
-    /* Array containing the following statistics about clients in the server:
+    /* Configuration the server was started with */
+    ServerConfig *config;
+    /* Token bucket limiting the rate of commands from all clients together */
+    TokenBucket globalBucket;
+    /* Counters of the following statistics about clients in the server:
      *
      * {#SAY, #KICK, #LIST, #AUTH, #NAME, #LEAVE}
      *
      * where #SAY etc. are the number of times the respective command was
-     * handled by the server from any client
+     * handled by the server from any client. Sharded, as every thread
+     * handling a client counts into them.
      */
-    int *stats;
+    StatCounters stats;
+    /*
+     * Nanoseconds from a command being read from a client's socket to it
+     * being dispatched to its handler, including any rate limiting wait
+     */
+    Histogram dispatchLatency;
+    /* Nanoseconds taken by command handlers */
+    Histogram handlerLatency;
+    /* Nanoseconds taken to queue a broadcast message for every client */
+    Histogram fanoutLatency;
+    /* Watermarks and slow consumer policy of all clients' output queues */
+    QueueLimits queueLimits;
+    /* Counters of the writes and slow consumers of all clients' queues */
+    QueueStats queueStats;
+    /* Maximum length of lines read from clients */
+    LineLimits lineLimits;
+    /* Counters of the oversized lines discarded from all clients */
+    LineStats lineStats;
+    /* Counters of the output compressed for all compressed clients */
+    CompressStats compressStats;
     /* Pointer to the head of the list */
     ClientNode *head;
-    /* Mutex controlling access to the list */
+    /*
+     * First node at each skip list level above the bottom one, i.e.
+     * skipHeads[0] is the first node at level 1
+     */
+    ClientNode *skipHeads[MAX_SKIP_HEIGHT - 1];
+    /* Number of skip list levels in use, including the bottom one */
+    int skipHeight;
+    /* Seed for choosing the heights of new nodes */
+    unsigned int skipSeed;
+    /* Index of the list's nodes by client name */
+    NameIndex names;
+    /*
+     * LIST: command naming every client in the list, or NULL if it must be
+     * rebuilt because a client joined or left since it was built
+     */
+    Payload *listPayload;
+    /* Mutex serialising changes to the list and lookups by name */
     pthread_mutex_t *lock;
+    /* Tracks lock free readers of the list so removed nodes are freed safely */
+    EpochSync epoch;
+    /*
+     * Nodes removed from the list which readers may still be at, freed once
+     * the epoch has advanced past those readers (see reclaim_clients()).
+     * Guarded by lock.
+     */
+    ClientNode *retired;
+    /*
+     * Mutex serialising the final step of name negotiation, so two clients
+     * negotiating concurrently can never both be given the same name.
+     */
+    pthread_mutex_t *nameLock;
+    /*
+     * Next suffix to assign for each base name clients asked to be assigned
+     * a name after. Guarded by nameLock.
+     */
+    SuffixTable suffixes;
 } ClientList;
 
 ClientList *init_client_list();
 void set_password(ClientList *clients, char *password);
+void set_config(ClientList *clients, ServerConfig *config);
 void free_client_list();
 void add_client(ClientList *clients, ClientThread *client);
 void remove_client(ClientList *clients, ClientThread *client);
+bool reclaim_clients(ClientList *clients);
+void sync_removed_clients(ClientList *clients);
 ClientThread *get_client_by_name(ClientList *clients, char *name);
+char *assign_client_name(ClientList *clients, ClientThread *client,
+        char *base);
 void send_all_clients(ClientList *clients, char *msg, ...);
+void broadcast_payload(ClientList *clients, Payload *payload);
 LineList *get_names(ClientList *clients);
-char *server_stat_line(ClientList *clients);
+Payload *get_list_payload(ClientList *clients);
+int begin_client_read(ClientList *clients);
+void end_client_read(ClientList *clients, int readSlot);
+ClientNode *first_client_node(ClientList *clients);
+ClientNode *next_client_node(ClientNode *node);
 
 #endif
@@ -3,60 +3,131 @@
 #include <string.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include "clientThread.h"
 #include "clientList.h"
+#include "eventLoop.h"
+#include "commands.h"
+
+/* Number of ClientThreads, i.e. client connections, currently open */
+static long openClients = 0;
 
-/* Number of digits in the largest number an int can store (65535) */
-#define MAX_DIGS 5
-/* 
- * Number of different commands a server should store statistics per each 
- * connected client 
- */
-#define CLIENT_STAT_NUM 3
 /*
  * Creates a new ClientThread struct, initialize default values for its members
- * and returns pointer to it.
+ * and returns pointer to it. The client is read from through the given
+ * Connection, or by an event loop if it is NULL.
  */
-ClientThread *init_client_thread(FILE *readFrom, FILE *writeTo) {
+ClientThread *init_client_thread(Connection *reader) {
     ClientThread *client = (ClientThread *) malloc(sizeof(ClientThread));
     client->isActive = true;
     client->name = NULL;
-    client->stats = calloc(CLIENT_STAT_NUM, sizeof(int));
-    client->readFrom = readFrom;
-    client->writeTo = writeTo;
+    client->printableName = NULL;
+    init_stat_counters(&client->stats, 1);
+    client->reader = reader;
+    client->conn = NULL;
+    client->node = NULL;
+    client->suffixEntry = NULL;
+    client->framed = false;
+    client->compressed = false;
+    init_token_bucket(&client->bucket, 0, 0);
     client->lock = calloc(1, sizeof(pthread_mutex_t));
     pthread_mutex_init(client->lock, 0);
+    __atomic_add_fetch(&openClients, 1, __ATOMIC_RELAXED);
 
     return client;
 }
 
 /*
- * Closes file descriptors used by a ClientThread struct, destroys its mutex
- * member and frees memory allocated to it.
+ * Returns the number of client connections currently open, including those
+ * of clients which have not yet completed their handshake.
+ */
+long count_open_clients() {
+    return __atomic_load_n(&openClients, __ATOMIC_RELAXED);
+}
+
+/*
+ * Destroys the mutex member of a ClientThread struct and frees memory
+ * allocated to it.
+ *
+ * The client's connection is released, and its socket closed by its event
+ * loop once the loop has written what it can of the client's remaining
+ * output.
  */
 void free_client_thread(ClientThread *client) {
     pthread_mutex_lock(client->lock);
     free(client->name);
-    free(client->stats);
-    fclose(client->readFrom);
-    fclose(client->writeTo);
+    free(client->printableName);
+    free_stat_counters(&client->stats);
+    if (client->reader != NULL) {
+        free_connection(client->reader);
+    }
     pthread_mutex_unlock(client->lock);
+    if (client->conn != NULL) {
+        event_conn_release(client->conn);
+    }
     pthread_mutex_destroy(client->lock);
     free(client->lock);
     free(client);
+    __atomic_sub_fetch(&openClients, 1, __ATOMIC_RELAXED);
 }
 
 /*
  * Allocates memory for and sets the name member of a ClientThread struct to
- * a given string.
+ * a given string, along with its printable version so it is only stripped of
+ * non-printable characters once.
  */
 void set_client_name(ClientThread *client, char *name) {
     pthread_mutex_lock(client->lock);
     client->name = (char *) calloc(strlen(name) + 1, sizeof(char));
     strcpy(client->name, name);
+    client->printableName = get_printable(name);
     pthread_mutex_unlock(client->lock);
 }
 
+/*
+ * Switches a client to framing (see frame.h) once it has asked for it and
+ * been sent FRAMED: in reply. Everything it sends afterwards is read as
+ * frames, and everything sent to it afterwards is framed.
+ *
+ * Must be called on the thread reading the client.
+ */
+void set_client_framed(ClientThread *client) {
+    client->framed = true;
+    if (client->reader != NULL) {
+        client->reader->readFramed = true;
+    }
+    event_conn_set_framed(client->conn);
+}
+
+/*
+ * Switches a client to compression once it has asked for it and been sent
+ * COMPRESS: in reply. Everything sent to it afterwards is compressed by a
+ * given Compressor, which its connection takes ownership of.
+ *
+ * Must be called on the thread reading the client.
+ */
+void set_client_compressed(ClientThread *client, Compressor *compressor) {
+    client->compressed = true;
+    event_conn_set_compressed(client->conn, compressor);
+}
+
+/*
+ * Parses a command of a given length read from a client in place into a
+ * CmdView, as a frame body if the client negotiated framing or else as a
+ * line. (see parse_frame() and parse_cmd())
+ *
+ * Returns true if the command was valid, else false.
+ */
+bool parse_client_cmd(ClientThread *client, char *cmd, size_t length,
+        CmdView *view) {
+    if (client->framed) {
+        return parse_frame(cmd, length, SERVER, view);
+    }
+
+    return parse_cmd(cmd, length, SERVER, view);
+}
+
 /* Returns the isActive flag of a ClientThread struct */
 bool get_active_status(ClientThread *client) {
     bool isActive;
@@ -89,52 +160,72 @@ void send_client(ClientThread *client, char *format, ...) {
     va_list args;
     va_start(args, format);
 
-    vfprintf(client->writeTo, format, args);
-    fprintf(client->writeTo, "\n");
-    fflush(client->writeTo);
+    vsend_client(client, format, args);
 
     va_end(args);
 }
 
 /*
- * Wrapper for read_file_line().
- * Reads a line of text sent by a client to a string and returns that string.
- * Also sets a bool flag to true if the read line is completely empty
- * (i.e. only contains EOF). (See read_file_line() in lineList.c)
+ * Version of send_client() taking a va_list of formatting arguments.
+ *
+ * The string is formatted to a Payload and queued on the client's
+ * connection, so this never blocks on a client that is slow to read.
  */
-char *read_client_line(ClientThread *client, bool *isLineEmpty) {
-    char *line = read_file_line(client->readFrom, isLineEmpty);
+void vsend_client(ClientThread *client, char *format, va_list args) {
+    Payload *payload = vformat_payload(format, args);
+    send_client_payload(client, payload);
+    unref_payload(payload);
+}
 
-    return line;
+/*
+ * Queues an already formatted Payload on a client's connection. The caller
+ * keeps its reference to the payload, so one payload can be sent to many
+ * clients.
+ */
+void send_client_payload(ClientThread *client, Payload *payload) {
+    event_conn_send(client->conn, payload);
 }
 
 /*
- * Creates and returns a string representation of a ClientThread's saved
- * statistics.
- *
- * The format of this string is:
- *
- * "<name>:SAY:<#SAY>:KICK:<#KICK>:LIST:<#LIST>\n"
+ * Wrapper for connection_read_line().
+ * Reads a line of text (or a frame's body, once the client negotiated
+ * framing) sent by a client and returns it, setting *length to its length.
+ * The line is a view into the client's read buffer which is only valid until
+ * the next read, and must not be freed.
  *
- * where name is the name of the client and #SAY etc. are the number of times
- * the client has called the respective commands.
- *
- * i.e. for a client John who's sent SAY, KICK and LIST each 3 times, its stat
- * line should be:
- *
- * "John:SAY:3:KICK:3:LIST:3"
+ * If the client closed its connection, or the read failed or timed out,
+ * NULL is returned and a bool flag is set to true.
  */
-char *client_stat_line(ClientThread *client) {
-    pthread_mutex_lock(client->lock);
-    char *statLine = calloc(strlen(client->name)
-            + strlen(":SAY::KICK::LIST:\n")
-            + MAX_DIGS * 3 + 1, sizeof(char)); 
+char *read_client_line(ClientThread *client, size_t *length,
+        bool *isLineEmpty) {
+    char *line;
+    if (connection_read_line(client->reader, &line, length) != READ_LINE) {
+        *isLineEmpty = true;
+        return NULL;
+    }
 
-    int *stats = client->stats;
-    sprintf(statLine, "%s:SAY:%d:KICK:%d:LIST:%d\n", client->name, 
-            stats[SAY_COUNT], stats[KICK_COUNT], stats[LIST_COUNT]);
-
-    pthread_mutex_unlock(client->lock);
+    return line;
+}
 
-    return statLine;
+/*
+ * Sets the time in milliseconds after which reads from a client block no
+ * longer and fail instead. A negative timeout removes the limit.
+ *
+ * Only applies to clients with their own handling thread, as event loop
+ * clients are never read from blocking.
+ */
+void set_client_read_timeout(ClientThread *client, long long timeoutMs) {
+    if (client->reader == NULL) {
+        return;
+    }
+
+    struct timeval timeout;
+    memset(&timeout, 0, sizeof(struct timeval));
+    if (timeoutMs >= 0) {
+        timeout.tv_sec = timeoutMs / 1000;
+        // A zero timeval would mean no limit, so wait at least 1usec
+        timeout.tv_usec = (timeoutMs % 1000) * 1000 + (timeoutMs == 0);
+    }
+    setsockopt(client->reader->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(struct timeval));
 }
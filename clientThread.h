@@ -3,7 +3,26 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <pthread.h>
+#include "rateLimit.h"
+#include "payload.h"
+#include "statCounters.h"
+#include "connection.h"
+#include "commands.h"
+#include "compress.h"
+#include "suffixTable.h"
+
+/* Connection a client's messages are written through (see eventLoop.h) */
+typedef struct EventConn EventConn;
+/* Node holding a client in the server's ClientList (see clientList.h) */
+typedef struct ClientNode ClientNode;
+
+/* 
+ * Number of different commands a server should store statistics per each 
+ * connected client 
+ */
+#define CLIENT_STAT_NUM 3
 
 /*
  * Struct containing information to an individual client being handled
@@ -20,25 +39,57 @@ typedef struct {
     bool isActive;
     /* Name of the client; set by name negotiation */
     char *name; 
+    /*
+     * Name of the client with non-printable characters removed, as it is
+     * sent to other clients and emitted to stdout. (see get_printable())
+     */
+    char *printableName;
     /* 
-     * Array containing the following statistics about the client:
+     * Counters of the following statistics about the client:
      *
      * {#SAY, #KICK, #LIST}
      *
      * where #SAY etc. are the number of times the respective command was sent
-     * by the client
+     * by the client. A single shard, as only the thread handling the client
+     * counts into them.
+     */
+    StatCounters stats;
+    /*
+     * Buffered connection over the client's socket used to receive messages
+     * from the client, or NULL if the client is read from by an event loop.
      */
-    int *stats;
+    Connection *reader;
     /*
-     * File pointer wrapping a file descriptor used to receive messages
-     * from a client.
+     * Event loop connection messages to the client are queued on and
+     * written through, so sending never blocks on the client.
      */
-    FILE *readFrom;
+    EventConn *conn;
     /*
-     * File pointer wrapping a file descriptor used to send messages to a
-     * client.
+     * Whether the client negotiated framing, so its commands are frames
+     * rather than lines (see frame.h). Only changed by the thread reading
+     * the client, during its handshake.
+     */
+    bool framed;
+    /*
+     * Whether the client negotiated compression, so its output is compressed
+     * (see compress.h). Only changed by the thread reading the client,
+     * during its handshake.
+     */
+    bool compressed;
+    /*
+     * Node of the ClientList the client is in, or NULL if it has not been
+     * added to it, so the client can be removed without searching the list.
+     */
+    ClientNode *node;
+    /*
+     * Entry of the ClientList's SuffixTable the client holds if it was
+     * assigned its name (see assign_client_name()), else NULL
+     */
+    SuffixEntry *suffixEntry;
+    /* Token bucket limiting the rate at which the client's commands are
+     * handled. Unlimited until set up from the server's configuration.
      */
-    FILE *writeTo;
+    TokenBucket bucket;
     /*
      * Mutex used to prevent concurrent modification of ClientThread
      * structs.
@@ -46,13 +97,21 @@ typedef struct {
     pthread_mutex_t *lock;
 } ClientThread;
 
-ClientThread *init_client_thread(FILE *readFrom, FILE *writeTo);
+ClientThread *init_client_thread(Connection *reader);
 void free_client_thread(ClientThread *client);
+long count_open_clients();
 void set_client_name(ClientThread *client, char *name);
+void set_client_framed(ClientThread *client);
+void set_client_compressed(ClientThread *client, Compressor *compressor);
+bool parse_client_cmd(ClientThread *client, char *cmd, size_t length,
+        CmdView *view);
 bool get_active_status(ClientThread *client);
 void disable_client(ClientThread *client);
 void send_client(ClientThread *client, char *format, ...);
-char *read_client_line(ClientThread *client, bool *isLineEmpty);
-char *client_stat_line(ClientThread *client);
+void vsend_client(ClientThread *client, char *format, va_list args);
+void send_client_payload(ClientThread *client, Payload *payload);
+char *read_client_line(ClientThread *client, size_t *length,
+        bool *isLineEmpty);
+void set_client_read_timeout(ClientThread *client, long long timeoutMs);
 
 #endif
@@ -26,64 +26,47 @@
 /*
  * The command numbers corresponding to commands a client can receive.
  * This corresponds to the outputs of the function get_cmd_no() from
- * commands.h
+ * commands.h and is generated from CLIENT_COMMANDS.
  */
 typedef enum {
-    WHO,
-    NAME_TAKEN,
-    AUTH,
-    OK,
-    KICK,
-    LIST,
-    MSG,
-    ENTER,
-    LEAVE
+    CLIENT_COMMANDS(CMD_NUMBER)
 } ClientCmdNumbers;
 
 /* 
  * typedef for client command handling functions, used to declare the const 
  * array handlers below
  */
-typedef void (*ClientHandlerFunction)(ClientData *, LineList *);
+typedef void (*ClientHandlerFunction)(ClientData *, CmdView *);
 
-void handle_unused(ClientData *data, LineList *cmdArgs);
-void handle_kick(ClientData *data, LineList *cmdArgs);
-void handle_list(ClientData *data, LineList *cmdArgs);
-void handle_msg(ClientData *data, LineList *cmdArgs);
-void handle_enter(ClientData *data, LineList *cmdArgs);
-void handle_leave(ClientData *data, LineList *cmdArgs);
+void handle_unused(ClientData *data, CmdView *cmd);
+void handle_kick(ClientData *data, CmdView *cmd);
+void handle_list(ClientData *data, CmdView *cmd);
+void handle_msg(ClientData *data, CmdView *cmd);
+void handle_enter(ClientData *data, CmdView *cmd);
+void handle_leave(ClientData *data, CmdView *cmd);
 
 /*
  * Array of pointers to functions for handling commands sent to the client
  * with no input arguments.
  *
  * Each function takes as input arguments a ClientData struct storing data
- * about the current client and a LineList storing the arguments of a
- * received command.
+ * about the current client and a CmdView of a received command.
+ *
+ * The array is generated from CLIENT_COMMANDS and indexed by command number.
  */
-const ClientHandlerFunction handlers[] = {
-        handle_unused,
-        handle_unused,
-        handle_unused,
-        handle_unused,
-        handle_kick,
-        handle_list,
-        handle_msg,
-        handle_enter,
-        handle_leave
-        };
+const ClientHandlerFunction handlers[] = {CLIENT_COMMANDS(CMD_HANDLER)};
 
 /*
- * Handles a command in string form sent to a client by a server.
+ * Handles a command of a given length sent to a client by a server, as a
+ * line or a frame body. The command is parsed in place (see
+ * parse_server_cmd()) and is not freed.
  * All invalid commands are silently ignored.
  */
-void handle_cmd(ClientData *data, char *cmd) {
-    LineList *cmdArgs = cmd_to_lines(cmd, CLIENT);
+void handle_cmd(ClientData *data, char *cmd, size_t length) {
+    CmdView view;
 
-    free(cmd);
-    if (cmdArgs != NULL) {
-        int cmdNo = get_cmd_no(cmdArgs->lines[0], CLIENT);
-        handlers[cmdNo](data, cmdArgs);
+    if (parse_server_cmd(data, cmd, length, &view)) {
+        handlers[view.cmdNo](data, &view);
     }
 }
 
@@ -102,43 +85,56 @@ void handle_cmd(ClientData *data, char *cmd) {
 void authenticate_client(ClientData *data) {
     bool authorized = false;
     bool isLastLine = false;
+    size_t length;
 
     while (!authorized) {
-        char *serverMsg = read_server_line(data, &isLastLine);
-        LineList *cmdArgs = cmd_to_lines(serverMsg, CLIENT);
+        char *serverMsg = read_server_line(data, &length, &isLastLine);
+        CmdView cmd;
 
         if (isLastLine) {
             // Comms error if server disconnects
-            free(serverMsg);
-            free_line_list(cmdArgs);
             disable_client(data, COMMS);
             break;
-        } else if (cmdArgs == NULL || 
-                get_cmd_no(cmdArgs->lines[0], CLIENT) != AUTH) {
+        } else if (!parse_cmd(serverMsg, length, CLIENT, &cmd)
+                || cmd.cmdNo != AUTH) {
             // Ignore messages that aren't AUTH:
-            free(serverMsg);
-            free_line_list(cmdArgs);
             continue;
         }
 
         send_to_server(data, "AUTH:%s", data->password);
-        free(serverMsg);
-        free_line_list(cmdArgs);
         
-        serverMsg = read_server_line(data, &isLastLine);
+        serverMsg = read_server_line(data, &length, &isLastLine);
         // Check if the server responsed with "OK:"
-        if (strcmp(serverMsg, "OK:") || isLastLine) {
-            free(serverMsg);
+        if (isLastLine || strcmp(serverMsg, "OK:")) {
             disable_client(data, FAILED_AUTH);
-            break;
-        } else {
-            // Authentication complete
-            free(serverMsg);
-            break;
         }
+        // Otherwise authentication is complete
+        break;
     }
 }
 
+/*
+ * Handles a server's acknowledgement of the client switching to framing or
+ * compression, which precedes the server's reply to the client's name.
+ *
+ * Returns true if the command was such an acknowledgement, else false.
+ */
+static bool handle_ack(ClientData *data, CmdView *cmd) {
+    Connection *server = data->server;
+
+    if (cmd->cmdNo == FRAMED && server->writeFramed && !server->readFramed) {
+        // Everything the server sends after the acknowledgement is a frame
+        server->readFramed = true;
+        return true;
+    } else if (cmd->cmdNo == COMPRESS && data->askedCompress
+            && server->inflater == NULL) {
+        start_inflating(data, cmd);
+        return true;
+    }
+
+    return false;
+}
+
 /*
  * Performs name negotiation with a server.
  * On receiving a WHO: command, the client responds with a NAME:clientName
@@ -151,6 +147,21 @@ void authenticate_client(ClientData *data) {
  * If the server responded with NAME_TAKEN:, the client increments its clientNo
  * and awaits another WHO: message from the server to repeat the above process.
  *
+ * If the client was run with --assign, it instead responds with an
+ * ASSIGN:clientName command, and the server replies with NAME_ASSIGNED:name
+ * giving a free name for the client, completing name negotiation in one round
+ * trip.
+ *
+ * If the client was run with --framed, it first sends FRAMED: and sends
+ * every later command as a frame (see frame.h). The server acknowledges with
+ * a FRAMED: line, after which it sends frames too.
+ *
+ * If the client was run with --compress, it then asks for compression with a
+ * preset dictionary, and everything after the server's COMPRESS:
+ * acknowledgement is inflated (see compress.h). A server which does not
+ * offer compression sends no acknowledgement, and the client reads its
+ * output uncompressed.
+ *
  * Invalid/unexpected responses from the server are ignored.
  *
  * If the server disconnects during this process, the name negotiation loop
@@ -159,42 +170,56 @@ void authenticate_client(ClientData *data) {
  */
 void name_negotiate(ClientData *data) {
     bool isLineEmpty = false;
+    size_t length;
 
     while (!data->authenticated && !isLineEmpty) {
-        char *serverMsg = read_server_line(data, &isLineEmpty);
-        LineList *cmdArgs = cmd_to_lines(serverMsg, CLIENT);
+        char *serverMsg = read_server_line(data, &length, &isLineEmpty);
+        CmdView cmd;
+        bool valid = !isLineEmpty
+                && parse_server_cmd(data, serverMsg, length, &cmd);
 
         // Check if the server sent WHO: and respond with the client's name
-        if (cmdArgs != NULL && get_cmd_no(cmdArgs->lines[0], CLIENT) == WHO) {
-            send_to_server(data, "NAME:%s", get_name(data));
-            free(serverMsg);
-            free_line_list(cmdArgs);
+        if (valid && cmd.cmdNo == WHO) {
+            if (data->options.framed && !data->server->writeFramed) {
+                start_framing(data);
+            }
+            if (data->options.compress && !data->askedCompress) {
+                request_compression(data);
+            }
+            if (data->options.assign) {
+                send_to_server(data, "ASSIGN:%s", data->name);
+            } else {
+                send_to_server(data, "NAME:%s", get_name(data));
+            }
 
-            // Get the server's next reply
-            serverMsg = read_server_line(data, &isLineEmpty);
-            cmdArgs = cmd_to_lines(serverMsg, CLIENT);
+            // Get the server's reply, reading past its acknowledgements of
+            // framing and compression
+            do {
+                serverMsg = read_server_line(data, &length, &isLineEmpty);
+                valid = !isLineEmpty
+                        && parse_server_cmd(data, serverMsg, length, &cmd);
+            } while (valid && handle_ack(data, &cmd));
 
-            if (cmdArgs == NULL) {
-                free(serverMsg);
+            if (!valid) {
                 continue;
             }
 
-            // Check if the reply was OK: or NAME_TAKEN:
-            int cmdNo = get_cmd_no(cmdArgs->lines[0], CLIENT);
-
-            switch (cmdNo) {
+            // Check if the reply was OK:, NAME_ASSIGNED: or NAME_TAKEN:
+            switch (cmd.cmdNo) {
                 case OK:
                     // Naming is complete
                     data->authenticated = true;
                     break;
+                case NAME_ASSIGNED:
+                    // Naming is complete under the name the server chose
+                    set_assigned_name(data, cmd.fields[1].start);
+                    data->authenticated = true;
+                    break;
                 case NAME_TAKEN:
                     // Increment client number
                     next_client_no(data);
                     break;
             }
-
-            free(serverMsg);
-            free_line_list(cmdArgs);
         }
     }
 
@@ -209,11 +234,9 @@ void name_negotiate(ClientData *data) {
  * Handler for the WHO:, NAME_TAKEN:, AUTH: and OK: commands if they are sent
  * by the server AFTER authentication and name negotiation are complete.
  * 
- * This function does nothing except free the LineList of
- * arguments it is given.
+ * This function does nothing.
  */
-void handle_unused(ClientData *data, LineList *cmdArgs) {
-    free_line_list(cmdArgs);
+void handle_unused(ClientData *data, CmdView *cmd) {
 }
 
 /*
@@ -221,27 +244,25 @@ void handle_unused(ClientData *data, LineList *cmdArgs) {
  * Calls disable_client to disable the client's isActive flag and set its exit
  * code to be that for kicked clients. (See disable_client() in clientData.c)
  */
-void handle_kick(ClientData *data, LineList *cmdArgs) {
-    free_line_list(cmdArgs);
+void handle_kick(ClientData *data, CmdView *cmd) {
     disable_client(data, KICKED);
 }
 
 /*
- * Handler for the LIST: command from a server given a LineList containing
+ * Handler for the LIST: command from a server given a CmdView of
  * the given arguments for that command.
  *
  * Emits "(current chatters: <list of names>)" to stdout where list of names
  * is the string listing all clients in the server as specified by the given 
  * command arguments.
  */
-void handle_list(ClientData *data, LineList *cmdArgs) {
-    printf("(current chatters: %s)\n", cmdArgs->lines[1]);
+void handle_list(ClientData *data, CmdView *cmd) {
+    printf("(current chatters: %s)\n", cmd->fields[1].start);
     fflush(stdout);
-    free_line_list(cmdArgs);
 }
 
 /*
- * Handler for the MSG: command from a server given a LineList containing
+ * Handler for the MSG: command from a server given a CmdView of
  * the given arguments for that command.
  *
  * Emits "<name>: <msg>" to stdout where name and msg are the name of the 
@@ -250,44 +271,41 @@ void handle_list(ClientData *data, LineList *cmdArgs) {
  *
  * Note that empty message bodies are valid.
  */
-void handle_msg(ClientData *data, LineList *cmdArgs) {
-    char *name = cmdArgs->lines[1];
+void handle_msg(ClientData *data, CmdView *cmd) {
+    char *name = cmd->fields[1].start;
 
     // Check for an empty message body
-    if (cmdArgs->numLines > 1) {
-        char *msg = cmdArgs->lines[2];
+    if (cmd->numFields > 2) {
+        char *msg = cmd->fields[2].start;
         printf("%s: %s\n", name, msg);
     } else {
         printf("%s:\n", name);
     }
     fflush(stdout);
-    free_line_list(cmdArgs);
 }
 
 /*
- * Hander for the ENTER: command from a server given a LineList containing
+ * Hander for the ENTER: command from a server given a CmdView of
  * the given arguments for that command.
  *
  * Emits "(<name> has entered the chat)" to stdout where name is the name of 
  * the entering client as specified by the given command arguments.
  */
-void handle_enter(ClientData *data, LineList *cmdArgs) {
-    printf("(%s has entered the chat)\n", cmdArgs->lines[1]);
+void handle_enter(ClientData *data, CmdView *cmd) {
+    printf("(%s has entered the chat)\n", cmd->fields[1].start);
     fflush(stdout);
-    free_line_list(cmdArgs);
 }
 
 /*
- * Hander for the LEAVE: command from a server given a LineList containing
+ * Hander for the LEAVE: command from a server given a CmdView of
  * the given arguments for that command.
  *
  * Emits "(<name> has left the chat)" to stdout where name is the name of 
  * the leaving client as specified by the given command arguments.
  */
-void handle_leave(ClientData *data, LineList *cmdArgs) {
-    printf("(%s has left the chat)\n", cmdArgs->lines[1]);
+void handle_leave(ClientData *data, CmdView *cmd) {
+    printf("(%s has left the chat)\n", cmd->fields[1].start);
     fflush(stdout);
-    free_line_list(cmdArgs);
 }
 
 /*
@@ -327,18 +345,22 @@ void *server_comms_handler(void *arg) {
     }
 
     while (data->isActive) {
-        if (poll_stream(fileno(data->readFrom))) {
+        // Lines already buffered do not make the socket readable
+        if (connection_line_ready(data->server)
+                || poll_stream(data->server->fd)) {
             bool serverLeft = false;
-            char *serverMsg = read_server_line(data, &serverLeft);
+            size_t length;
+            char *serverMsg = read_server_line(data, &length, &serverLeft);
            
             // Break if the last read_server_line call detected that the server
             // is no longer active (see read_server_line in clientData.c)
-            if (serverLeft && data->isActive) {
-                free(serverMsg);
-                disable_client(data, COMMS);
+            if (serverLeft) {
+                if (data->isActive) {
+                    disable_client(data, COMMS);
+                }
                 break;
             }
-            handle_cmd(data, serverMsg);
+            handle_cmd(data, serverMsg, length);
         }
     }
 
@@ -362,19 +384,23 @@ void send_user_msg(ClientData *data, char *msg) {
     // Check if the message is *LEAVE:
     int isLeave = strcmp(msg, "*LEAVE:");
 
+    // Disable the client before the server can close the connection in
+    // reply, so the close is not taken as the server leaving
+    if (!isLeave) {
+        disable_client(data, NORMAL);
+    }
+
     // Check if the message is a command
     if (msg[0] == '*') {
         send_to_server(data, msg + 1);
     } else {
         // Otherwise send the message with a SAY:
-        send_to_server(data, "SAY:%s", msg);
+        send_say_to_server(data, msg);
     }
 
     free(msg);
     
-    // Disable the client if user inputs *LEAVE:
     if (!isLeave) {
-        disable_client(data, NORMAL);
         // Emit leave message
         printf("(%s has left the chat)\n", data->name);
         fflush(stdout);
@@ -437,10 +463,10 @@ void start_client(ClientData *data) {
  * - Exit with the exit code specified by the client's data on terminating
  */
 void end_client(ClientData *data) {
-    pthread_mutex_lock(data->lock);
+    // The lock is not held while joining, as either thread may still be
+    // disabling the client (see disable_client())
     pthread_join(data->serverHandler, NULL);
     pthread_join(data->userHandler, NULL);
-    pthread_mutex_unlock(data->lock);
 
     int exitCode = data->exitCode;
     free_client_data(data);
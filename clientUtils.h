@@ -3,7 +3,7 @@
 
 #include "clientData.h"
 
-void handle_cmd(ClientData *data, char *cmd);
+void handle_cmd(ClientData *data, char *cmd, size_t length);
 void start_client(ClientData *data);
 void end_client(ClientData *data);
 
@@ -2,220 +2,356 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include "commands.h"
+#include "frame.h"
 
-/* Command number of SAY: command as per get_cmd_no() */
-#define SAY 2
-/* Command number of MSG: command as per get_cmd_no() */
-#define MSG 6
-
-/* Strings corresponding to commands that can be sent to a client */
-const char *clientCmdWords[] = {
-        "WHO",
-        "NAME_TAKEN",
-        "AUTH",
-        "OK",
-        "KICK",
-        "LIST",
-        "MSG",
-        "ENTER",
-        "LEAVE"
-        };
+/* Number of bits of the hash of a command word */
+#define CMD_HASH_BITS 6
 
-/* 
- * Max valid number of arguments per command corresponding to each respective
- * command in clientCmdWords.
- */
-const int maxClientCmdLengths[] = {1, 1, 1, 1, 1, 2, 3, 2, 2};
+/* Number of slots in the hash table of each set of commands */
+#define CMD_HASH_SLOTS (1 << CMD_HASH_BITS)
+
+/* Number of hash seeds tried when searching for a perfect hash */
+#define CMD_HASH_SEEDS 4096
 
 /*
- * Minimum valid number of valid arguments per command corresponding to each
- * respective command in clientCmdWords.
+ * Struct describing a command, generated from CLIENT_COMMANDS or
+ * SERVER_COMMANDS in commands.h.
  */
-const int minClientCmdLengths[] = {1, 1, 1, 1, 1, 1, 2, 2, 2};
-
-/* Strings corresponding to commands that can be sent to a server.
- * "NAME" is not included here as name negotiation is handled separately
- * from the other commands. (see server.c)*/
-const char *serverCmdWords[] = {
-        "NAME",
-        "AUTH",
-        "SAY",
-        "KICK",
-        "LIST",
-        "LEAVE"
-        };
+typedef struct {
+    /* Command word */
+    const char *word;
+    /* Length of the command word */
+    size_t length;
+    /* Minimum valid number of fields, including the command word */
+    int minFields;
+    /* Maximum valid number of fields, including the command word */
+    int maxFields;
+    /* Whether the last field may contain ':' characters */
+    bool freeText;
+} CmdDescriptor;
+
+/* Expands to the CmdDescriptor of a command */
+#define CMD_DESCRIPTOR(name, minFields, maxFields, freeText, handler) \
+        {#name, sizeof(#name) - 1, minFields, maxFields, freeText},
+
+/* Descriptors of the commands that can be sent to a client */
+static const CmdDescriptor clientCmds[] = {CLIENT_COMMANDS(CMD_DESCRIPTOR)};
+
+/* Descriptors of the commands that can be sent to a server */
+static const CmdDescriptor serverCmds[] = {SERVER_COMMANDS(CMD_DESCRIPTOR)};
 
 /*
- * Max valid number of arguments per command corresponding to each respective
- * command in serverCmdWords
+ * Struct representing a set of commands and a hash table of their words.
+ *
+ * The table's seed is chosen when it is built so that no two command words
+ * hash to the same slot, so looking up a command compares it against at
+ * most one command word. (see build_cmd_table())
  */
-const int maxServerCmdLengths[] = {2, 2, 2, 2, 1, 1};
+typedef struct {
+    /* Descriptors of the commands, indexed by command number */
+    const CmdDescriptor *cmds;
+    /* Number of commands (less than CMD_HASH_SLOTS) */
+    int count;
+    /* Multiplier of the table's hash function */
+    unsigned int seed;
+    /* Number of the command whose word hashes to each slot, or -1 */
+    signed char slots[CMD_HASH_SLOTS];
+} CmdTable;
 
-/*
- * Minimum valid number of arguments per command corresponding to each
- * respective command in serverCmdWords
+/* 
+ * Commands that can be sent to client and server respectively, indexed by
+ * CmdSentTo.
  */
-const int minServerCmdLengths[] = {1, 1, 1, 2, 1, 1};
+static CmdTable cmdTables[] = {
+        {clientCmds, sizeof(clientCmds) / sizeof(CmdDescriptor)},
+        {serverCmds, sizeof(serverCmds) / sizeof(CmdDescriptor)}
+        };
 
-/* Number of possible commands for client and server respectively*/
-const int cmdCount[] = {9, 6};
+/* Ensures cmdTables is built exactly once (see get_cmd_no()) */
+static pthread_once_t cmdTablesOnce = PTHREAD_ONCE_INIT;
 
-/* 
- * Array of arrays containing valid command words that can be sent to client 
- * and server respectively
+/*
+ * Returns the slot of a command word of a given length in a hash table with
+ * a given seed. The word's length and its first, middle and last characters
+ * are packed into a key, which is hashed by multiplication with the seed.
  */
-const char **cmdWords[] = {clientCmdWords, serverCmdWords};
+static unsigned int hash_cmd_word(const char *word, size_t length,
+        unsigned int seed) {
+    unsigned int key = (unsigned int) length << 24
+            | (unsigned int) (unsigned char) word[0] << 16
+            | (unsigned int) (unsigned char) word[length / 2] << 8
+            | (unsigned char) word[length - 1];
+
+    return (key * seed) >> (32 - CMD_HASH_BITS);
+}
 
 /*
- * Array of arrays containing the max valid number of arguments for client and
- * server commands respectively.
+ * Fills the slots of a CmdTable using a given seed. A command whose slot is
+ * taken goes in the next free slot.
+ *
+ * Returns the number of commands which were not put in their own slot, so 0
+ * if the seed gives a perfect hash of the table's commands.
  */
-const int *maxCmdLengths[] = {maxClientCmdLengths, maxServerCmdLengths};
+static int fill_cmd_table(CmdTable *table, unsigned int seed) {
+    int displaced = 0;
+    table->seed = seed;
+    memset(table->slots, -1, sizeof(table->slots));
+
+    for (int cmdNo = 0; cmdNo < table->count; ++cmdNo) {
+        const CmdDescriptor *cmd = &table->cmds[cmdNo];
+        unsigned int slot = hash_cmd_word(cmd->word, cmd->length, seed);
+        while (table->slots[slot] >= 0) {
+            slot = (slot + 1) & (CMD_HASH_SLOTS - 1);
+            displaced++;
+        }
+        table->slots[slot] = cmdNo;
+    }
+
+    return displaced;
+}
 
 /*
- * Array of arrays containing the minimum valid number of arguments for client
- * and server commands respectively.
+ * Builds the hash table of a CmdTable, searching for a seed which gives a
+ * perfect hash of its commands. Should none be found (i.e. two commands have
+ * the same length and first, middle and last characters), the last seed
+ * tried is kept and lookups fall back to probing the following slots.
  */
-const int *minCmdLengths[] = {minClientCmdLengths, minServerCmdLengths};
+static void build_cmd_table(CmdTable *table) {
+    for (unsigned int i = 0; i < CMD_HASH_SEEDS; ++i) {
+        // Odd multipliers spread the key across the high bits of the hash
+        if (fill_cmd_table(table, (2 * i + 1) * 0x9E3779B1u) == 0) {
+            break;
+        }
+    }
+}
+
+/* Builds the hash tables of both sets of commands */
+static void build_cmd_tables(void) {
+    build_cmd_table(&cmdTables[CLIENT]);
+    build_cmd_table(&cmdTables[SERVER]);
+}
 
 /* 
- * Converts command cmd given as a string to the index of that string
- * in either clientCmdWords or serverCmdWords if it is in the array.
+ * Converts a command word of a given length (which need not be null
+ * terminated) to the number of that command, i.e. its index in either
+ * CLIENT_COMMANDS or SERVER_COMMANDS if it is in the list.
+ *
+ * If sentTo is 0, the word is looked for in CLIENT_COMMANDS whilst if it 
+ * is 1 it is looked for in SERVER_COMMANDS.
  *
- * If sentTo is 0, the string is looked for in clientCmdWords whilst if it 
- * is 1 it is looked for in serverCmdWords.
+ * The word is looked up in a perfect hash table of the commands, so is
+ * compared against at most one command word.
  *
- * If the index is found it is returned, else -1 is returned.
+ * If the command is found its number is returned, else -1 is returned.
  *
  * (This function is adapted from my A3 submission)
  */
-int get_cmd_no(char *cmd, int sentTo) {
-    // Default value is -1, no command matched
-    int matchedCmd = -1;
-   
+int get_cmd_no(const char *word, size_t length, int sentTo) {
     // Check for empty command
-    if (cmd == NULL || strlen(cmd) == 0) {
-        return matchedCmd;
+    if (word == NULL || length == 0) {
+        return -1;
     }
 
-    for (int i = 0; i < cmdCount[sentTo]; ++i) {
-        if (!strcmp(cmd, cmdWords[sentTo][i])) {
-            matchedCmd = i;
-            break;
+    pthread_once(&cmdTablesOnce, build_cmd_tables);
+    CmdTable *table = &cmdTables[sentTo];
+    unsigned int slot = hash_cmd_word(word, length, table->seed);
+
+    int cmdNo;
+    while ((cmdNo = table->slots[slot]) >= 0) {
+        const CmdDescriptor *cmd = &table->cmds[cmdNo];
+        if (cmd->length == length && !memcmp(word, cmd->word, length)) {
+            return cmdNo;
         }
+        slot = (slot + 1) & (CMD_HASH_SLOTS - 1);
     }
 
-    return matchedCmd;
+    return -1;
 }
 
 /*
- * Returns a LineList representation of the arguments of a command given the 
- * command as a string, where each argument delimited by ':' is saved as a 
- * separate entry in the LineList.
- *
- * If a pointer to a bool flag is given (i.e. not NULL), then
- * sets the flag (*invalidCmd) to true if the command is missing a terminating
- * colon where required.
- *
- * (This function is adapted from my A3 submission)
+ * Adds the field starting at *pos to a CmdView. The field ends at the next
+ * ':' of the command, which is overwritten with a null character, or at the
+ * end of the command. *pos is moved past the field and its ':'.
  */
-LineList *get_cmd_args(char *cmd, bool *invalidCmd, int sentTo) {
-    // Make a copy of cmd for strtok to work on as strtok modifies strings
-    char *cmdCopy = calloc(strlen(cmd) + 1, sizeof(char));
-    strcpy(cmdCopy, cmd);
-    LineList *cmdLines = init_line_list();
-
-    // reference is used by strtok_r internally for thread safety
-    char *reference;
-    char *token = strtok_r(cmdCopy, ":", &reference);
-    int cmdNo = get_cmd_no(token, sentTo);
-    int maxCmdArgs;
-
-    // Ensure first token is a valid command
-    if (cmdNo < 0) {
-        free(cmdCopy);
-        return cmdLines;
+static void take_field(CmdView *view, char **pos, char *end) {
+    char *start = *pos;
+    char *colon = memchr(start, ':', end - start);
+    char *fieldEnd = colon != NULL ? colon : end;
+
+    view->fields[view->numFields].start = start;
+    view->fields[view->numFields].length = fieldEnd - start;
+    view->numFields++;
+
+    if (colon != NULL) {
+        *colon = '\0';
+        *pos = colon + 1;
     } else {
-        maxCmdArgs = maxCmdLengths[sentTo][cmdNo];
-    }
-
-    int argCount = 1;
-    while (token != NULL) {
-        add_to_lines(cmdLines, token);
-        // Break when enough arguments have been read
-        if (++argCount >= maxCmdArgs) {
-            break;
-        }
-        token = strtok_r(NULL, ":", &reference);
+        *pos = end;
     }
+}
 
-    // Retrieve the part of cmdCopy not operated on by strtok
-    if ((token = strtok_r(NULL, "", &reference)) != NULL) {
-        add_to_lines(cmdLines, token);
-    }
-    free(cmdCopy);
-
-    // Check the command has valid format
-    if (invalidCmd != NULL) {
-        if ((cmdLines->numLines < maxCmdLengths[sentTo][cmdNo]) &&
-                (cmd[strlen(cmd) - 1] != ':')) {
-        // Command invalid if of minimum valid length and doesn't end in ":"
-            *invalidCmd = true;
-        }
+/*
+ * Moves *pos past any ':' characters, as empty fields between colons are
+ * skipped. Returns true if any of the command is left afterwards.
+ */
+static bool skip_colons(char **pos, char *end) {
+    while (*pos < end && **pos == ':') {
+        (*pos)++;
     }
 
-    return cmdLines;
+    return *pos < end;
 }
 
 /*
- * Given a command in string format, converts it to a LineList representation
- * using get_cmd_str(). Also checks if the arguments given are valid for 
- * the command specified. (e.g. MSG: can have empty second argument whilst
- * other commands may not)
+ * Parses a command of a given length in place into a CmdView, whose fields
+ * point into the command rather than copies of it. The ':' ending each field
+ * is overwritten with a null character, so cmd must be writable and
+ * cmd[length] must be a null character.
+ *
+ * Fields are delimited by ':', with empty fields skipped, until the command
+ * has one fewer field than its maximum number of arguments; the rest of the
+ * command is then the last field. (e.g. SAY:a:b has the fields SAY and a:b)
  *
  * If sentTo is 0, the command is checked if it is a valid command a client can
  * receive. If 1, it's check if it's a valid command a server can receive.
+ * A command is invalid if:
+ *  - it has fewer than its maximum number of arguments but does not end in
+ *    ':', or fewer than its minimum number of arguments
+ *  - its last field is not free text (as for SAY: and MSG:) but contains a
+ *    ':', or it has more than its maximum number of arguments (e.g. MSG:
+ *    can have empty second argument whilst other commands may not)
  *
- * Returns the LineList representation of the command if its number of
- * arguments is valid, else returns NULL.
+ * Returns true if the command was valid, else false. No memory is allocated.
  */
-LineList *cmd_to_lines(char *cmd, int sentTo) {
+bool parse_cmd(char *cmd, size_t length, int sentTo, CmdView *view) {
+    char *pos = cmd;
+    char *end = cmd + length;
+    view->cmdNo = -1;
+    view->numFields = 0;
+
     // Ignore empty commands
-    if (cmd == NULL || strlen(cmd) < 1) {
-        return NULL;
+    if (!skip_colons(&pos, end)) {
+        return false;
+    }
+    bool terminated = cmd[length - 1] == ':';
+
+    // Ensure first field is a valid command
+    take_field(view, &pos, end);
+    int cmdNo = get_cmd_no(view->fields[0].start, view->fields[0].length,
+            sentTo);
+    if (cmdNo < 0) {
+        return false;
     }
+    view->cmdNo = cmdNo;
+    const CmdDescriptor *desc = &cmdTables[sentTo].cmds[cmdNo];
+    int maxFields = desc->maxFields;
 
-    bool invalidCmd = false;
-    LineList *parsedCmd = get_cmd_args(cmd, &invalidCmd, sentTo);
+    // Split fields until enough arguments have been read
+    while (view->numFields < maxFields - 1 && skip_colons(&pos, end)) {
+        take_field(view, &pos, end);
+    }
 
-    // Return null if the command was empty
-    if (parsedCmd->numLines < 1) {
-        free_line_list(parsedCmd);
-        return NULL;
+    // The part of the command not split is its last field
+    if (pos < end) {
+        view->fields[view->numFields].start = pos;
+        view->fields[view->numFields].length = end - pos;
+        view->numFields++;
     }
 
-    int cmdNo = get_cmd_no(parsedCmd->lines[0], sentTo);
+    // Command invalid if of less than max length and doesn't end in ":"
+    bool invalidCmd = view->numFields < maxFields && !terminated;
 
-    if ((sentTo == SERVER && cmdNo != SAY) ||
-            (sentTo == CLIENT && cmdNo != MSG)) {
+    if (!desc->freeText) {
         // Check commands apart from SAY: and MSG: do not have additional
         // colons or more than expected arguments
-        if (pattern_match_string(":",
-                parsedCmd->lines[parsedCmd->numLines - 1]) ||
-                parsedCmd->numLines > maxCmdLengths[sentTo][cmdNo]) {
+        CmdField *last = &view->fields[view->numFields - 1];
+        if (memchr(last->start, ':', last->length) != NULL ||
+                view->numFields > maxFields) {
             invalidCmd = true;
         }
     }
 
-    // Check validity of the command
-    if (invalidCmd || cmdNo < 0 ||
-            parsedCmd->numLines < minCmdLengths[sentTo][cmdNo]) {
-        free_line_list(parsedCmd);
-        return NULL;
+    return !invalidCmd && view->numFields >= desc->minFields;
+}
+
+/*
+ * Returns true if a field of a received frame could not have been sent as
+ * the same field of a line, i.e. it is not the free text field of its
+ * command and is empty or contains a ':' or new line. Such fields would
+ * break the lines they are relayed in to clients without framing.
+ */
+static bool bad_frame_field(CmdField *field, bool freeText) {
+    return !freeText && (field->length == 0
+            || memchr(field->start, ':', field->length) != NULL
+            || memchr(field->start, '\n', field->length) != NULL);
+}
+
+/*
+ * Parses the body of a frame (see frame.h) of a given length into a
+ * CmdView, whose fields point into the body rather than copies of it. The
+ * command word (fields[0]) points to the command's name instead.
+ *
+ * Fields are found by their lengths, so the body is only scanned to check
+ * that arguments other than free text hold no ':' or new line (see
+ * bad_frame_field()), which keeps every command relayable as a line.
+ *
+ * A frame is invalid if its command id is not of a command sentTo can
+ * receive, a field's length runs past the end of the body or is not followed
+ * by a null byte, or it has fewer or more fields than its command accepts.
+ * An empty free text field is left out of the CmdView, as it is when parsing
+ * the same command from a line (see parse_cmd()).
+ *
+ * Returns true if the frame was valid, else false. No memory is allocated.
+ */
+bool parse_frame(char *body, size_t length, int sentTo, CmdView *view) {
+    view->cmdNo = -1;
+    view->numFields = 0;
+
+    pthread_once(&cmdTablesOnce, build_cmd_tables);
+    CmdTable *table = &cmdTables[sentTo];
+    if (length == 0 || (unsigned char) body[0] >= table->count) {
+        return false;
+    }
+    view->cmdNo = (unsigned char) body[0];
+    const CmdDescriptor *desc = &table->cmds[view->cmdNo];
+    view->fields[0].start = (char *) desc->word;
+    view->fields[0].length = desc->length;
+    view->numFields = 1;
+
+    size_t offset = 1;
+    while (offset < length) {
+        size_t fieldLength, used;
+        if (view->numFields == desc->maxFields
+                || get_varint(body + offset, length - offset, &fieldLength,
+                &used) != FRAME_OK) {
+            return false;
+        }
+        offset += used;
+        if (fieldLength >= length - offset
+                || body[offset + fieldLength] != '\0') {
+            return false;
+        }
+
+        CmdField *field = &view->fields[view->numFields];
+        field->start = body + offset;
+        field->length = fieldLength;
+        bool freeText = desc->freeText
+                && view->numFields == desc->maxFields - 1;
+        if (bad_frame_field(field, freeText)) {
+            return false;
+        }
+        offset += fieldLength + 1;
+        if (fieldLength > 0) {
+            view->numFields++;
+        } else if (offset < length) {
+            // Only a free text field may be empty, and it is always last
+            return false;
+        }
     }
 
-    return parsedCmd;
+    return view->numFields >= desc->minFields;
 }
 
 /*
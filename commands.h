@@ -5,6 +5,65 @@
 #include "lineList.h"
 #include "stdbool.h"
 
+/*
+ * Table of the commands that can be sent to a client, each given as
+ * X(name, minFields, maxFields, freeText, handler) where:
+ *  - name is the command word, which is also its ClientCmdNumbers constant
+ *  - minFields and maxFields are the minimum and maximum valid numbers of
+ *    fields of the command, including the command word
+ *  - freeText is true if the last field may contain ':' characters
+ *  - handler is the function of clientUtils.c handling the command
+ *
+ * Command numbers, descriptors and handler tables are all generated from
+ * this list, so a command is added by adding a line here (and its handler).
+ * As command numbers are sent as the command ids of frames (see frame.h),
+ * new commands go at the end of the list.
+ */
+#define CLIENT_COMMANDS(X) \
+    X(WHO, 1, 1, false, handle_unused) \
+    X(NAME_TAKEN, 1, 1, false, handle_unused) \
+    X(AUTH, 1, 1, false, handle_unused) \
+    X(OK, 1, 1, false, handle_unused) \
+    X(KICK, 1, 1, false, handle_kick) \
+    X(LIST, 1, 2, false, handle_list) \
+    X(MSG, 2, 3, true, handle_msg) \
+    X(ENTER, 2, 2, false, handle_enter) \
+    X(LEAVE, 2, 2, false, handle_leave) \
+    X(ASSIGN, 1, 1, false, handle_unused) \
+    X(NAME_ASSIGNED, 2, 2, false, handle_unused) \
+    X(FRAMED, 1, 1, false, handle_unused) \
+    X(COMPRESS, 1, 2, false, handle_unused)
+
+/*
+ * Table of the commands that can be sent to a server, in the same form as
+ * CLIENT_COMMANDS with handlers from serverUtils.c.
+ *
+ * NAME:, AUTH:, ASSIGN:, FRAMED: and COMPRESS: have no handler as they are
+ * handled by the handshake of a client. (see handshake.c)
+ */
+#define SERVER_COMMANDS(X) \
+    X(NAME, 1, 2, false, NULL) \
+    X(AUTH, 1, 2, false, NULL) \
+    X(SAY, 1, 2, true, handle_say) \
+    X(KICK, 2, 2, false, handle_kick) \
+    X(LIST, 1, 1, false, handle_list) \
+    X(LEAVE, 1, 1, false, handle_leave) \
+    X(ASSIGN, 1, 2, false, NULL) \
+    X(FRAMED, 1, 1, false, NULL) \
+    X(COMPRESS, 1, 2, false, NULL)
+
+/*
+ * Expands to the enum constant of a command in CLIENT_COMMANDS or
+ * SERVER_COMMANDS, for generating the command numbers.
+ */
+#define CMD_NUMBER(name, minFields, maxFields, freeText, handler) name,
+
+/*
+ * Expands to the handler of a command in CLIENT_COMMANDS or SERVER_COMMANDS,
+ * for generating handler tables indexed by command number.
+ */
+#define CMD_HANDLER(name, minFields, maxFields, freeText, handler) handler,
+
 /*
  * Enum respresenting possible locations to which commands are sent,
  * for use as the sentTo variable passed into get_cmd_master.
@@ -14,9 +73,46 @@ typedef enum {
     CLIENT, SERVER
 } CmdSentTo;
 
-LineList *get_cmd_args(char *cmd, bool *invalidCmd, int sentTo);
-int get_cmd_no(char *cmd, int sentTo);
-LineList *cmd_to_lines(char *cmd, int sentTo);
+/*
+ * Largest number of fields (the command word and its arguments) a parsed
+ * command can have. This is the most arguments any command accepts (MSG:),
+ * which is also enough for the extra field that makes a command with too
+ * many arguments invalid.
+ */
+#define MAX_CMD_FIELDS 3
+
+/*
+ * Struct representing a single field of a parsed command as a span of the
+ * line it was parsed from. The field is also terminated by a null character
+ * so may be used as a string.
+ */
+typedef struct {
+    /* First character of the field */
+    char *start;
+    /* Number of characters in the field */
+    size_t length;
+} CmdField;
+
+/*
+ * Struct representing a command parsed in place by parse_cmd() or
+ * parse_frame(), with fields pointing into the line or frame it was parsed
+ * from rather than copied.
+ *
+ * fields[0] is the command word and fields[1] onwards are its arguments, the
+ * last of which holds the rest of the line.
+ */
+typedef struct {
+    /* Number of the command as per get_cmd_no() */
+    int cmdNo;
+    /* Number of fields in the command, including the command word */
+    int numFields;
+    /* Fields of the command */
+    CmdField fields[MAX_CMD_FIELDS];
+} CmdView;
+
+int get_cmd_no(const char *word, size_t length, int sentTo);
+bool parse_cmd(char *cmd, size_t length, int sentTo, CmdView *view);
+bool parse_frame(char *body, size_t length, int sentTo, CmdView *view);
 char *get_password(char *authPath, bool *invalidAuthFile);
 
 #endif
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "compress.h"
+#include "timing.h"
+
+/* Base 2 logarithm of the deflate window size, negative for a raw stream */
+#define WINDOW_BITS (-15)
+/* zlib's default amount of memory for its internal compression state */
+#define MEM_LEVEL 8
+/* Smallest amount of free space in a Compressor's output for a deflate() */
+#define COMPRESS_CHUNK 4096
+/* Number of compressed bytes a Decompressor reads from its socket at once */
+#define INFLATE_READ_SIZE 4096
+
+/*
+ * Protocol text every preset dictionary starts with. Each name then adds
+ * "\nMSG:<name>:", the prefix of every message it sends.
+ */
+static const char dictionaryBase[] = "LIST:ENTER:LEAVE:KICK:";
+
+/*
+ * Returns the number of bytes a name of a given length adds to a preset
+ * dictionary.
+ */
+static size_t dictionary_entry_size(size_t nameLength) {
+    return strlen("\nMSG:") + nameLength + strlen(":");
+}
+
+/*
+ * Given a comma separated list of names of a given length, returns the
+ * length of its longest prefix of whole names whose preset dictionary (see
+ * build_dictionary()) fits in MAX_DICT_SIZE bytes.
+ */
+size_t fit_dictionary_names(const char *names, size_t length) {
+    size_t size = strlen(dictionaryBase);
+    size_t fitted = 0;
+    size_t start = 0;
+
+    while (start < length) {
+        const char *comma = memchr(names + start, ',', length - start);
+        size_t end = comma != NULL ? (size_t) (comma - names) : length;
+        size += dictionary_entry_size(end - start);
+        if (size > MAX_DICT_SIZE) {
+            break;
+        }
+        fitted = end;
+        start = end + 1;
+    }
+
+    return fitted;
+}
+
+/*
+ * Writes the preset dictionary for a comma separated list of names of a
+ * given length at dest, which must have room for MAX_DICT_SIZE bytes. The
+ * names must have been fitted with fit_dictionary_names().
+ *
+ * Returns the length of the dictionary.
+ */
+size_t build_dictionary(char *dest, const char *names, size_t length) {
+    size_t size = strlen(dictionaryBase);
+    memcpy(dest, dictionaryBase, size);
+
+    size_t start = 0;
+    while (start < length) {
+        const char *comma = memchr(names + start, ',', length - start);
+        size_t end = comma != NULL ? (size_t) (comma - names) : length;
+        memcpy(dest + size, "\nMSG:", strlen("\nMSG:"));
+        size += strlen("\nMSG:");
+        memcpy(dest + size, names + start, end - start);
+        size += end - start;
+        dest[size++] = ':';
+        start = end + 1;
+    }
+
+    return size;
+}
+
+/*
+ * Creates a Compressor compressing at a given zlib level (0-9), starting
+ * with a preset dictionary of a given length, or none if dictLength is 0.
+ * The new stream is counted in the given CompressStats.
+ */
+Compressor *init_compressor(int level, const char *dictionary,
+        size_t dictLength, CompressStats *stats) {
+    Compressor *comp = (Compressor *) calloc(1, sizeof(Compressor));
+    deflateInit2(&comp->stream, level, Z_DEFLATED, WINDOW_BITS, MEM_LEVEL,
+            Z_DEFAULT_STRATEGY);
+    if (dictLength > 0) {
+        deflateSetDictionary(&comp->stream, (const Bytef *) dictionary,
+                dictLength);
+        __atomic_add_fetch(&stats->dictStreams, 1, __ATOMIC_RELAXED);
+    }
+    comp->out = (char *) malloc(COMPRESS_CHUNK);
+    comp->outCap = COMPRESS_CHUNK;
+    comp->outStart = 0;
+    comp->outEnd = 0;
+    comp->stats = stats;
+    __atomic_add_fetch(&stats->streams, 1, __ATOMIC_RELAXED);
+
+    return comp;
+}
+
+/*
+ * Runs deflate() with a given flush mode over a Compressor's current input
+ * until it has all been consumed and flushed as asked, growing the output
+ * buffer as needed.
+ */
+static void deflate_all(Compressor *comp, int flush) {
+    do {
+        if (comp->outCap - comp->outEnd < COMPRESS_CHUNK) {
+            comp->outCap *= 2;
+            comp->out = (char *) realloc(comp->out, comp->outCap);
+        }
+        comp->stream.next_out = (Bytef *) comp->out + comp->outEnd;
+        comp->stream.avail_out = comp->outCap - comp->outEnd;
+        deflate(&comp->stream, flush);
+        comp->outEnd = comp->outCap - comp->stream.avail_out;
+    } while (comp->stream.avail_out == 0);
+}
+
+/*
+ * Compresses the bytes of an array of iovecs, appending them to a
+ * Compressor's unwritten output followed by a sync flush, so the receiver
+ * can inflate all of them from what has been written.
+ *
+ * Returns the number of compressed bytes appended.
+ */
+size_t compress_iovecs(Compressor *comp, struct iovec *iov, int numIov) {
+    long long start = thread_cpu_ns();
+    size_t before = comp->outEnd;
+    size_t bytesIn = 0;
+
+    for (int i = 0; i < numIov; ++i) {
+        comp->stream.next_in = (Bytef *) iov[i].iov_base;
+        comp->stream.avail_in = iov[i].iov_len;
+        deflate_all(comp, Z_NO_FLUSH);
+        bytesIn += iov[i].iov_len;
+    }
+    deflate_all(comp, Z_SYNC_FLUSH);
+
+    size_t bytesOut = comp->outEnd - before;
+    __atomic_add_fetch(&comp->stats->bytesIn, (long) bytesIn,
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&comp->stats->bytesOut, (long) bytesOut,
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&comp->stats->cpuNanos,
+            (long) (thread_cpu_ns() - start), __ATOMIC_RELAXED);
+
+    return bytesOut;
+}
+
+/* Frees memory allocated to a Compressor, which may be NULL */
+void free_compressor(Compressor *comp) {
+    if (comp == NULL) {
+        return;
+    }
+    deflateEnd(&comp->stream);
+    free(comp->out);
+    free(comp);
+}
+
+/*
+ * Creates a Decompressor inflating a stream started with a preset
+ * dictionary of a given length, or none if dictLength is 0.
+ *
+ * Bytes of the stream already read from the socket (i.e. buffered after the
+ * line which started compression) are given as pending, and are inflated
+ * before anything more is read.
+ */
+Decompressor *init_decompressor(const char *dictionary, size_t dictLength,
+        const char *pending, size_t pendingLength) {
+    Decompressor *dec = (Decompressor *) calloc(1, sizeof(Decompressor));
+    inflateInit2(&dec->stream, WINDOW_BITS);
+    if (dictLength > 0) {
+        inflateSetDictionary(&dec->stream, (const Bytef *) dictionary,
+                dictLength);
+    }
+    dec->inCap = pendingLength > INFLATE_READ_SIZE
+            ? pendingLength : INFLATE_READ_SIZE;
+    dec->in = (char *) malloc(dec->inCap);
+    memcpy(dec->in, pending, pendingLength);
+    dec->stream.next_in = (Bytef *) dec->in;
+    dec->stream.avail_in = pendingLength;
+
+    return dec;
+}
+
+/*
+ * Inflates bytes of a Decompressor's stream into a buffer with a given
+ * amount of space, reading compressed bytes from a socket only once those
+ * already read are used up. Blocks until at least one byte is inflated.
+ *
+ * Returns the number of bytes inflated, 0 if the peer closed the connection
+ * or -1 if the read failed or the stream is corrupt (with errno set to
+ * EPROTO).
+ */
+ssize_t inflate_read(Decompressor *dec, int fd, char *dest, size_t space) {
+    while (true) {
+        if (dec->stream.avail_in == 0) {
+            ssize_t numRead = read(fd, dec->in, dec->inCap);
+            if (numRead <= 0) {
+                return numRead;
+            }
+            dec->stream.next_in = (Bytef *) dec->in;
+            dec->stream.avail_in = numRead;
+        }
+
+        dec->stream.next_out = (Bytef *) dest;
+        dec->stream.avail_out = space;
+        int status = inflate(&dec->stream, Z_SYNC_FLUSH);
+        size_t produced = space - dec->stream.avail_out;
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            errno = EPROTO;
+            return -1;
+        } else if (produced > 0) {
+            return produced;
+        }
+    }
+}
+
+/*
+ * Returns true if a Decompressor holds compressed bytes not yet inflated,
+ * which do not make its socket readable.
+ */
+bool inflate_pending(Decompressor *dec) {
+    return dec->stream.avail_in > 0;
+}
+
+/* Frees memory allocated to a Decompressor, which may be NULL */
+void free_decompressor(Decompressor *dec) {
+    if (dec == NULL) {
+        return;
+    }
+    inflateEnd(&dec->stream);
+    free(dec->in);
+    free(dec);
+}
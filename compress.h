@@ -0,0 +1,92 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+/*
+ * Stream compression
+ *
+ * A client may ask during its handshake for everything the server sends it
+ * from then on to be compressed as a single raw deflate stream (see
+ * handshake.c). Output is compressed as it is written (see
+ * out_queue_write()), each batch of messages ending in a sync flush so the
+ * client can inflate every message as soon as it arrives.
+ *
+ * Both ends may start the stream with a preset dictionary built from the
+ * names of the clients in the server when compression was negotiated (see
+ * build_dictionary()), so even the first "MSG:<name>:" prefix of a
+ * connection compresses well.
+ */
+
+/* Largest number of bytes in a preset dictionary */
+#define MAX_DICT_SIZE 4096
+
+/* Default compression level, trading ratio for CPU time */
+#define DEFAULT_COMPRESS_LEVEL 6
+
+/*
+ * Struct counting the output compressed for every connection of a server,
+ * so where compression pays off can be judged. Updated atomically.
+ */
+typedef struct {
+    /* Number of connections which switched to compression */
+    long streams;
+    /* Number of those which started with a preset dictionary */
+    long dictStreams;
+    /* Number of bytes of output compressed */
+    long bytesIn;
+    /* Number of compressed bytes they became */
+    long bytesOut;
+    /* Thread CPU time in nanoseconds spent compressing */
+    long cpuNanos;
+} CompressStats;
+
+/*
+ * Struct representing the compressing end of a connection's deflate stream,
+ * with the compressed bytes not yet written to its socket.
+ */
+typedef struct {
+    /* zlib's deflate stream state */
+    z_stream stream;
+    /* Compressed bytes waiting to be written */
+    char *out;
+    /* Number of bytes allocated to out */
+    size_t outCap;
+    /* Offset in out of the first byte not yet written */
+    size_t outStart;
+    /* Offset in out after the last compressed byte */
+    size_t outEnd;
+    /* Counters the compressor's work is added to */
+    CompressStats *stats;
+} Compressor;
+
+/*
+ * Struct representing the inflating end of a connection's deflate stream,
+ * with the compressed bytes read from its socket but not yet inflated.
+ */
+typedef struct {
+    /* zlib's inflate stream state, whose next_in points into in */
+    z_stream stream;
+    /* Compressed bytes read from the socket */
+    char *in;
+    /* Number of bytes allocated to in */
+    size_t inCap;
+} Decompressor;
+
+size_t fit_dictionary_names(const char *names, size_t length);
+size_t build_dictionary(char *dest, const char *names, size_t length);
+Compressor *init_compressor(int level, const char *dictionary,
+        size_t dictLength, CompressStats *stats);
+size_t compress_iovecs(Compressor *comp, struct iovec *iov, int numIov);
+void free_compressor(Compressor *comp);
+Decompressor *init_decompressor(const char *dictionary, size_t dictLength,
+        const char *pending, size_t pendingLength);
+ssize_t inflate_read(Decompressor *dec, int fd, char *dest, size_t space);
+bool inflate_pending(Decompressor *dec);
+void free_decompressor(Decompressor *dec);
+
+#endif
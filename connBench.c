@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "lineList.h"
+#include "commands.h"
+
+/*
+ * Connection count benchmark for the server.
+ *
+ * Usage: connBench port serverPid count [authfile]
+ *
+ * Opens count connections to a running server, completing authentication
+ * (if an authfile is given) and name negotiation on each, and keeps them all
+ * connected while reading (and discarding) everything the server sends.
+ * The resident memory of the server process is sampled before and after
+ * so the memory used per connection can be reported.
+ *
+ * Run against a server started with and without --event-loop to compare the
+ * two modes, i.e.
+ *
+ *     ./server --event-loop authfile 0 & ./connBench <port> $! 10000
+ */
+
+/* Maximum number of events handled per call to epoll_wait() */
+#define MAX_EVENTS 256
+/* Size of the buffer used to discard server output */
+#define DRAIN_SIZE 65536
+/* Connections are reported on after every multiple of this many */
+#define REPORT_EVERY 1000
+
+/*
+ * Reads a field such as "VmRSS" from /proc/<pid>/status and returns its
+ * value in kB, or -1 if it could not be read.
+ */
+long read_proc_status(int pid, char *field) {
+    char path[64];
+    sprintf(path, "/proc/%d/status", pid);
+    FILE *status = fopen(path, "r");
+    if (status == NULL) {
+        return -1;
+    }
+
+    long value = -1;
+    LineList *lines = file_to_lines(status);
+    fclose(status);
+    for (int i = 0; i < lines->numLines; ++i) {
+        if (!strncmp(lines->lines[i], field, strlen(field))
+                && lines->lines[i][strlen(field)] == ':') {
+            value = atol(lines->lines[i] + strlen(field) + 1);
+        }
+    }
+    free_line_list(lines);
+
+    return value;
+}
+
+/* Connects a blocking socket to the server on localhost at a given port */
+int connect_to_port(char *port) {
+    struct addrinfo *ai = NULL;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo("localhost", port, &hints, &ai)) {
+        return -1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, ai->ai_addr, sizeof(struct sockaddr))) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+
+    return fd;
+}
+
+/*
+ * Reads a line sent by the server one byte at a time (so no bytes after the
+ * line are consumed) into a buffer of a given size.
+ * Returns false on EOF or error.
+ */
+bool read_reply(int fd, char *line, size_t size) {
+    size_t length = 0;
+    char next;
+    while (read(fd, &next, 1) == 1) {
+        if (next == '\n') {
+            line[length] = '\0';
+            return true;
+        }
+        if (length < size - 1) {
+            line[length++] = next;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Authenticates and names a newly connected benchmark client, skipping over
+ * any ENTER:/LEAVE: messages. Returns false if the server rejected the
+ * client.
+ */
+bool handshake(int fd, char *password, int clientNo) {
+    char line[256];
+    char reply[256];
+
+    while (read_reply(fd, line, sizeof(line))) {
+        if (!strcmp(line, "AUTH:")) {
+            sprintf(reply, "AUTH:%s\n", password == NULL ? "" : password);
+        } else if (!strcmp(line, "WHO:")) {
+            sprintf(reply, "NAME:bench%d\n", clientNo);
+        } else if (!strcmp(line, "OK:") || !strcmp(line, "NAME_TAKEN:")) {
+            continue;
+        } else {
+            return false;
+        }
+
+        if (write(fd, reply, strlen(reply)) < 0) {
+            return false;
+        }
+        // The name reply is the last step of the handshake
+        if (!strncmp(reply, "NAME:", strlen("NAME:"))) {
+            return read_reply(fd, line, sizeof(line)) && !strcmp(line, "OK:");
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Reads and discards whatever the server has sent to connections which are
+ * currently readable.
+ */
+void drain(int epollFd, char *buffer) {
+    struct epoll_event events[MAX_EVENTS];
+    int numEvents;
+    while ((numEvents = epoll_wait(epollFd, events, MAX_EVENTS, 0)) > 0) {
+        for (int i = 0; i < numEvents; ++i) {
+            while (read(events[i].data.fd, buffer, DRAIN_SIZE) > 0) {
+                ;
+            }
+        }
+    }
+}
+
+/* Returns the current monotonic time in seconds */
+double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "Usage: connBench port serverPid count [authfile]\n");
+        return 1;
+    }
+
+    int serverPid = atoi(argv[2]);
+    int count = atoi(argv[3]);
+    bool invalidAuthFile = false;
+    char *password = NULL;
+    if (argc == 5) {
+        password = get_password(argv[4], &invalidAuthFile);
+    }
+
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    int epollFd = epoll_create1(0);
+    char *buffer = malloc(DRAIN_SIZE);
+    long rssBefore = read_proc_status(serverPid, "VmRSS");
+    double start = now();
+    int connected = 0;
+
+    printf("connections\tserverRSS(kB)\tthreads\tkB/conn\n");
+    while (connected < count) {
+        int fd = connect_to_port(argv[1]);
+        if (fd < 0 || !handshake(fd, password, connected)) {
+            fprintf(stderr, "connection %d failed: %s\n", connected,
+                    strerror(errno));
+            break;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        connected++;
+
+        drain(epollFd, buffer);
+        if (connected % REPORT_EVERY == 0 || connected == count) {
+            long rss = read_proc_status(serverPid, "VmRSS");
+            printf("%d\t%ld\t%ld\t%.2f\n", connected, rss,
+                    read_proc_status(serverPid, "Threads"),
+                    (double) (rss - rssBefore) / connected);
+            fflush(stdout);
+        }
+    }
+
+    // Let the server finish sending outstanding ENTER: messages
+    double settle = now();
+    while (now() - settle < 1.0) {
+        drain(epollFd, buffer);
+    }
+
+    long rssAfter = read_proc_status(serverPid, "VmRSS");
+    printf("sustained %d connections in %.2fs\n", connected,
+            settle - start);
+    printf("server RSS %ld kB -> %ld kB, %.2f kB per connection\n",
+            rssBefore, rssAfter,
+            connected > 0 ? (double) (rssAfter - rssBefore) / connected : 0);
+
+    free(password);
+    free(buffer);
+
+    return 0;
+}
@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "connection.h"
+#include "lineLimit.h"
+#include "frame.h"
+
+/*
+ * Creates a Connection reading and writing through a given socket file
+ * descriptor, which must be in blocking mode. Lines read are limited to the
+ * length given by a LineLimits, or unlimited if it is NULL.
+ */
+Connection *init_connection(int fd, LineLimits *limits) {
+    Connection *conn = (Connection *) malloc(sizeof(Connection));
+    conn->fd = fd;
+    conn->readBuf = (char *) malloc(CONN_READ_SIZE);
+    conn->readCap = CONN_READ_SIZE;
+    conn->readStart = 0;
+    conn->readEnd = 0;
+    conn->scanned = 0;
+    conn->readClosed = false;
+    conn->limits = limits;
+    conn->discarding = false;
+    conn->numOversized = 0;
+    conn->overLimit = false;
+    conn->readFramed = false;
+    conn->writeFramed = false;
+    conn->discardLeft = 0;
+    conn->badFrame = false;
+    conn->inflater = NULL;
+    conn->writeBuf = (char *) malloc(CONN_WRITE_SIZE);
+    conn->writeLen = 0;
+
+    return conn;
+}
+
+/*
+ * Frees memory allocated to a Connection. Unwritten bytes are discarded and
+ * the socket is left open.
+ */
+void free_connection(Connection *conn) {
+    free_decompressor(conn->inflater);
+    free(conn->readBuf);
+    free(conn->writeBuf);
+    free(conn);
+}
+
+/*
+ * Makes room at the end of a Connection's read buffer for another read by
+ * moving the unreturned bytes to its start, growing the buffer if they fill
+ * it (i.e. the line being read is longer than the buffer).
+ *
+ * One byte is always kept free after the buffered bytes, so a final line
+ * without a new line can still be null terminated. As oversized lines are
+ * discarded before they fill the buffer, it never grows past twice the
+ * maximum line length (or CONN_READ_SIZE).
+ */
+static void make_read_room(Connection *conn) {
+    size_t buffered = conn->readEnd - conn->readStart;
+    if (conn->readStart > 0) {
+        memmove(conn->readBuf, conn->readBuf + conn->readStart, buffered);
+        conn->readStart = 0;
+        conn->readEnd = buffered;
+    }
+
+    if (conn->readEnd + 1 >= conn->readCap) {
+        conn->readCap *= 2;
+        conn->readBuf = (char *) realloc(conn->readBuf, conn->readCap);
+    }
+}
+
+/*
+ * Discards the buffered bytes of an oversized line whose new line has not
+ * arrived yet, so they are dropped as they arrive rather than buffered.
+ */
+static void discard_buffered(Connection *conn) {
+    count_discarded(conn->limits, conn->readEnd - conn->readStart);
+    conn->readStart = 0;
+    conn->readEnd = 0;
+    conn->scanned = 0;
+    conn->discarding = true;
+}
+
+/*
+ * Returns the next line in a Connection's read buffer, without reading from
+ * its socket. The line's new line is replaced by a null character and the
+ * line is marked as returned.
+ *
+ * Once the peer has closed the connection, an unterminated final line is
+ * returned as a full line.
+ *
+ * Lines longer than the connection's maximum line length are skipped and
+ * counted, stopping once the peer has sent too many of them (overLimit).
+ *
+ * Returns NULL if there is no complete line buffered.
+ */
+static char *next_buffered_line(Connection *conn, size_t *length) {
+    while (!conn->overLimit) {
+        char *start = conn->readBuf + conn->readStart;
+        size_t buffered = conn->readEnd - conn->readStart;
+        char *newLine = memchr(start + conn->scanned, '\n',
+                buffered - conn->scanned);
+
+        if (newLine != NULL) {
+            *length = newLine - start;
+        } else if (conn->readClosed && (buffered > 0 || conn->discarding)) {
+            *length = buffered;
+            newLine = start + buffered;
+        } else {
+            if (conn->discarding || line_too_long(conn->limits, buffered)) {
+                discard_buffered(conn);
+            } else {
+                conn->scanned = buffered;
+            }
+            return NULL;
+        }
+
+        size_t lineEnd = buffered > *length ? *length + 1 : *length;
+        conn->readStart += lineEnd;
+        conn->scanned = 0;
+        if (!conn->discarding && !line_too_long(conn->limits, *length)) {
+            *newLine = '\0';
+            return start;
+        }
+
+        // The end of an oversized line, up to its new line, is discarded too
+        count_discarded(conn->limits, lineEnd);
+        conn->discarding = false;
+        conn->overLimit = end_oversized_line(conn->limits,
+                &conn->numOversized);
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the body of the next frame (see frame.h) in a Connection's read
+ * buffer, without reading from its socket, setting *length to the body's
+ * length. The frame is marked as returned.
+ *
+ * Frames with bodies longer than the connection's maximum line length are
+ * skipped and counted like oversized lines, their bytes discarded as they
+ * arrive. A frame whose length is not a valid varint marks the connection
+ * as having a bad frame (badFrame).
+ *
+ * Returns NULL if there is no complete frame buffered.
+ */
+static char *next_buffered_frame(Connection *conn, size_t *length) {
+    while (!conn->overLimit && !conn->badFrame) {
+        char *start = conn->readBuf + conn->readStart;
+        size_t buffered = conn->readEnd - conn->readStart;
+
+        if (conn->discardLeft > 0) {
+            size_t discarded = buffered < conn->discardLeft
+                    ? buffered : conn->discardLeft;
+            count_discarded(conn->limits, discarded);
+            conn->readStart += discarded;
+            conn->discardLeft -= discarded;
+            if (conn->discardLeft > 0) {
+                return NULL;
+            }
+            conn->overLimit = end_oversized_line(conn->limits,
+                    &conn->numOversized);
+            continue;
+        }
+
+        size_t headerLength;
+        FrameStatus status = get_varint(start, buffered, length,
+                &headerLength);
+        if (status == FRAME_INVALID) {
+            conn->badFrame = true;
+        } else if (status == FRAME_PARTIAL) {
+            return NULL;
+        } else if (line_too_long(conn->limits, *length)) {
+            count_discarded(conn->limits, headerLength);
+            conn->readStart += headerLength;
+            conn->discardLeft = *length;
+        } else if (buffered - headerLength >= *length) {
+            conn->readStart += headerLength + *length;
+            return start + headerLength;
+        } else {
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Reads the next line sent through a Connection, blocking until a full line
+ * has arrived (or the socket's receive timeout expires).
+ *
+ * On READ_LINE, *line is set to the line without its new line and *length
+ * to its length. The line is a null terminated view into the connection's
+ * read buffer, which may be modified in place but is only valid until the
+ * next read from the connection.
+ *
+ * Once readFramed is set, frames are read instead: *line is set to the body
+ * of the next frame, which is not null terminated (though its fields are),
+ * and an incomplete frame at the end of the connection is dropped.
+ *
+ * Once inflating (see connection_start_inflating()), bytes read from the
+ * socket are inflated into the read buffer, and a corrupt stream fails the
+ * read.
+ *
+ * Returns whether a line was read, the peer closed the connection, the peer
+ * sent too many oversized lines or the read failed.
+ */
+ReadStatus connection_read_line(Connection *conn, char **line,
+        size_t *length) {
+    while ((*line = conn->readFramed ? next_buffered_frame(conn, length)
+            : next_buffered_line(conn, length)) == NULL) {
+        if (conn->overLimit) {
+            return READ_OVERSIZED;
+        } else if (conn->badFrame) {
+            return READ_ERROR;
+        } else if (conn->readClosed) {
+            return READ_EOF;
+        }
+
+        make_read_room(conn);
+        char *dest = conn->readBuf + conn->readEnd;
+        size_t space = conn->readCap - conn->readEnd - 1;
+        ssize_t numRead = conn->inflater != NULL
+                ? inflate_read(conn->inflater, conn->fd, dest, space)
+                : read(conn->fd, dest, space);
+        if (numRead < 0 && errno != EINTR) {
+            return READ_ERROR;
+        } else if (numRead == 0) {
+            conn->readClosed = true;
+        } else if (numRead > 0) {
+            conn->readEnd += numRead;
+        }
+    }
+
+    return READ_LINE;
+}
+
+/*
+ * Returns true if the next connection_read_line() on a Connection will
+ * return without reading its socket, i.e. a full line (or frame) is already
+ * buffered or the peer has closed the connection (or sent too many oversized
+ * lines).
+ *
+ * As buffered lines do not make the socket readable, this should be checked
+ * before waiting for the socket to become readable with select() or poll().
+ */
+bool connection_line_ready(Connection *conn) {
+    size_t buffered = conn->readEnd - conn->readStart;
+    if (conn->inflater != NULL && inflate_pending(conn->inflater)) {
+        return true;
+    }
+    if (conn->readFramed) {
+        size_t length, headerLength;
+        FrameStatus status = get_varint(conn->readBuf + conn->readStart,
+                buffered, &length, &headerLength);
+        return conn->readClosed || conn->overLimit || status == FRAME_INVALID
+                || (status == FRAME_OK && buffered - headerLength >= length);
+    }
+
+    return conn->readClosed || conn->overLimit
+            || memchr(conn->readBuf + conn->readStart + conn->scanned,
+            '\n', buffered - conn->scanned) != NULL;
+}
+
+/*
+ * Switches a Connection to inflating everything read from its socket from
+ * now on, as a raw deflate stream starting with a preset dictionary of a
+ * given length (none if dictLength is 0).
+ *
+ * Must be called right after reading the line (or frame) the peer started
+ * compressing after: bytes already buffered beyond it are the start of the
+ * stream, so are moved out of the read buffer to be inflated.
+ */
+void connection_start_inflating(Connection *conn, const char *dictionary,
+        size_t dictLength) {
+    conn->inflater = init_decompressor(dictionary, dictLength,
+            conn->readBuf + conn->readStart, conn->readEnd - conn->readStart);
+    conn->readStart = 0;
+    conn->readEnd = 0;
+    conn->scanned = 0;
+}
+
+/*
+ * Writes every byte in a Connection's write buffer to its socket.
+ * Returns false if the socket had an error, else true.
+ */
+bool connection_flush(Connection *conn) {
+    size_t written = 0;
+
+    while (written < conn->writeLen) {
+        ssize_t numWritten = write(conn->fd, conn->writeBuf + written,
+                conn->writeLen - written);
+        if (numWritten < 0 && errno != EINTR) {
+            conn->writeLen = 0;
+            return false;
+        } else if (numWritten > 0) {
+            written += numWritten;
+        }
+    }
+    conn->writeLen = 0;
+
+    return true;
+}
+
+/*
+ * Adds bytes to a Connection's write buffer, writing the buffer to the
+ * socket whenever it fills. The bytes are not necessarily written until
+ * connection_flush() is called.
+ *
+ * Returns false if the socket had an error, else true.
+ */
+bool connection_write(Connection *conn, const char *bytes, size_t length) {
+    while (length > 0) {
+        if (conn->writeLen == CONN_WRITE_SIZE && !connection_flush(conn)) {
+            return false;
+        }
+
+        size_t space = CONN_WRITE_SIZE - conn->writeLen;
+        size_t chunk = length < space ? length : space;
+        memcpy(conn->writeBuf + conn->writeLen, bytes, chunk);
+        conn->writeLen += chunk;
+        bytes += chunk;
+        length -= chunk;
+    }
+
+    return true;
+}
+
+/*
+ * Formats a line given as a formatting string and va_list of arguments in
+ * the manner of vprintf(), appends a new line and writes it through a
+ * Connection, flushing its write buffer.
+ *
+ * The line is formatted directly into the write buffer where it fits.
+ *
+ * Returns false if the socket had an error, else true.
+ */
+bool vconnection_send(Connection *conn, char *format, va_list args) {
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    size_t space = CONN_WRITE_SIZE - conn->writeLen;
+    int length = vsnprintf(conn->writeBuf + conn->writeLen, space, format,
+            argsCopy);
+    va_end(argsCopy);
+
+    bool ok = true;
+    if (length >= 0 && (size_t) length < space) {
+        conn->writeLen += length;
+    } else if (length >= 0) {
+        // The line does not fit in the buffer, so is formatted separately
+        char *line = (char *) calloc(length + 1, sizeof(char));
+        vsnprintf(line, length + 1, format, args);
+        ok = connection_write(conn, line, length);
+        free(line);
+    }
+
+    return ok && connection_write(conn, "\n", 1) && connection_flush(conn);
+}
+
+/*
+ * Writes the frame of a command given as a CmdView (see write_frame())
+ * through a Connection, flushing its write buffer.
+ *
+ * The frame is written directly into the write buffer where it fits.
+ *
+ * Returns false if the socket had an error, else true.
+ */
+bool connection_send_frame(Connection *conn, CmdView *view) {
+    size_t size = frame_size(view);
+    bool ok = true;
+
+    if (size <= CONN_WRITE_SIZE - conn->writeLen) {
+        write_frame(conn->writeBuf + conn->writeLen, view);
+        conn->writeLen += size;
+    } else {
+        // The frame does not fit in the buffer, so is built separately
+        char *frame = (char *) malloc(size);
+        write_frame(frame, view);
+        ok = connection_write(conn, frame, size);
+        free(frame);
+    }
+
+    return ok && connection_flush(conn);
+}
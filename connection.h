@@ -0,0 +1,102 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include "lineLimit.h"
+#include "commands.h"
+#include "compress.h"
+
+/* Initial size of a Connection's read buffer */
+#define CONN_READ_SIZE 4096
+
+/* Size of a Connection's write buffer */
+#define CONN_WRITE_SIZE 4096
+
+/*
+ * Outcomes of reading a line from a Connection
+ */
+typedef enum {
+    /* A line was read */
+    READ_LINE,
+    /* The peer closed the connection and every line sent was read */
+    READ_EOF,
+    /* The peer sent more oversized lines than its LineLimits allow */
+    READ_OVERSIZED,
+    /* The read failed or timed out, or the peer sent an invalid frame */
+    READ_ERROR
+} ReadStatus;
+
+/*
+ * Struct representing a buffered, blocking connection over a socket, which
+ * reads and writes lines of text directly through the socket's file
+ * descriptor.
+ *
+ * Each read() fills as much of the read buffer as the socket has ready, so
+ * many lines are framed per system call, and lines are returned as views
+ * into the buffer rather than copies. Written lines are formatted straight
+ * into the write buffer. Lines longer than a maximum length are discarded
+ * as they arrive.
+ *
+ * The socket is not owned by the Connection and is not closed when it is
+ * freed.
+ */
+typedef struct {
+    /* Socket file descriptor read and written */
+    int fd;
+    /* Bytes read from the socket */
+    char *readBuf;
+    /* Number of bytes allocated to readBuf */
+    size_t readCap;
+    /* Offset in readBuf of the first byte not yet returned in a line */
+    size_t readStart;
+    /* Offset in readBuf after the last byte read */
+    size_t readEnd;
+    /* Number of bytes after readStart known not to contain a new line */
+    size_t scanned;
+    /* Whether the peer has closed its end of the connection */
+    bool readClosed;
+    /* Maximum length of lines read, or NULL for no maximum */
+    LineLimits *limits;
+    /* Whether the rest of the line being read is discarded as too long */
+    bool discarding;
+    /* Number of oversized lines the peer has sent */
+    int numOversized;
+    /* Whether the peer has sent as many oversized lines as it may */
+    bool overLimit;
+    /* Whether frames (see frame.h) are read rather than lines */
+    bool readFramed;
+    /*
+     * Whether the peer reads frames, so commands should be sent with
+     * connection_send_frame() rather than as lines
+     */
+    bool writeFramed;
+    /* Number of bytes of an oversized frame yet to arrive and be discarded */
+    size_t discardLeft;
+    /* Whether the peer sent a frame with an invalid length */
+    bool badFrame;
+    /*
+     * Inflater of the peer's deflate stream once it compresses what it
+     * sends (see compress.h), else NULL
+     */
+    Decompressor *inflater;
+    /* Bytes waiting to be written to the socket */
+    char *writeBuf;
+    /* Number of bytes stored in writeBuf */
+    size_t writeLen;
+} Connection;
+
+Connection *init_connection(int fd, LineLimits *limits);
+void free_connection(Connection *conn);
+ReadStatus connection_read_line(Connection *conn, char **line,
+        size_t *length);
+bool connection_line_ready(Connection *conn);
+void connection_start_inflating(Connection *conn, const char *dictionary,
+        size_t dictLength);
+bool connection_write(Connection *conn, const char *bytes, size_t length);
+bool vconnection_send(Connection *conn, char *format, va_list args);
+bool connection_send_frame(Connection *conn, CmdView *view);
+bool connection_flush(Connection *conn);
+
+#endif
@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <sched.h>
+#include "epoch.h"
+
+/*
+ * Initializes an EpochSync with no readers.
+ */
+void init_epoch(EpochSync *sync) {
+    sync->current = 0;
+    sync->readers[0] = 0;
+    sync->readers[1] = 0;
+}
+
+/*
+ * Starts a read of memory protected by an EpochSync. Memory reachable during
+ * the read is not freed until the matching epoch_exit().
+ *
+ * Returns the slot the reader was counted in, to be given to epoch_exit().
+ */
+int epoch_enter(EpochSync *sync) {
+    while (1) {
+        long epoch = __atomic_load_n(&sync->current, __ATOMIC_SEQ_CST);
+        int slot = epoch & 1;
+        __atomic_add_fetch(&sync->readers[slot], 1, __ATOMIC_SEQ_CST);
+
+        // If the epoch advanced before this reader was counted, a writer may
+        // have missed it, so count it in the new epoch instead
+        if (__atomic_load_n(&sync->current, __ATOMIC_SEQ_CST) == epoch) {
+            return slot;
+        }
+        __atomic_sub_fetch(&sync->readers[slot], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Ends a read started by epoch_enter(), given the slot it returned.
+ */
+void epoch_exit(EpochSync *sync, int slot) {
+    __atomic_sub_fetch(&sync->readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the epoch an EpochSync must reach before memory unlinked before
+ * this call, so no new reader can reach it, may be freed (see
+ * epoch_reached()).
+ */
+long epoch_retire_target(EpochSync *sync) {
+    return __atomic_load_n(&sync->current, __ATOMIC_SEQ_CST) + 2;
+}
+
+/*
+ * Advances an EpochSync as far towards a target epoch (as returned by
+ * epoch_retire_target()) as its readers allow, without waiting for any.
+ *
+ * Returns whether the target was reached, i.e. every reader which started
+ * before the target was taken has exited.
+ */
+bool epoch_reached(EpochSync *sync, long target) {
+    while (1) {
+        long epoch = __atomic_load_n(&sync->current, __ATOMIC_SEQ_CST);
+        if (epoch >= target) {
+            return true;
+        }
+
+        // The epoch before the current one shares the next one's slot
+        if (__atomic_load_n(&sync->readers[(epoch + 1) & 1],
+                __ATOMIC_SEQ_CST) != 0) {
+            return false;
+        }
+        __atomic_compare_exchange_n(&sync->current, &epoch, epoch + 1,
+                false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+}
+
+/*
+ * Waits until every reader of an EpochSync which started before this call
+ * has exited. Must not be called during a read.
+ *
+ * Memory unlinked before this call, so no new reader can reach it, may be
+ * freed once it returns.
+ */
+void epoch_synchronize(EpochSync *sync) {
+    long target = epoch_retire_target(sync);
+
+    while (!epoch_reached(sync, target)) {
+        sched_yield();
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stdbool.h>
+
+/*
+ * Struct used to defer freeing memory which lock free readers may still be
+ * using (epoch based reclamation).
+ *
+ * Readers bracket their reads with epoch_enter() and epoch_exit(). A writer
+ * which has unlinked memory so that no new reader can reach it calls
+ * epoch_synchronize(), which returns once every reader which might have
+ * reached it has exited, after which the memory can be freed. A writer which
+ * must not wait instead notes epoch_retire_target() and frees the memory on
+ * a later pass once epoch_reached() returns true for it.
+ *
+ * Readers are counted per epoch parity. The epoch may only advance once no
+ * readers of the previous epoch remain, so two advances after an unlink
+ * mean every reader from before the unlink is gone.
+ */
+typedef struct {
+    /* Current epoch */
+    long current;
+    /* Number of readers in an even ([0]) or odd ([1]) epoch */
+    long readers[2];
+} EpochSync;
+
+void init_epoch(EpochSync *sync);
+int epoch_enter(EpochSync *sync);
+void epoch_exit(EpochSync *sync, int slot);
+void epoch_synchronize(EpochSync *sync);
+long epoch_retire_target(EpochSync *sync);
+bool epoch_reached(EpochSync *sync, long target);
+
+#endif
@@ -0,0 +1,1009 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "eventLoop.h"
+#include "serverUtils.h"
+#include "clientList.h"
+#include "clientThread.h"
+#include "handshake.h"
+#include "timing.h"
+#include "frame.h"
+
+/* Maximum number of events handled per call to epoll_wait() */
+#define MAX_EVENTS 64
+/* Size of the buffer each event loop reads sockets into */
+#define SCRATCH_SIZE 65536
+
+/*
+ * Milliseconds an event loop waits at most before trying again to free
+ * clients it removed which lock free readers were still at
+ */
+#define RECLAIM_INTERVAL_MS 1
+
+/*
+ * Outcomes of looking for the next command in bytes read from a connection
+ */
+typedef enum {
+    /* A complete command was found */
+    FOUND_CMD,
+    /* An oversized command, or part of one, was discarded */
+    FOUND_DISCARDED,
+    /* The next command has not fully arrived */
+    FOUND_PARTIAL,
+    /* The connection should be closed */
+    FOUND_CLOSE
+} FoundResult;
+
+/*
+ * Outcomes of handling the lines buffered for a connection
+ */
+typedef enum {
+    /* All complete lines were handled */
+    LINES_HANDLED,
+    /* Handling stopped at a command deferred by the rate limits */
+    LINES_DEFERRED,
+    /* The connection should be closed */
+    LINES_CLOSE
+} LinesResult;
+
+static void *run_event_loop(void *arg);
+static bool read_conn(EventLoop *loop, EventConn *conn);
+static void close_conn(EventConn *conn);
+
+/*
+ * Creates numLoops event loops, each with its own epoll instance and thread,
+ * and returns an EventLoopGroup containing them.
+ */
+EventLoopGroup *start_event_loops(ClientList *clients, int numLoops) {
+    EventLoopGroup *group = (EventLoopGroup *) malloc(sizeof(EventLoopGroup));
+    group->loops = (EventLoop *) calloc(numLoops, sizeof(EventLoop));
+    group->numLoops = numLoops;
+    group->nextLoop = 0;
+
+    for (int i = 0; i < numLoops; ++i) {
+        EventLoop *loop = &group->loops[i];
+        loop->epollFd = epoll_create1(0);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK);
+        loop->clients = clients;
+        loop->scratch = (char *) malloc(SCRATCH_SIZE);
+        loop->shakeLock = calloc(1, sizeof(pthread_mutex_t));
+        pthread_mutex_init(loop->shakeLock, 0);
+        loop->pendingLock = calloc(1, sizeof(pthread_mutex_t));
+        pthread_mutex_init(loop->pendingLock, 0);
+
+        // The wake eventfd is told apart from connections by its NULL data
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &event);
+
+        pthread_create(&loop->threadId, NULL, run_event_loop, loop);
+        pthread_detach(loop->threadId);
+    }
+
+    return group;
+}
+
+/*
+ * Wakes an event loop's thread if it is waiting in epoll_wait().
+ */
+static void wake_loop(EventLoop *loop) {
+    uint64_t one = 1;
+    if (write(loop->wakeFd, &one, sizeof(uint64_t)) < 0) {
+        // The counter is already non-zero, so the loop will wake anyway
+    }
+}
+
+/*
+ * Adds a connection to the end of its event loop's handshake list.
+ *
+ * If the list was empty the loop may be waiting without a timeout, so it is
+ * woken to take the new deadline into account.
+ */
+static void link_handshake(EventConn *conn) {
+    EventLoop *loop = conn->loop;
+    pthread_mutex_lock(loop->shakeLock);
+    conn->shakePrev = loop->shakeTail;
+    conn->shakeNext = NULL;
+    bool wasEmpty = loop->shakeTail == NULL;
+    if (!wasEmpty) {
+        loop->shakeTail->shakeNext = conn;
+    } else {
+        loop->shakeHead = conn;
+    }
+    loop->shakeTail = conn;
+    conn->inShakeList = true;
+    pthread_mutex_unlock(loop->shakeLock);
+
+    if (wasEmpty) {
+        wake_loop(loop);
+    }
+}
+
+/*
+ * Removes a connection from its event loop's handshake list if it is in it.
+ */
+static void unlink_handshake(EventConn *conn) {
+    EventLoop *loop = conn->loop;
+    pthread_mutex_lock(loop->shakeLock);
+    if (conn->inShakeList) {
+        if (conn->shakePrev != NULL) {
+            conn->shakePrev->shakeNext = conn->shakeNext;
+        } else {
+            loop->shakeHead = conn->shakeNext;
+        }
+        if (conn->shakeNext != NULL) {
+            conn->shakeNext->shakePrev = conn->shakePrev;
+        } else {
+            loop->shakeTail = conn->shakePrev;
+        }
+        conn->inShakeList = false;
+    }
+    pthread_mutex_unlock(loop->shakeLock);
+}
+
+/*
+ * Creates an EventConn for a client socket on the next event loop of a group
+ * and links it to the socket's ClientThread.
+ */
+static EventConn *init_event_conn(EventLoopGroup *group, int fdClient,
+        ClientThread *client) {
+    EventLoop *loop = &group->loops[group->nextLoop];
+    group->nextLoop = (group->nextLoop + 1) % group->numLoops;
+
+    EventConn *conn = (EventConn *) calloc(1, sizeof(EventConn));
+    conn->fd = fdClient;
+    conn->loop = loop;
+    conn->lock = calloc(1, sizeof(pthread_mutex_t));
+    pthread_mutex_init(conn->lock, 0);
+    init_out_queue(&conn->queue, &loop->clients->queueLimits,
+            &loop->clients->queueStats);
+
+    client->conn = conn;
+    conn->data.clients = loop->clients;
+    conn->data.client = client;
+
+    return conn;
+}
+
+/*
+ * Hands a newly accepted client socket to the next event loop of a group.
+ *
+ * The socket is made non-blocking, a ClientThread is created for it and its
+ * handshake is started (see start_handshake()). All further communication
+ * with the client, including the rest of the handshake, happens on the event
+ * loop's thread so the accept loop never waits on a client.
+ */
+void event_loop_add(EventLoopGroup *group, int fdClient) {
+    fcntl(fdClient, F_SETFL, fcntl(fdClient, F_GETFL) | O_NONBLOCK);
+
+    ClientThread *client = init_client_thread(NULL);
+    EventConn *conn = init_event_conn(group, fdClient, client);
+    EventLoop *loop = conn->loop;
+    init_client_rate(loop->clients, client);
+
+    // The handshake is started before the socket is added to the loop so
+    // nothing is read from the client before its first messages are queued
+    start_handshake(&conn->handshake, loop->clients, client);
+
+    // Once linked or added, the connection may be closed by the loop (when
+    // its deadline passes or the client hangs up), but close_conn() takes
+    // the connection's lock first, so it waits until both are done. The loop
+    // may also already be writing the handshake messages, so the events are
+    // chosen under the lock too.
+    pthread_mutex_lock(conn->lock);
+    if (conn->handshake.deadline >= 0) {
+        link_handshake(conn);
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN | (conn->wantWrite ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+    epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fdClient, &event);
+    conn->registered = true;
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Creates an EventConn through which the output of a client with its own
+ * handling thread is written by the next event loop of a group.
+ *
+ * The given socket is only written by the loop, as the client's thread reads
+ * it; it is closed by the event loop once the client is freed (see
+ * event_conn_release()).
+ */
+EventConn *event_conn_attach(EventLoopGroup *group, int fdClient,
+        ClientThread *client) {
+    EventConn *conn = init_event_conn(group, fdClient, client);
+    conn->ownThread = true;
+
+    return conn;
+}
+
+/*
+ * Updates the events an event loop waits for on a connection's socket:
+ * readability unless the connection is paused or read by its own thread, and
+ * writability if it has queued output.
+ *
+ * Sockets of connections read by their own thread are only registered with
+ * the loop while it waits for writability, so the loop is not woken by the
+ * client's input or hang up.
+ * Must be called with the connection's lock held.
+ */
+static void update_events(EventConn *conn) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = (conn->paused || conn->ownThread ? 0 : EPOLLIN)
+            | (conn->wantWrite ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+
+    int epollFd = conn->loop->epollFd;
+    if (!conn->ownThread) {
+        if (conn->registered) {
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+        }
+    } else if (event.events != 0 && !conn->registered) {
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conn->fd, &event);
+        conn->registered = true;
+    } else if (event.events == 0 && conn->registered) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        conn->registered = false;
+    }
+}
+
+/*
+ * Changes whether an event loop waits for a connection's socket to become
+ * writable.
+ * Must be called with the connection's lock held.
+ */
+static void set_want_write(EventConn *conn, bool wantWrite) {
+    conn->wantWrite = wantWrite;
+    update_events(conn);
+}
+
+/*
+ * Changes whether an event loop reads from a connection's socket.
+ * Must be called on the connection's event loop thread.
+ */
+static void set_paused(EventConn *conn, bool paused) {
+    pthread_mutex_lock(conn->lock);
+    conn->paused = paused;
+    update_events(conn);
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Swaps the connections at two positions of an event loop's deferred heap.
+ */
+static void swap_deferred(EventLoop *loop, int i, int j) {
+    EventConn *temp = loop->deferred[i];
+    loop->deferred[i] = loop->deferred[j];
+    loop->deferred[j] = temp;
+    loop->deferred[i]->deferIndex = i;
+    loop->deferred[j]->deferIndex = j;
+}
+
+/*
+ * Restores the heap order of an event loop's deferred heap around the
+ * connection at a given position after it was added, removed or moved.
+ */
+static void sift_deferred(EventLoop *loop, int index) {
+    EventConn **heap = loop->deferred;
+
+    while (index > 0 &&
+            heap[index]->resumeAt < heap[(index - 1) / 2]->resumeAt) {
+        swap_deferred(loop, index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+
+    while (1) {
+        int smallest = index;
+        for (int child = 2 * index + 1; child <= 2 * index + 2; ++child) {
+            if (child < loop->numDeferred &&
+                    heap[child]->resumeAt < heap[smallest]->resumeAt) {
+                smallest = child;
+            }
+        }
+        if (smallest == index) {
+            break;
+        }
+        swap_deferred(loop, index, smallest);
+        index = smallest;
+    }
+}
+
+/*
+ * Pauses reading from a connection whose next command is deferred by the
+ * rate limits, and schedules it to resume after a given number of
+ * microseconds.
+ */
+static void defer_conn(EventLoop *loop, EventConn *conn, long long wait) {
+    conn->resumeAt = now_ms() + (wait + 999) / 1000;
+    set_paused(conn, true);
+
+    if (loop->numDeferred == loop->deferCap) {
+        loop->deferCap = loop->deferCap * 2 + 1;
+        loop->deferred = (EventConn **) realloc(loop->deferred,
+                loop->deferCap * sizeof(EventConn *));
+    }
+    conn->deferIndex = loop->numDeferred++;
+    loop->deferred[conn->deferIndex] = conn;
+    sift_deferred(loop, conn->deferIndex);
+}
+
+/*
+ * Removes a paused connection from its event loop's deferred heap.
+ */
+static void remove_deferred(EventLoop *loop, EventConn *conn) {
+    int index = conn->deferIndex;
+    swap_deferred(loop, index, --loop->numDeferred);
+    if (index < loop->numDeferred) {
+        sift_deferred(loop, index);
+    }
+}
+
+/*
+ * Adds a connection to its event loop's pending list so the loop writes its
+ * queued output (or frees it, if released) on its next iteration.
+ *
+ * The loop is woken if the list was empty, unless this is the loop's own
+ * thread which handles the list before it next waits.
+ * Must be called with the connection's lock held.
+ */
+static void schedule_flush(EventConn *conn) {
+    EventLoop *loop = conn->loop;
+    conn->flushPending = true;
+
+    pthread_mutex_lock(loop->pendingLock);
+    bool wasEmpty = loop->pendingHead == NULL;
+    conn->nextPending = loop->pendingHead;
+    loop->pendingHead = conn;
+    pthread_mutex_unlock(loop->pendingLock);
+
+    if (wasEmpty && !pthread_equal(pthread_self(), loop->threadId)) {
+        wake_loop(loop);
+    }
+}
+
+/*
+ * Queues a Payload to be sent to the client of a connection. May be called
+ * from any thread, and never waits on the client. The caller keeps its own
+ * reference to the payload.
+ *
+ * The payload is written by the connection's event loop, on its next
+ * iteration if nothing was already queued or else once the socket becomes
+ * writable. Clients which negotiated framing are sent the payload's frame.
+ * Output to broken or released connections is dropped.
+ *
+ * Clients which are slow consumers are handled according to the server's
+ * slow consumer policy (see out_queue_push()). Evicted clients have their
+ * socket shut down, so their reader disconnects them with LEAVE: sent as if
+ * they had left themselves.
+ */
+void event_conn_send(EventConn *conn, Payload *payload) {
+    pthread_mutex_lock(conn->lock);
+
+    if (!conn->broken && !conn->released) {
+        Payload *wire = conn->framed ? get_framed_payload(payload) : payload;
+        PushResult result = wire != NULL
+                ? out_queue_push(&conn->queue, wire) : PUSH_DROPPED;
+        if (result == PUSH_QUEUED && !conn->flushPending
+                && !conn->wantWrite) {
+            schedule_flush(conn);
+        } else if (result == PUSH_EVICT) {
+            conn->broken = true;
+            shutdown(conn->fd, SHUT_RDWR);
+        }
+    }
+
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Switches a connection to framing (see frame.h): every payload queued on it
+ * afterwards is sent as a frame and, if it is read by its event loop, bytes
+ * read after the line being handled are parsed as frames.
+ *
+ * Must be called on the thread reading the client, once the line asking for
+ * framing is handled.
+ */
+void event_conn_set_framed(EventConn *conn) {
+    pthread_mutex_lock(conn->lock);
+    conn->framed = true;
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Switches a connection to compression (see compress.h): every payload
+ * queued on it afterwards is compressed by a given Compressor as it is
+ * written. The connection frees the compressor when it is destroyed.
+ */
+void event_conn_set_compressed(EventConn *conn, Compressor *compressor) {
+    pthread_mutex_lock(conn->lock);
+    compress_out_queue(&conn->queue, compressor);
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Marks a connection's client as gone. May be called from any thread.
+ *
+ * The connection's event loop writes what it can of the remaining queued
+ * output without waiting, then closes the socket and frees the connection.
+ */
+void event_conn_release(EventConn *conn) {
+    pthread_mutex_lock(conn->lock);
+    conn->released = true;
+    if (!conn->flushPending) {
+        schedule_flush(conn);
+    }
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Returns true if writing to a connection failed or its client was evicted
+ * as a slow consumer, so its client is about to be disconnected. May be
+ * called from any thread.
+ */
+bool event_conn_broken(EventConn *conn) {
+    pthread_mutex_lock(conn->lock);
+    bool broken = conn->broken;
+    pthread_mutex_unlock(conn->lock);
+
+    return broken;
+}
+
+/*
+ * Writes as much of a connection's queued output to its socket as it will
+ * accept, and waits for writability only while output remains queued.
+ *
+ * If the socket had an error, the queued output is discarded and the
+ * connection marked broken; its client is disconnected once the connection's
+ * reader sees the error.
+ * Must be called with the connection's lock held.
+ */
+static void flush_conn(EventConn *conn) {
+    if (!out_queue_write(&conn->queue, conn->fd)) {
+        clear_out_queue(&conn->queue);
+        conn->broken = true;
+    }
+
+    bool wantWrite = conn->queue.numBytes > 0;
+    if (wantWrite != conn->wantWrite) {
+        set_want_write(conn, wantWrite);
+    }
+}
+
+/*
+ * Frees a released connection and closes its socket.
+ * Must be called on the connection's event loop thread.
+ */
+static void destroy_conn(EventConn *conn) {
+    if (conn->registered) {
+        epoll_ctl(conn->loop->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    }
+    close(conn->fd);
+    clear_out_queue(&conn->queue);
+    free_compressor(conn->queue.compressor);
+    free(conn->readBuf);
+    pthread_mutex_destroy(conn->lock);
+    free(conn->lock);
+    free(conn);
+}
+
+/*
+ * Handles every connection in an event loop's pending list: queued output is
+ * written, and released connections are freed once what can be written of
+ * their output without waiting has been.
+ */
+static void handle_pending(EventLoop *loop) {
+    pthread_mutex_lock(loop->pendingLock);
+    EventConn *conn = loop->pendingHead;
+    loop->pendingHead = NULL;
+    pthread_mutex_unlock(loop->pendingLock);
+
+    while (conn != NULL) {
+        EventConn *next = conn->nextPending;
+
+        pthread_mutex_lock(conn->lock);
+        conn->flushPending = false;
+        flush_conn(conn);
+        bool released = conn->released;
+        pthread_mutex_unlock(conn->lock);
+
+        if (released) {
+            destroy_conn(conn);
+        }
+        conn = next;
+    }
+}
+
+/*
+ * Handles a single line received from a client.
+ *
+ * Until the client has completed its handshake, the line is its reply to the
+ * last handshake message sent and is passed to handshake_step(). Once the
+ * handshake is done, ENTER: messages are sent for the client.
+ *
+ * Lines from clients which have completed the handshake are handled as
+ * regular commands with handle_cmd().
+ *
+ * The line (of a given length, followed by a null character) or frame body
+ * lies in the connection's read buffer and is parsed in place rather than
+ * copied.
+ * Returns false if the connection should be closed.
+ */
+static bool handle_conn_line(EventConn *conn, char *line, size_t length) {
+    ClientList *clients = conn->data.clients;
+    ClientThread *client = conn->data.client;
+
+    if (conn->handshake.state == HANDSHAKE_DONE) {
+        handle_cmd(&conn->data, line, length, conn->readAt);
+        return get_active_status(client);
+    }
+
+    HandshakeState state = handshake_step(&conn->handshake, clients, client,
+            line, length);
+    if (state == HANDSHAKE_DONE) {
+        unlink_handshake(conn);
+        announce_entry(clients, client);
+    }
+
+    return state != HANDSHAKE_FAILED;
+}
+
+/*
+ * Looks for a line at the start of a buffer of bytes of a given length read
+ * from a connection. If one is found, *line and *lineLength are set to the
+ * line without its new line and *used to the number of bytes it takes up.
+ *
+ * Lines longer than the server's maximum line length are discarded.
+ *
+ * Returns whether a line was found or discarded, the line is incomplete or
+ * the connection should be closed for sending too many oversized lines.
+ */
+static FoundResult find_conn_line(EventConn *conn, char *bytes,
+        size_t length, char **line, size_t *lineLength, size_t *used) {
+    LineLimits *limits = &conn->data.clients->lineLimits;
+    char *newLine = memchr(bytes, '\n', length);
+    if (newLine == NULL) {
+        return FOUND_PARTIAL;
+    }
+
+    *line = bytes;
+    *lineLength = newLine - bytes;
+    *used = *lineLength + 1;
+    if (line_too_long(limits, *lineLength)) {
+        count_discarded(limits, *used);
+        return end_oversized_line(limits, &conn->numOversized)
+                ? FOUND_CLOSE : FOUND_DISCARDED;
+    }
+
+    return FOUND_CMD;
+}
+
+/*
+ * Looks for a frame (see frame.h) at the start of a buffer of bytes of a
+ * given length read from a connection which negotiated framing. If one is
+ * found, *body and *bodyLength are set to the frame's body and *used to the
+ * number of bytes the whole frame takes up.
+ *
+ * Frames with bodies longer than the server's maximum line length are
+ * discarded, including the bytes of them which have not arrived yet.
+ *
+ * Returns whether a frame was found or (part of one) discarded, the frame is
+ * incomplete or the connection should be closed, i.e. for sending too many
+ * oversized frames or an invalid frame length.
+ */
+static FoundResult find_conn_frame(EventConn *conn, char *bytes,
+        size_t length, char **body, size_t *bodyLength, size_t *used) {
+    LineLimits *limits = &conn->data.clients->lineLimits;
+    if (conn->discardLeft > 0) {
+        *used = length < conn->discardLeft ? length : conn->discardLeft;
+        count_discarded(limits, *used);
+        conn->discardLeft -= *used;
+        return conn->discardLeft == 0
+                && end_oversized_line(limits, &conn->numOversized)
+                ? FOUND_CLOSE : FOUND_DISCARDED;
+    }
+
+    size_t headerLength;
+    FrameStatus status = get_varint(bytes, length, bodyLength,
+            &headerLength);
+    if (status == FRAME_INVALID) {
+        return FOUND_CLOSE;
+    } else if (status == FRAME_PARTIAL) {
+        return FOUND_PARTIAL;
+    }
+
+    if (line_too_long(limits, *bodyLength)) {
+        // The body is skipped as it arrives, as lines are while discarding
+        *used = headerLength;
+        count_discarded(limits, headerLength);
+        conn->discardLeft = *bodyLength;
+        return FOUND_DISCARDED;
+    } else if (length - headerLength < *bodyLength) {
+        return FOUND_PARTIAL;
+    }
+
+    *body = bytes + headerLength;
+    *used = headerLength + *bodyLength;
+
+    return FOUND_CMD;
+}
+
+/*
+ * Handles every complete command in a buffer of bytes read from a
+ * connection, which are lines or, once the client has negotiated framing,
+ * frames. Sets *consumed to the number of bytes up to and including the
+ * last command handled.
+ *
+ * Commands longer than the server's maximum line length are discarded, and
+ * the connection closed once it has sent too many of them.
+ *
+ * Before each command of a client which has completed its handshake, a token
+ * is taken from the server's rate limits. If none is available, the
+ * connection is deferred and handling stops at that command.
+ */
+static LinesResult handle_conn_lines(EventConn *conn, char *buffer,
+        size_t length, size_t *consumed) {
+    size_t start = 0;
+    *consumed = 0;
+
+    while (start < length) {
+        char *cmd;
+        size_t cmdLength, used;
+        // Framing is switched on by a line, so is checked for each command
+        bool framed = conn->framed;
+        FoundResult found = framed
+                ? find_conn_frame(conn, buffer + start, length - start,
+                &cmd, &cmdLength, &used)
+                : find_conn_line(conn, buffer + start, length - start,
+                &cmd, &cmdLength, &used);
+        if (found == FOUND_PARTIAL) {
+            break;
+        } else if (found == FOUND_CLOSE) {
+            return LINES_CLOSE;
+        }
+
+        if (found == FOUND_CMD && conn->handshake.state == HANDSHAKE_DONE) {
+            long long wait = take_command_token(conn->data.clients,
+                    conn->data.client, now_us());
+            if (wait > 0) {
+                defer_conn(conn->loop, conn, wait);
+                return LINES_DEFERRED;
+            }
+        }
+
+        start += used;
+        *consumed = start;
+        if (found == FOUND_DISCARDED) {
+            continue;
+        }
+
+        // A line's new line is replaced so the line can be used as a string
+        if (!framed) {
+            cmd[cmdLength] = '\0';
+        }
+        if (!handle_conn_line(conn, cmd, cmdLength)) {
+            return LINES_CLOSE;
+        }
+    }
+
+    return LINES_HANDLED;
+}
+
+/*
+ * Stores the bytes of an incomplete line at the start of a connection's read
+ * buffer, growing the buffer if required.
+ */
+static void keep_partial_line(EventConn *conn, char *bytes, size_t length) {
+    if (length > conn->readCap) {
+        conn->readCap = length * 2;
+        conn->readBuf = (char *) realloc(conn->readBuf, conn->readCap);
+    }
+    memmove(conn->readBuf, bytes, length);
+    conn->readLen = length;
+}
+
+/*
+ * Appends bytes to the end of a connection's read buffer.
+ */
+static void append_read(EventConn *conn, char *bytes, size_t length) {
+    if (conn->readLen + length > conn->readCap) {
+        conn->readCap = (conn->readLen + length) * 2;
+        conn->readBuf = (char *) realloc(conn->readBuf, conn->readCap);
+    }
+    memcpy(conn->readBuf + conn->readLen, bytes, length);
+    conn->readLen += length;
+}
+
+/*
+ * Handles the complete lines in a buffer of bytes read from a connection and
+ * keeps the unhandled remainder in the connection's read buffer.
+ *
+ * Returns false if the connection should be closed, including once every
+ * line from a client which closed its end of the connection was handled.
+ */
+static bool handle_buffered(EventConn *conn, char *buffer, size_t length) {
+    size_t consumed;
+    LinesResult result = handle_conn_lines(conn, buffer, length, &consumed);
+    if (result == LINES_CLOSE) {
+        return false;
+    }
+
+    // An incomplete line already over the maximum length is discarded, along
+    // with the rest of it as it arrives (see discard_line_end())
+    LineLimits *limits = &conn->data.clients->lineLimits;
+    if (!conn->framed && result == LINES_HANDLED
+            && line_too_long(limits, length - consumed)) {
+        count_discarded(limits, length - consumed);
+        conn->readLen = 0;
+        conn->discarding = true;
+    } else {
+        keep_partial_line(conn, buffer + consumed, length - consumed);
+    }
+
+    return result == LINES_DEFERRED || !conn->readClosed;
+}
+
+/*
+ * Discards bytes read from a connection up to the new line ending the
+ * oversized line it is sending, then handles the bytes after it.
+ *
+ * Returns false if the connection should be closed.
+ */
+static bool discard_line_end(EventConn *conn, char *bytes, size_t length) {
+    LineLimits *limits = &conn->data.clients->lineLimits;
+    char *newLine = memchr(bytes, '\n', length);
+    if (newLine == NULL) {
+        count_discarded(limits, length);
+        return true;
+    }
+
+    size_t lineEnd = newLine - bytes + 1;
+    count_discarded(limits, lineEnd);
+    conn->discarding = false;
+    if (end_oversized_line(limits, &conn->numOversized)) {
+        return false;
+    }
+
+    return handle_buffered(conn, bytes + lineEnd, length - lineEnd);
+}
+
+/*
+ * Reads available bytes from a connection's socket and handles every
+ * complete line read. Bytes following the last new line are kept until the
+ * rest of their line arrives, unless they are already too long for a line.
+ *
+ * Returns false if the client disconnected, the socket had an error or the
+ * client should otherwise be disconnected.
+ */
+static bool read_conn(EventLoop *loop, EventConn *conn) {
+    ssize_t numRead = read(conn->fd, loop->scratch, SCRATCH_SIZE);
+    if (numRead < 0) {
+        // A hung up socket with nothing left to read will never be readable
+        return !conn->hungUp
+                && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+    }
+    conn->readAt = now_ns();
+
+    if (numRead == 0) {
+        // On EOF, an unterminated final line is handled as a full line
+        conn->readClosed = true;
+        if (conn->discarding) {
+            end_oversized_line(&conn->data.clients->lineLimits,
+                    &conn->numOversized);
+            return false;
+        }
+        if (conn->readLen > 0 && !conn->framed) {
+            append_read(conn, "\n", 1);
+        }
+        return handle_buffered(conn, conn->readBuf, conn->readLen);
+    }
+
+    if (conn->discarding) {
+        return discard_line_end(conn, loop->scratch, numRead);
+    }
+
+    // Join the new bytes onto an incomplete line from previous reads
+    if (conn->readLen > 0) {
+        append_read(conn, loop->scratch, numRead);
+        return handle_buffered(conn, conn->readBuf, conn->readLen);
+    }
+
+    return handle_buffered(conn, loop->scratch, numRead);
+}
+
+/*
+ * Closes a connection on its event loop's thread.
+ *
+ * Clients which had completed their handshake have LEAVE: messages sent for
+ * them and are removed from the server's ClientList. The connection's
+ * ClientThread is freed, once no lock free reader of the list is still at
+ * it, which releases the connection so its socket is closed and its memory
+ * freed once the loop handles its pending list.
+ */
+static void close_conn(EventConn *conn) {
+    ClientList *clients = conn->data.clients;
+    ClientThread *client = conn->data.client;
+
+    pthread_mutex_lock(conn->lock);
+    epoll_ctl(conn->loop->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->registered = false;
+    pthread_mutex_unlock(conn->lock);
+    unlink_handshake(conn);
+    if (conn->paused) {
+        remove_deferred(conn->loop, conn);
+    }
+    disable_client(client);
+
+    if (conn->handshake.state == HANDSHAKE_DONE) {
+        announce_exit(clients, client);
+        // Freeing the client may have to wait for readers still at it, which
+        // the loop must not, so it is left to the loop's later passes
+        remove_client(clients, client);
+        conn->loop->reclaimPending = true;
+    } else {
+        free_client_thread(client);
+    }
+}
+
+/*
+ * Returns the time in milliseconds until the earliest handshake deadline or
+ * deferred command of an event loop's connections, or -1 if there is
+ * neither, for use as the timeout of epoll_wait(). While clients the loop
+ * removed remain to be freed, it is at most RECLAIM_INTERVAL_MS.
+ */
+static int next_deadline_timeout(EventLoop *loop) {
+    long long now = now_ms();
+    long long timeout = -1;
+    pthread_mutex_lock(loop->shakeLock);
+    if (loop->shakeHead != NULL) {
+        timeout = handshake_remaining(&loop->shakeHead->handshake, now);
+    }
+    pthread_mutex_unlock(loop->shakeLock);
+
+    if (loop->numDeferred > 0) {
+        long long resume = loop->deferred[0]->resumeAt - now;
+        resume = resume > 0 ? resume : 0;
+        if (timeout < 0 || resume < timeout) {
+            timeout = resume;
+        }
+    }
+    if (loop->reclaimPending &&
+            (timeout < 0 || timeout > RECLAIM_INTERVAL_MS)) {
+        timeout = RECLAIM_INTERVAL_MS;
+    }
+
+    return (int) timeout;
+}
+
+/*
+ * Handles a hang up or error on the socket of a paused connection.
+ *
+ * The connection is not closed yet, as that would drop the lines buffered for
+ * it. Instead its socket is removed from the loop's epoll instance, so the
+ * hang up does not keep waking the loop, and the connection is left to
+ * resume_deferred(), which handles its buffered lines and whatever is left to
+ * read from the socket before closing it.
+ */
+static void hang_up_paused(EventConn *conn) {
+    pthread_mutex_lock(conn->lock);
+    epoll_ctl(conn->loop->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+    conn->registered = false;
+    conn->hungUp = true;
+    pthread_mutex_unlock(conn->lock);
+}
+
+/*
+ * Resumes every paused connection of an event loop whose deferred command is
+ * due, handling the lines buffered for it (which may defer it again).
+ */
+static void resume_deferred(EventLoop *loop) {
+    long long now = now_ms();
+
+    while (loop->numDeferred > 0 && loop->deferred[0]->resumeAt <= now) {
+        EventConn *conn = loop->deferred[0];
+        remove_deferred(loop, conn);
+        set_paused(conn, false);
+
+        bool keepOpen = handle_buffered(conn, conn->readBuf, conn->readLen);
+        // A hung up socket is no longer watched, so it is read here until it
+        // is drained or the connection is deferred again
+        while (keepOpen && conn->hungUp && !conn->paused) {
+            keepOpen = read_conn(loop, conn);
+        }
+        if (!keepOpen) {
+            close_conn(conn);
+        }
+    }
+}
+
+/*
+ * Closes every connection of an event loop whose handshake deadline has
+ * passed. As the handshake list is ordered by deadline, only expired
+ * connections at its head are visited.
+ */
+static void expire_handshakes(EventLoop *loop) {
+    long long now = now_ms();
+
+    while (1) {
+        pthread_mutex_lock(loop->shakeLock);
+        EventConn *conn = loop->shakeHead;
+        if (conn == NULL || handshake_remaining(&conn->handshake, now) > 0) {
+            pthread_mutex_unlock(loop->shakeLock);
+            break;
+        }
+        pthread_mutex_unlock(loop->shakeLock);
+
+        close_conn(conn);
+    }
+}
+
+/*
+ * Thread function run by each event loop thread.
+ * Waits for sockets of its connections to become readable or writable and
+ * reads, handles and writes client messages as they do. Connections which do
+ * not complete their handshake in time are closed, connections deferred by
+ * the rate limits are resumed when due, clients removed by the loop are
+ * freed once no reader is at them, and output queued by other threads is
+ * written.
+ */
+static void *run_event_loop(void *arg) {
+    toggle_sighup(0, NULL);
+    EventLoop *loop = (EventLoop *) arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int numEvents = epoll_wait(loop->epollFd, events, MAX_EVENTS,
+                next_deadline_timeout(loop));
+
+        for (int i = 0; i < numEvents; ++i) {
+            EventConn *conn = (EventConn *) events[i].data.ptr;
+            bool keepOpen = true;
+
+            if (conn == NULL) {
+                uint64_t count;
+                if (read(loop->wakeFd, &count, sizeof(uint64_t)) < 0) {
+                    // Spurious wake ups are harmless
+                }
+                continue;
+            }
+
+            if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+                pthread_mutex_lock(conn->lock);
+                flush_conn(conn);
+                pthread_mutex_unlock(conn->lock);
+            }
+            // Paused connections are only woken for errors and hang ups, and
+            // connections with their own thread are read by that thread
+            if (!conn->ownThread && conn->paused &&
+                    (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                hang_up_paused(conn);
+            } else if (!conn->ownThread && !conn->paused &&
+                    (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                keepOpen = read_conn(loop, conn);
+            }
+            if (!keepOpen) {
+                close_conn(conn);
+            }
+        }
+
+        expire_handshakes(loop);
+        resume_deferred(loop);
+        if (loop->reclaimPending) {
+            loop->reclaimPending = reclaim_clients(loop->clients);
+        }
+        handle_pending(loop);
+    }
+
+    return 0;
+}
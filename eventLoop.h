@@ -0,0 +1,194 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "clientList.h"
+#include "serverUtils.h"
+#include "handshake.h"
+#include "outQueue.h"
+
+typedef struct EventLoop EventLoop;
+
+/*
+ * Struct storing the state of a client connection belonging to an event
+ * loop.
+ *
+ * Every client's output is queued on its connection and written by the
+ * connection's event loop with non-blocking writes. In event loop mode the
+ * loop also reads from and handles the connection; input is buffered until
+ * complete lines are available. Clients with their own handling thread
+ * (ownThread) are read from by that thread and only written by the loop.
+ */
+struct EventConn {
+    /* Socket file descriptor the connection is written through */
+    int fd;
+    /*
+     * Whether the client is read from and handled by its own thread rather
+     * than by the event loop
+     */
+    bool ownThread;
+    /* Progress of the client's authentication and name negotiation */
+    Handshake handshake;
+    /*
+     * Previous and next connections in the event loop's list of connections
+     * still in their handshake, which is ordered by handshake deadline.
+     */
+    EventConn *shakePrev;
+    EventConn *shakeNext;
+    /* Whether the connection is in its event loop's handshake list */
+    bool inShakeList;
+    /* Bytes read from the client which do not yet form a complete line */
+    char *readBuf;
+    /* Number of bytes stored in readBuf */
+    size_t readLen;
+    /* Number of bytes allocated to readBuf */
+    size_t readCap;
+    /*
+     * Whether the line being read is longer than the server's maximum line
+     * length, so its bytes are discarded until its new line arrives. Thus
+     * readBuf never holds much more than the maximum line length.
+     */
+    bool discarding;
+    /* Number of oversized lines the client has sent */
+    int numOversized;
+    /*
+     * Whether the client negotiated framing, so its input is parsed and its
+     * output sent as frames (see frame.h)
+     */
+    bool framed;
+    /* Number of bytes of an oversized frame yet to arrive and be discarded */
+    size_t discardLeft;
+    /* Messages waiting to be written to the client */
+    OutQueue queue;
+    /* Whether the loop is currently waiting for the socket to be writable */
+    bool wantWrite;
+    /* Whether the socket is registered with the loop's epoll instance */
+    bool registered;
+    /* Whether the connection is in its event loop's pending list */
+    bool flushPending;
+    /* Next connection in the event loop's pending list */
+    EventConn *nextPending;
+    /* Whether writing to the socket failed, so output is discarded */
+    bool broken;
+    /*
+     * Whether the connection's client is gone; the loop frees the
+     * connection and closes its socket when it next handles its pending list
+     */
+    bool released;
+    /*
+     * Whether reading from the connection is paused because its next
+     * command is deferred by the server's rate limits
+     */
+    bool paused;
+    /* Time (as returned by now_ms()) at which a paused connection resumes */
+    long long resumeAt;
+    /* Index of a paused connection in its event loop's deferred heap */
+    int deferIndex;
+    /*
+     * Whether the client has closed its end of the connection. The
+     * connection is closed once all lines read before that are handled.
+     */
+    bool readClosed;
+    /*
+     * Whether the socket hung up or failed while the connection was paused.
+     * It is no longer watched by the loop, which reads what is left of it
+     * once the connection resumes.
+     */
+    bool hungUp;
+    /*
+     * Time (as returned by now_ns()) of the last read from the socket, which
+     * completed every line buffered for the connection
+     */
+    long long readAt;
+    /* Event loop the connection belongs to */
+    EventLoop *loop;
+    /* ClientList and ClientThread passed to the server's command handlers */
+    ClientThreadData data;
+    /*
+     * Mutex protecting the output queue and the write related flags above,
+     * as any thread may queue messages on any connection
+     */
+    pthread_mutex_t *lock;
+};
+
+/*
+ * Struct representing a single event loop thread and the epoll instance it
+ * waits on.
+ */
+struct EventLoop {
+    /* File descriptor of the loop's epoll instance */
+    int epollFd;
+    /*
+     * eventfd other threads write to in order to wake the loop from
+     * epoll_wait(), i.e. when its earliest deadline changes
+     */
+    int wakeFd;
+    /* ClientList of all clients in the server */
+    ClientList *clients;
+    /*
+     * Buffer the loop reads sockets into. Only bytes not forming a complete
+     * line are copied to a connection's own read buffer, so idle connections
+     * hold no read buffer at all.
+     */
+    char *scratch;
+    /*
+     * Oldest and newest connections still in their handshake. As every
+     * handshake has the same timeout, the oldest has the earliest deadline.
+     */
+    EventConn *shakeHead;
+    EventConn *shakeTail;
+    /* Mutex protecting the handshake list, which the accept loop appends to */
+    pthread_mutex_t *shakeLock;
+    /*
+     * Binary min-heap of paused connections ordered by the time they
+     * resume, so the loop knows how long it may wait for events.
+     */
+    EventConn **deferred;
+    /* Number of connections in the deferred heap */
+    int numDeferred;
+    /* Number of connections the deferred heap has space allocated for */
+    int deferCap;
+    /*
+     * Whether clients this loop removed from the ClientList may still be
+     * waiting to be freed (see reclaim_clients())
+     */
+    bool reclaimPending;
+    /*
+     * Connections which have had messages queued on an empty queue, or have
+     * been released, since the loop last handled them
+     */
+    EventConn *pendingHead;
+    /* Mutex protecting the pending list, which any thread may add to */
+    pthread_mutex_t *pendingLock;
+    /* Thread id of the loop's thread */
+    pthread_t threadId;
+};
+
+/*
+ * Struct representing a fixed set of event loop threads between which new
+ * connections are distributed round-robin.
+ *
+ * In thread-per-client mode the loops only write client output.
+ */
+struct EventLoopGroup {
+    /* Array of event loops */
+    EventLoop *loops;
+    /* Number of event loops */
+    int numLoops;
+    /* Index of the loop the next connection is given to */
+    int nextLoop;
+};
+
+EventLoopGroup *start_event_loops(ClientList *clients, int numLoops);
+void event_loop_add(EventLoopGroup *group, int fdClient);
+EventConn *event_conn_attach(EventLoopGroup *group, int fdClient,
+        ClientThread *client);
+void event_conn_send(EventConn *conn, Payload *payload);
+void event_conn_set_framed(EventConn *conn);
+void event_conn_set_compressed(EventConn *conn, Compressor *compressor);
+void event_conn_release(EventConn *conn);
+bool event_conn_broken(EventConn *conn);
+
+#endif
@@ -0,0 +1,120 @@
+#include <string.h>
+#include "frame.h"
+#include "commands.h"
+
+/* Bits of a value held by each byte of a varint */
+#define VARINT_BITS 7
+/* Bit of a varint byte set if another byte follows it */
+#define VARINT_MORE 0x80
+
+/*
+ * Decodes the varint at the start of a buffer of a given length. On
+ * FRAME_OK, *value is set to the varint's value and *used to the number of
+ * bytes it took up.
+ *
+ * Returns whether the varint was decoded, is incomplete or is invalid.
+ */
+FrameStatus get_varint(const char *bytes, size_t length, size_t *value,
+        size_t *used) {
+    size_t result = 0;
+
+    for (size_t i = 0; i < MAX_VARINT_BYTES; ++i) {
+        if (i == length) {
+            return FRAME_PARTIAL;
+        }
+
+        unsigned char byte = (unsigned char) bytes[i];
+        size_t bits = (size_t) (byte & ~VARINT_MORE);
+        // The last byte of a 64-bit value only holds its top bit
+        if ((bits << (VARINT_BITS * i)) >> (VARINT_BITS * i) != bits) {
+            return FRAME_INVALID;
+        }
+        result |= bits << (VARINT_BITS * i);
+
+        if (!(byte & VARINT_MORE)) {
+            *value = result;
+            *used = i + 1;
+            return FRAME_OK;
+        }
+    }
+
+    return FRAME_INVALID;
+}
+
+/*
+ * Encodes a value as a varint at dest, which must have room for
+ * MAX_VARINT_BYTES bytes.
+ * Returns the number of bytes written.
+ */
+size_t put_varint(char *dest, size_t value) {
+    size_t used = 0;
+
+    while (value >= VARINT_MORE) {
+        dest[used++] = (char) (value | VARINT_MORE);
+        value >>= VARINT_BITS;
+    }
+    dest[used++] = (char) value;
+
+    return used;
+}
+
+/*
+ * Returns the number of bytes in the varint encoding a value.
+ */
+static size_t varint_size(size_t value) {
+    size_t size = 1;
+
+    while (value >= VARINT_MORE) {
+        value >>= VARINT_BITS;
+        size++;
+    }
+
+    return size;
+}
+
+/*
+ * Returns the number of bytes in the body of the frame of a command, i.e.
+ * after its length.
+ */
+static size_t body_size(CmdView *view) {
+    size_t size = 1;
+
+    for (int i = 1; i < view->numFields; ++i) {
+        size_t length = view->fields[i].length;
+        size += varint_size(length) + length + 1;
+    }
+
+    return size;
+}
+
+/*
+ * Returns the number of bytes in the frame of a command (see frame.h),
+ * including its length.
+ */
+size_t frame_size(CmdView *view) {
+    size_t body = body_size(view);
+
+    return varint_size(body) + body;
+}
+
+/*
+ * Writes the frame of a command, given as a CmdView, at dest, which must
+ * have room for frame_size() bytes. The command word (fields[0]) is not
+ * sent, as the frame's command id stands for it.
+ *
+ * Returns a pointer to the byte after the frame.
+ */
+char *write_frame(char *dest, CmdView *view) {
+    dest += put_varint(dest, body_size(view));
+    *dest++ = (char) view->cmdNo;
+
+    for (int i = 1; i < view->numFields; ++i) {
+        CmdField *field = &view->fields[i];
+        dest += put_varint(dest, field->length);
+        memcpy(dest, field->start, field->length);
+        dest += field->length;
+        *dest++ = '\0';
+    }
+
+    return dest;
+}
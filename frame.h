@@ -0,0 +1,51 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "commands.h"
+
+/*
+ * Framed protocol
+ *
+ * Once a client and server have negotiated framing during the handshake
+ * (see handshake.c), each command is sent as a frame instead of a line:
+ *
+ *     <varint body length> <command id> <field>...
+ *
+ * where the command id is a single byte giving the command's number in
+ * CLIENT_COMMANDS or SERVER_COMMANDS, and each of the command's arguments
+ * (the fields after the command word) is sent as
+ *
+ *     <varint field length> <field bytes> <null byte>
+ *
+ * Varints are unsigned LEB128: 7 bits per byte, least significant first,
+ * with the top bit set on every byte but the last.
+ *
+ * Commands are thus found and split by offset rather than by scanning for
+ * new lines and ':', and fields may contain either. The null byte after each
+ * field lets a received field be used in place as a string.
+ */
+
+/* Largest number of bytes in a varint encoding a size_t */
+#define MAX_VARINT_BYTES 10
+
+/*
+ * Outcomes of decoding a varint from received bytes
+ */
+typedef enum {
+    /* The varint was decoded */
+    FRAME_OK,
+    /* The bytes end before the varint does */
+    FRAME_PARTIAL,
+    /* The varint is longer than any size_t, so the peer is misbehaving */
+    FRAME_INVALID
+} FrameStatus;
+
+FrameStatus get_varint(const char *bytes, size_t length, size_t *value,
+        size_t *used);
+size_t put_varint(char *dest, size_t value);
+size_t frame_size(CmdView *view);
+char *write_frame(char *dest, CmdView *view);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "handshake.h"
+#include "serverUtils.h"
+#include "commands.h"
+#include "clientList.h"
+#include "clientThread.h"
+#include "lineList.h"
+#include "timing.h"
+#include "trace.h"
+#include "compress.h"
+#include "payload.h"
+
+/*
+ * Starts the handshake of a newly connected client.
+ *
+ * If the server requires authentication, AUTH: is sent to the client,
+ * otherwise authentication is successful by default and OK: followed by
+ * WHO: are sent.
+ *
+ * The handshake deadline is set from the server's configured handshake
+ * timeout.
+ */
+void start_handshake(Handshake *shake, ClientList *clients,
+        ClientThread *client) {
+    long timeout = clients->config->handshakeTimeout;
+    shake->deadline = timeout > 0 ? now_ms() + timeout : -1;
+
+    if (clients->password != NULL) {
+        shake->state = HANDSHAKE_AUTH;
+        send_client(client, "AUTH:");
+    } else {
+        shake->state = HANDSHAKE_NAME;
+        send_client(client, "OK:");
+        send_client(client, "WHO:");
+    }
+}
+
+/*
+ * Checks a client's reply to an AUTH: challenge, given whether it was a valid
+ * command and if so its CmdView.
+ *
+ * Returns true if the reply was a valid AUTH:<password> command whose
+ * password matches that of the server, else false.
+ */
+static bool check_auth_reply(ClientList *clients, CmdView *cmd, bool valid) {
+    bool authenticated = false;
+
+    // Check for a valid AUTH: command
+    if (valid && cmd->numFields > 1 && cmd->cmdNo == AUTH) {
+        // Update server stats
+        stat_add(&clients->stats, AUTH_COUNT, 1);
+        // Check password
+        if (!strcmp(clients->password, cmd->fields[1].start)) {
+            authenticated = true;
+        }
+    }
+    trace_event(authenticated ? TRACE_AUTH_OK : TRACE_AUTH_FAIL, 0);
+
+    return authenticated;
+}
+
+/*
+ * Checks a client's reply to a WHO: command, given whether it was a valid
+ * command and if so its CmdView.
+ *
+ * If the reply was a valid NAME:<name> command and no other client in the
+ * server has that name, the client's name is set to the given name, OK: is
+ * sent to it and it is added to the ClientList.
+ *
+ * A client may instead reply with a valid ASSIGN:<base> command, to be
+ * assigned a free name based on <base> (see assign_client_name()) in one
+ * round trip rather than negotiating one with NAME:. The name is sent to it
+ * as NAME_ASSIGNED:<name> before it is added to the ClientList. WHO: does not
+ * advertise this, so clients which never send ASSIGN: see no change.
+ *
+ * Either is done while holding the ClientList's nameLock so no other client
+ * can claim the name in between, and so the reply reaches the client before
+ * any broadcast does.
+ *
+ * Returns HANDSHAKE_DONE if the client was named, HANDSHAKE_NAME if the name
+ * was empty or taken and HANDSHAKE_FAILED if the reply was not a NAME: or
+ * ASSIGN: command.
+ */
+static HandshakeState check_name_reply(ClientList *clients,
+        ClientThread *client, CmdView *cmd, bool valid) {
+    HandshakeState result = HANDSHAKE_FAILED;
+
+    // Check the client's reply was a valid NAME: command
+    if (valid && cmd->cmdNo == NAME) {
+        result = HANDSHAKE_NAME;
+        // Update server stats
+        stat_add(&clients->stats, NAME_COUNT, 1);
+
+        // Check if the given name was empty, and if not, if the name is
+        // already taken
+        pthread_mutex_lock(clients->nameLock);
+        if (cmd->numFields > 1 &&
+                get_client_by_name(clients, cmd->fields[1].start) == NULL) {
+            set_client_name(client, cmd->fields[1].start);
+            send_client(client, "OK:");
+            add_client(clients, client);
+            trace_event(TRACE_NAME_ASSIGNED, 0);
+            result = HANDSHAKE_DONE;
+        }
+        pthread_mutex_unlock(clients->nameLock);
+    } else if (valid && cmd->cmdNo == ASSIGN) {
+        // Update server stats
+        stat_add(&clients->stats, NAME_COUNT, 1);
+
+        pthread_mutex_lock(clients->nameLock);
+        char *name = assign_client_name(clients, client,
+                cmd->numFields > 1 ? cmd->fields[1].start : "");
+        set_client_name(client, name);
+        send_client(client, "NAME_ASSIGNED:%s", name);
+        add_client(clients, client);
+        pthread_mutex_unlock(clients->nameLock);
+        trace_event(TRACE_NAME_ASSIGNED, 1);
+
+        free(name);
+        result = HANDSHAKE_DONE;
+    }
+
+    return result;
+}
+
+/*
+ * Replies to a client's COMPRESS: request, made while naming, and compresses
+ * everything sent to it afterwards.
+ *
+ * A client replying COMPRESS:DICT is sent COMPRESS:<names>, naming the
+ * clients in the server whose "MSG:<name>:" prefixes both ends preset their
+ * deflate stream's dictionary with (see build_dictionary()); any other reply
+ * is sent COMPRESS: and starts without a dictionary.
+ */
+static void start_compression(ClientList *clients, ClientThread *client,
+        CmdView *cmd) {
+    char dictionary[MAX_DICT_SIZE];
+    size_t dictLength = 0;
+
+    if (cmd->numFields > 1 && !strcmp(cmd->fields[1].start, "DICT")) {
+        // The names line lies between "LIST:" and the new line
+        Payload *list = get_list_payload(clients);
+        char *names = list->bytes + strlen("LIST:");
+        size_t namesLength = fit_dictionary_names(names,
+                list->length - strlen("LIST:\n"));
+        send_client(client, "COMPRESS:%.*s", (int) namesLength, names);
+        dictLength = build_dictionary(dictionary, names, namesLength);
+        unref_payload(list);
+    } else {
+        send_client(client, "COMPRESS:");
+    }
+
+    set_client_compressed(client, init_compressor(
+            clients->config->compressLevel, dictionary, dictLength,
+            &clients->compressStats));
+}
+
+/*
+ * Advances a client's handshake given the next line (or frame body) of a
+ * given length the client sent.
+ *
+ * While authenticating, a correct AUTH:<password> reply gets OK: and WHO:
+ * sent to the client; anything else fails the handshake.
+ *
+ * While naming, a NAME:<name> reply with a free name or an ASSIGN:<base>
+ * reply completes the handshake (see check_name_reply()); an empty or taken
+ * name gets NAME_TAKEN: and WHO: sent to the client so it can try again, and
+ * anything else fails the handshake.
+ *
+ * While naming, a client which has not yet switched to framing may also ask
+ * to with FRAMED:. FRAMED: is sent back as the last line the client receives;
+ * everything after it in either direction is a frame (see frame.h), starting
+ * with the client's NAME: or ASSIGN:. This is never advertised, so clients
+ * which do not ask keep reading and sending lines.
+ *
+ * Likewise, a client may ask for compression with COMPRESS:. If the server
+ * offers compression it replies COMPRESS: (see start_compression()), and
+ * everything it sends afterwards is compressed. Otherwise the request is
+ * ignored, so the client's name reply arrives without it. Compression is
+ * never advertised either.
+ *
+ * Returns the new state of the handshake. The reply is parsed in place (see
+ * parse_client_cmd()) and is not freed.
+ */
+HandshakeState handshake_step(Handshake *shake, ClientList *clients,
+        ClientThread *client, char *reply, size_t length) {
+    CmdView cmd;
+    bool valid = parse_client_cmd(client, reply, length, &cmd);
+
+    switch (shake->state) {
+        case HANDSHAKE_AUTH:
+            if (check_auth_reply(clients, &cmd, valid)) {
+                shake->state = HANDSHAKE_NAME;
+                send_client(client, "OK:");
+                send_client(client, "WHO:");
+            } else {
+                shake->state = HANDSHAKE_FAILED;
+            }
+            break;
+        case HANDSHAKE_NAME:
+            if (valid && cmd.cmdNo == FRAMED && !client->framed) {
+                send_client(client, "FRAMED:");
+                set_client_framed(client);
+                break;
+            } else if (valid && cmd.cmdNo == COMPRESS
+                    && !client->compressed) {
+                if (clients->config->compress) {
+                    start_compression(clients, client, &cmd);
+                }
+                break;
+            }
+            shake->state = check_name_reply(clients, client, &cmd, valid);
+            if (shake->state == HANDSHAKE_NAME) {
+                send_client(client, "NAME_TAKEN:");
+                send_client(client, "WHO:");
+            }
+            break;
+        default:
+            break;
+    }
+
+    return shake->state;
+}
+
+/*
+ * Returns the number of milliseconds (>= 0) left at a given time until the
+ * deadline of a handshake, or -1 if the handshake has no deadline.
+ */
+long long handshake_remaining(Handshake *shake, long long now) {
+    if (shake->deadline < 0) {
+        return -1;
+    }
+
+    return shake->deadline > now ? shake->deadline - now : 0;
+}
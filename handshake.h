@@ -0,0 +1,46 @@
+#ifndef HANDSHAKE_H
+#define HANDSHAKE_H
+
+#include <stdbool.h>
+#include "clientList.h"
+#include "clientThread.h"
+
+/*
+ * Stages of the handshake (authentication then name negotiation) a newly
+ * connected client goes through before entering the chat.
+ */
+typedef enum {
+    /* AUTH: has been sent and an AUTH:<password> reply is awaited */
+    HANDSHAKE_AUTH,
+    /* WHO: has been sent and a NAME:<name> reply is awaited */
+    HANDSHAKE_NAME,
+    /* The client is authenticated, named and in the ClientList */
+    HANDSHAKE_DONE,
+    /* The client failed the handshake and should be disconnected */
+    HANDSHAKE_FAILED
+} HandshakeState;
+
+/*
+ * Struct storing the progress of a single client's handshake.
+ *
+ * The handshake is driven one client reply at a time by handshake_step(), so
+ * it can be run by an event loop for many clients at once as well as by a
+ * client's own thread.
+ */
+typedef struct {
+    /* Current stage of the handshake */
+    HandshakeState state;
+    /*
+     * Time (as returned by now_ms()) by which the handshake must be done, or
+     * -1 if there is no deadline.
+     */
+    long long deadline;
+} Handshake;
+
+void start_handshake(Handshake *shake, ClientList *clients,
+        ClientThread *client);
+HandshakeState handshake_step(Handshake *shake, ClientList *clients,
+        ClientThread *client, char *reply, size_t length);
+long long handshake_remaining(Handshake *shake, long long now);
+
+#endif
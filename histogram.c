@@ -0,0 +1,110 @@
+#include <string.h>
+#include <stdbool.h>
+#include "histogram.h"
+
+/*
+ * Initializes an empty Histogram.
+ */
+void init_histogram(Histogram *histogram) {
+    memset(histogram->counts, 0, sizeof(histogram->counts));
+    histogram->max = 0;
+    histogram->sum = 0;
+}
+
+/*
+ * Returns the index of the bucket a value is counted in.
+ *
+ * Values below HISTOGRAM_SUB_BUCKETS each have a bucket of their own. Larger
+ * values are placed by the position of their highest set bit, then by the
+ * HISTOGRAM_SUB_BITS bits below it.
+ */
+static int bucket_index(long long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value > 0 ? (int) value : 0;
+    }
+
+    int highBit = 63 - __builtin_clzll((unsigned long long) value);
+    int shift = highBit - HISTOGRAM_SUB_BITS;
+
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS
+            + (int) ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/*
+ * Returns the largest value counted in a given bucket.
+ */
+static long long bucket_top(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    long long bottom = (long long) (HISTOGRAM_SUB_BUCKETS
+            + index % HISTOGRAM_SUB_BUCKETS) << shift;
+
+    return bottom + (1LL << shift) - 1;
+}
+
+/*
+ * Records a value in a Histogram. Negative values are recorded as 0.
+ * Safe to call concurrently from multiple threads.
+ */
+void histogram_record(Histogram *histogram, long long value) {
+    value = value > 0 ? value : 0;
+    __atomic_add_fetch(&histogram->counts[bucket_index(value)], 1,
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum, value, __ATOMIC_RELAXED);
+
+    long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    // On failure max is updated to the value another thread stored
+    while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max,
+            value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ;
+    }
+}
+
+/*
+ * Returns the number of values recorded in a Histogram.
+ */
+long long histogram_count(Histogram *histogram) {
+    long long count = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        count += __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    }
+
+    return count;
+}
+
+/*
+ * Returns the value at a given percentile (0 to 100) of the values recorded
+ * in a Histogram, i.e. the smallest value at least that percentage of the
+ * recorded values are less than or equal to, to within the precision of its
+ * bucket. Returns 0 if no values were recorded.
+ */
+long long histogram_percentile(Histogram *histogram, double percentile) {
+    long long counts[HISTOGRAM_BUCKETS];
+    long long count = 0;
+    // Take a copy so values recorded meanwhile cannot move the target
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        counts[i] = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+        count += counts[i];
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    long long rank = (long long) (percentile / 100.0 * count + 0.999999);
+    rank = rank < 1 ? 1 : rank;
+    long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            long long top = bucket_top(i);
+            return top < max ? top : max;
+        }
+    }
+
+    return max;
+}
@@ -0,0 +1,37 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/* Number of bits of precision kept for each recorded value */
+#define HISTOGRAM_SUB_BITS 4
+/* Number of linear buckets each power of two range of values is split into */
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+/* Number of buckets needed to cover every non-negative long long value */
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) \
+        * HISTOGRAM_SUB_BUCKETS)
+
+/*
+ * Struct representing a histogram of non-negative values, such as latencies
+ * in nanoseconds.
+ *
+ * Buckets are log-linear (as in an HDR histogram): each power of two range
+ * of values is split into HISTOGRAM_SUB_BUCKETS equal buckets, so any value
+ * is counted to within 1/16th (6.25%) of itself in a fixed amount of memory.
+ *
+ * Values are recorded with relaxed atomic adds, so any number of threads can
+ * record into a histogram at once without a lock.
+ */
+typedef struct {
+    /* Number of values recorded into each bucket */
+    long long counts[HISTOGRAM_BUCKETS];
+    /* Largest value recorded */
+    long long max;
+    /* Sum of the values recorded */
+    long long sum;
+} Histogram;
+
+void init_histogram(Histogram *histogram);
+void histogram_record(Histogram *histogram, long long value);
+long long histogram_count(Histogram *histogram);
+long long histogram_percentile(Histogram *histogram, double percentile);
+
+#endif
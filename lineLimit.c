@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "lineLimit.h"
+
+/*
+ * Returns true if a line (or the start of one) of a given length is longer
+ * than the maximum line length of a LineLimits. A NULL LineLimits has no
+ * maximum.
+ */
+bool line_too_long(LineLimits *limits, size_t length) {
+    return limits != NULL && limits->maxLength > 0
+            && length > limits->maxLength;
+}
+
+/*
+ * Counts a given number of bytes of an oversized line as discarded.
+ */
+void count_discarded(LineLimits *limits, size_t bytes) {
+    __atomic_add_fetch(&limits->stats->discardedBytes, (long) bytes,
+            __ATOMIC_RELAXED);
+}
+
+/*
+ * Counts the end of an oversized line from a connection, given the number of
+ * oversized lines the connection sent before it.
+ *
+ * Returns true if the connection has now sent maxOversized oversized lines
+ * and its client should be disconnected, else false.
+ */
+bool end_oversized_line(LineLimits *limits, int *numOversized) {
+    __atomic_add_fetch(&limits->stats->oversized, 1, __ATOMIC_RELAXED);
+    (*numOversized)++;
+
+    if (limits->maxOversized > 0 && *numOversized >= limits->maxOversized) {
+        __atomic_add_fetch(&limits->stats->disconnected, 1,
+                __ATOMIC_RELAXED);
+        return true;
+    }
+
+    return false;
+}
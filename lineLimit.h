@@ -0,0 +1,44 @@
+#ifndef LINELIMIT_H
+#define LINELIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Struct counting the oversized lines discarded by every connection of a
+ * server. Updated atomically.
+ */
+typedef struct {
+    /* Number of lines discarded for being longer than the maximum */
+    long oversized;
+    /* Number of bytes discarded, including the lines' new lines */
+    long discardedBytes;
+    /* Number of clients disconnected for sending too many oversized lines */
+    long disconnected;
+} LineStats;
+
+/*
+ * Struct storing the maximum line length shared by every connection of a
+ * server, and what is done with clients which exceed it.
+ *
+ * Bytes of a line longer than maxLength are discarded as they arrive rather
+ * than buffered, so no connection ever buffers much more than maxLength
+ * bytes of input.
+ */
+typedef struct {
+    /* Largest number of bytes in a line, excluding its new line; 0 for none */
+    size_t maxLength;
+    /*
+     * Number of oversized lines after which a client is disconnected, 0 to
+     * never disconnect clients for them
+     */
+    int maxOversized;
+    /* Counters of the lines discarded by connections with these limits */
+    LineStats *stats;
+} LineLimits;
+
+bool line_too_long(LineLimits *limits, size_t length);
+void count_discarded(LineLimits *limits, size_t bytes);
+bool end_oversized_line(LineLimits *limits, int *numOversized);
+
+#endif
@@ -2,12 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include "lineList.h"
+#include "scan.h"
 
-/* 
- * Characters with ASCII code >= this value are printable, the ones below
- * are unprintable control codes
- */
-#define MIN_PRINTABLE 32
+/* Number of characters initially allocated to a line read by get_line() */
+#define INITIAL_LINE_SIZE 64
 
 /*
  * "Read" in "ReadLine" is past tense :)
@@ -112,7 +110,9 @@ char *read_line_stdin(bool *isLineEmpty) {
  */
 static ReadLine *get_line(FILE *doc, bool *isLineEmpty) {
     int index = 0;
-    char *line = (char *) calloc(1, sizeof(char));
+    // The line's capacity doubles as it fills, rather than growing per char
+    int capacity = INITIAL_LINE_SIZE;
+    char *line = (char *) calloc(capacity, sizeof(char));
     // Initialize the first character to '\0' in case of an empty file.
     line[0] = '\0';
     int nextChar = fgetc(doc);
@@ -132,7 +132,10 @@ static ReadLine *get_line(FILE *doc, bool *isLineEmpty) {
         /* Place the last read character into the output string
          * +2 accounts for '\0' and new character allocated
          */
-        line = (char *) realloc(line, (index + 2) * sizeof(char));
+        if (index + 2 > capacity) {
+            capacity *= 2;
+            line = (char *) realloc(line, capacity * sizeof(char));
+        }
         line[index++] = (char) nextChar;
      
         // Read the next character
@@ -144,14 +147,8 @@ static ReadLine *get_line(FILE *doc, bool *isLineEmpty) {
         }
     }
 
-    /*
-     * Add end of string character '\0' if the end character currently
-     * isn't already '\0'
-     */
-    if (index > 0 && line[index - 1] != '\0') {
-        line = (char *) realloc(line, (index + 2) * sizeof(char));
-        line[index] = '\0';
-    }
+    // Terminate the string after the last character read
+    line[index] = '\0';
 
     // Create and return the ReadLine struct
     ReadLine *readLine = malloc(sizeof(ReadLine));
@@ -259,9 +256,10 @@ int pattern_match_string(char *pattern, char *target) {
      * pattern, and if so, sets the output value as true and breaks from the
      * loop.
      */
-    for (int offset = 0; offset < strlen(target); ++offset) {
-        if (strncasecmp(pattern, target + offset,
-                strlen(pattern) * sizeof(char)) == 0) {
+    size_t targetLength = strlen(target);
+    size_t patternLength = strlen(pattern);
+    for (size_t offset = 0; offset < targetLength; ++offset) {
+        if (strncasecmp(pattern, target + offset, patternLength) == 0) {
             matched = 1;
             break;
         }
@@ -273,19 +271,12 @@ int pattern_match_string(char *pattern, char *target) {
 /*
  * Given a string, returns a copy of the string where any non-printable
  * characters (ASCII value <32 which are control codes) are replaced with
- * question marks .
+ * question marks. (see copy_printable() in scan.c)
  */
 char *get_printable(char *line) {
-    char *printableLine = calloc(strlen(line) + 1, sizeof(char));
-
-    for (int i = 0; i < strlen(line); ++i) {
-        if ((int) line[i] < MIN_PRINTABLE) {
-            // Replace unprintable char with '?'
-            printableLine[i] = '?';
-        } else {
-            printableLine[i] = line[i];
-        }
-    }
+    size_t length = strlen(line);
+    char *printableLine = calloc(length + 1, sizeof(char));
+    copy_printable(printableLine, line, length);
 
     return printableLine;
 }
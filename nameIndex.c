@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "nameIndex.h"
+#include "clientList.h"
+
+/* Number of buckets a NameIndex starts with */
+#define INITIAL_BUCKETS 64
+/* Offset basis and prime of the 64-bit FNV-1a hash */
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*
+ * Returns the 64-bit FNV-1a hash of a string.
+ */
+uint64_t hash_name(char *name) {
+    uint64_t hash = FNV_OFFSET;
+    for (unsigned char *c = (unsigned char *) name; *c != '\0'; ++c) {
+        hash ^= *c;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * Returns a pointer to the chain of the bucket a name belongs in.
+ */
+static ClientNode **bucket_of(NameIndex *index, char *name) {
+    return &index->buckets[hash_name(name) & (index->numBuckets - 1)];
+}
+
+/*
+ * Initializes an empty NameIndex.
+ */
+void init_name_index(NameIndex *index) {
+    index->numBuckets = INITIAL_BUCKETS;
+    index->buckets = (ClientNode **) calloc(index->numBuckets,
+            sizeof(ClientNode *));
+    index->count = 0;
+}
+
+/*
+ * Frees memory allocated to a NameIndex. The indexed nodes are not freed.
+ */
+void free_name_index(NameIndex *index) {
+    free(index->buckets);
+    index->buckets = NULL;
+    index->numBuckets = 0;
+    index->count = 0;
+}
+
+/*
+ * Doubles the number of buckets of a NameIndex and rehashes its nodes into
+ * them.
+ */
+static void grow_index(NameIndex *index) {
+    ClientNode **oldBuckets = index->buckets;
+    size_t oldNumBuckets = index->numBuckets;
+
+    index->numBuckets *= 2;
+    index->buckets = (ClientNode **) calloc(index->numBuckets,
+            sizeof(ClientNode *));
+
+    for (size_t i = 0; i < oldNumBuckets; ++i) {
+        ClientNode *node = oldBuckets[i];
+        while (node != NULL) {
+            ClientNode *next = node->hashNext;
+            ClientNode **bucket = bucket_of(index, node->client->name);
+            node->hashNext = *bucket;
+            *bucket = node;
+            node = next;
+        }
+    }
+
+    free(oldBuckets);
+}
+
+/*
+ * Adds a ClientNode to a NameIndex under the name of its client.
+ */
+void name_index_add(NameIndex *index, ClientNode *node) {
+    if (index->count >= index->numBuckets) {
+        grow_index(index);
+    }
+
+    ClientNode **bucket = bucket_of(index, node->client->name);
+    node->hashNext = *bucket;
+    *bucket = node;
+    index->count++;
+}
+
+/*
+ * Removes a ClientNode from a NameIndex.
+ * If the node is not in the index, this function does nothing.
+ */
+void name_index_remove(NameIndex *index, ClientNode *node) {
+    ClientNode **link = bucket_of(index, node->client->name);
+    while (*link != NULL) {
+        if (*link == node) {
+            *link = node->hashNext;
+            node->hashNext = NULL;
+            index->count--;
+            return;
+        }
+        link = &(*link)->hashNext;
+    }
+}
+
+/*
+ * Finds and returns the ClientNode in a NameIndex whose client has a given
+ * name, or NULL if there is none.
+ */
+ClientNode *name_index_find(NameIndex *index, char *name) {
+    ClientNode *node = *bucket_of(index, name);
+    while (node != NULL && strcmp(node->client->name, name)) {
+        node = node->hashNext;
+    }
+
+    return node;
+}
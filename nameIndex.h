@@ -0,0 +1,32 @@
+#ifndef NAMEINDEX_H
+#define NAMEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "clientThread.h"
+
+/*
+ * Struct representing a hash table indexing the ClientNodes of a ClientList
+ * by client name, so clients can be found by name in constant time.
+ *
+ * Collisions are chained through the hashNext member of each ClientNode, so
+ * the index allocates nothing per client. The table doubles in size when it
+ * holds more clients than it has buckets.
+ */
+typedef struct {
+    /* Array of the first node of each bucket's chain */
+    ClientNode **buckets;
+    /* Number of buckets; always a power of two */
+    size_t numBuckets;
+    /* Number of nodes in the index */
+    size_t count;
+} NameIndex;
+
+uint64_t hash_name(char *name);
+void init_name_index(NameIndex *index);
+void free_name_index(NameIndex *index);
+void name_index_add(NameIndex *index, ClientNode *node);
+void name_index_remove(NameIndex *index, ClientNode *node);
+ClientNode *name_index_find(NameIndex *index, char *name);
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "outQueue.h"
+#include "trace.h"
+#include "commands.h"
+#include "frame.h"
+
+/* Maximum number of queued messages gathered into a single write */
+#define MAX_WRITE_IOVECS 64
+/*
+ * Multiple of the high watermark past which even commands SLOW_DROP_OLDEST
+ * never drops are not queued, and the client is evicted instead
+ */
+#define HARD_LIMIT_FACTOR 2
+
+/*
+ * Initializes an empty OutQueue with the given watermarks and slow consumer
+ * policy, which counts its writes and slow consumer events in the given
+ * QueueStats.
+ */
+void init_out_queue(OutQueue *queue, QueueLimits *limits, QueueStats *stats) {
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->offset = 0;
+    queue->numBytes = 0;
+    queue->numMessages = 0;
+    queue->slow = false;
+    queue->dropped = 0;
+    queue->limits = limits;
+    queue->stats = stats;
+    queue->compressor = NULL;
+    queue->numCompressed = 0;
+}
+
+/*
+ * Adds a given amount to one of the counters of a QueueStats.
+ */
+static void add_stat(long *counter, long amount) {
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+/*
+ * Changes whether an OutQueue is a slow consumer.
+ */
+static void set_slow(OutQueue *queue, bool slow) {
+    if (slow != queue->slow) {
+        queue->slow = slow;
+        add_stat(&queue->stats->slow, slow ? 1 : -1);
+        if (slow) {
+            add_stat(&queue->stats->slowEvents, 1);
+        }
+    }
+}
+
+/*
+ * Counts a given number of messages dropped from or not added to an
+ * OutQueue.
+ */
+static void count_dropped(OutQueue *queue, long dropped) {
+    queue->dropped += dropped;
+    add_stat(&queue->stats->dropped, dropped);
+}
+
+/*
+ * Returns true if a Payload is a MSG: command, which the SLOW_DROP_OLDEST
+ * policy may drop. Other commands change the state of the chat as seen by
+ * the client so are never dropped by it.
+ *
+ * Frames are told apart by the command id following their length.
+ */
+static bool is_droppable(Payload *payload) {
+    if (payload->isFrame) {
+        size_t length, used;
+        get_varint(payload->bytes, payload->length, &length, &used);
+        return (unsigned char) payload->bytes[used]
+                == get_cmd_no("MSG", strlen("MSG"), CLIENT);
+    }
+
+    return payload->length >= strlen("MSG:")
+            && !strncmp(payload->bytes, "MSG:", strlen("MSG:"));
+}
+
+/*
+ * Unlinks and frees a message which follows a given message (or is the head
+ * of the queue, if prev is NULL), releasing its reference to its Payload.
+ */
+static void remove_message(OutQueue *queue, OutMessage *prev,
+        OutMessage *message) {
+    if (prev != NULL) {
+        prev->next = message->next;
+    } else {
+        queue->head = message->next;
+        queue->offset = 0;
+    }
+    if (queue->tail == message) {
+        queue->tail = prev;
+    }
+    queue->numBytes -= message->payload->length;
+    queue->numMessages--;
+    unref_payload(message->payload);
+    free(message);
+}
+
+/*
+ * Drops the oldest droppable messages of an OutQueue until length more bytes
+ * fit under its high watermark, or no droppable messages are left. A
+ * partially written head message is never dropped.
+ */
+static void drop_oldest(OutQueue *queue, size_t length) {
+    OutMessage *prev = queue->offset > 0 ? queue->head : NULL;
+    OutMessage *message = prev != NULL ? prev->next : queue->head;
+    long dropped = 0;
+
+    while (message != NULL
+            && queue->numBytes + length > queue->limits->highWater) {
+        OutMessage *next = message->next;
+        if (is_droppable(message->payload)) {
+            remove_message(queue, prev, message);
+            dropped++;
+        } else {
+            prev = message;
+        }
+        message = next;
+    }
+
+    count_dropped(queue, dropped);
+}
+
+/*
+ * Clears a slow consumer's OutQueue and counts its client as evicted.
+ * Returns PUSH_EVICT, for the caller to disconnect the client.
+ */
+static PushResult evict(OutQueue *queue) {
+    clear_out_queue(queue);
+    add_stat(&queue->stats->evicted, 1);
+
+    return PUSH_EVICT;
+}
+
+/*
+ * Appends a message to the end of an OutQueue, taking a reference to its
+ * Payload rather than copying it.
+ *
+ * If the message would take the queue past its high watermark, the queue
+ * becomes a slow consumer and is handled by its policy:
+ *
+ * - SLOW_DROP_OLDEST: queued MSG: messages are dropped, oldest first, to
+ *   make room. A new MSG: message which still does not fit is dropped, but
+ *   other commands are queued unless they would take the queue past
+ *   HARD_LIMIT_FACTOR times its high watermark, in which case the client is
+ *   evicted as for SLOW_DISCONNECT.
+ *
+ * - SLOW_DISCONNECT: the queue is cleared and PUSH_EVICT returned, for the
+ *   caller to disconnect the client.
+ *
+ * - SLOW_PAUSE: new messages are dropped until the queue drains to its low
+ *   watermark.
+ *
+ * Returns whether the message was queued, dropped or the client should be
+ * evicted.
+ */
+PushResult out_queue_push(OutQueue *queue, Payload *payload) {
+    size_t length = payload->length;
+    QueueLimits *limits = queue->limits;
+
+    if (queue->slow && limits->policy == SLOW_PAUSE) {
+        count_dropped(queue, 1);
+        return PUSH_DROPPED;
+    }
+
+    if (queue->numBytes + length > limits->highWater) {
+        set_slow(queue, true);
+
+        if (limits->policy == SLOW_DISCONNECT) {
+            return evict(queue);
+        } else if (limits->policy == SLOW_PAUSE) {
+            count_dropped(queue, 1);
+            return PUSH_DROPPED;
+        }
+
+        drop_oldest(queue, length);
+        if (queue->numBytes + length > limits->highWater
+                && is_droppable(payload)) {
+            count_dropped(queue, 1);
+            return PUSH_DROPPED;
+        } else if (queue->numBytes + length
+                > HARD_LIMIT_FACTOR * limits->highWater) {
+            return evict(queue);
+        }
+    }
+
+    OutMessage *message = (OutMessage *) malloc(sizeof(OutMessage));
+    message->next = NULL;
+    message->payload = payload;
+    message->compressed = queue->compressor != NULL;
+    ref_payload(payload);
+
+    if (queue->tail != NULL) {
+        queue->tail->next = message;
+    } else {
+        queue->head = message;
+    }
+    queue->tail = message;
+    queue->numBytes += length;
+    queue->numMessages++;
+
+    return PUSH_QUEUED;
+}
+
+/*
+ * Removes and frees the head message of an OutQueue, releasing its
+ * reference to its Payload.
+ */
+static void pop_message(OutQueue *queue) {
+    OutMessage *message = queue->head;
+    queue->head = message->next;
+    if (queue->head == NULL) {
+        queue->tail = NULL;
+    }
+    queue->offset = 0;
+    queue->numMessages--;
+    unref_payload(message->payload);
+    free(message);
+}
+
+/*
+ * Returns true if an OutQueue has compressed bytes waiting to be written.
+ */
+static bool compressed_pending(OutQueue *queue) {
+    Compressor *comp = queue->compressor;
+
+    return comp != NULL && comp->outStart < comp->outEnd;
+}
+
+/*
+ * Compresses the messages at the head of an OutQueue which are to be
+ * compressed (up to MAX_WRITE_IOVECS at a time), removing them from the
+ * queue; their compressed bytes are written in their place, and the messages
+ * are counted as written once those bytes are (see consume_bytes()).
+ */
+static void compress_messages(OutQueue *queue) {
+    struct iovec iov[MAX_WRITE_IOVECS];
+    int numIov = 0;
+    size_t length = 0;
+
+    for (OutMessage *message = queue->head;
+            message != NULL && message->compressed
+            && numIov < MAX_WRITE_IOVECS; message = message->next) {
+        iov[numIov].iov_base = message->payload->bytes;
+        iov[numIov].iov_len = message->payload->length;
+        length += message->payload->length;
+        numIov++;
+    }
+    if (numIov == 0) {
+        return;
+    }
+
+    size_t compressed = compress_iovecs(queue->compressor, iov, numIov);
+    queue->numBytes = queue->numBytes - length + compressed;
+    queue->numCompressed += numIov;
+    for (int i = 0; i < numIov; ++i) {
+        pop_message(queue);
+    }
+}
+
+/*
+ * Fills an array of at most MAX_WRITE_IOVECS iovecs with the next unwritten
+ * bytes of an OutQueue: its compressed bytes waiting to be written if it has
+ * any, else the unwritten bytes of the uncompressed messages at its head.
+ * Returns the number of iovecs filled.
+ */
+static int gather_messages(OutQueue *queue, struct iovec *iov) {
+    int numIov = 0;
+    size_t offset = queue->offset;
+
+    if (compressed_pending(queue)) {
+        Compressor *comp = queue->compressor;
+        iov[0].iov_base = comp->out + comp->outStart;
+        iov[0].iov_len = comp->outEnd - comp->outStart;
+        return 1;
+    }
+
+    for (OutMessage *message = queue->head;
+            message != NULL && !message->compressed
+            && numIov < MAX_WRITE_IOVECS;
+            message = message->next) {
+        iov[numIov].iov_base = message->payload->bytes + offset;
+        iov[numIov].iov_len = message->payload->length - offset;
+        numIov++;
+        offset = 0;
+    }
+
+    return numIov;
+}
+
+/*
+ * Removes a given number of written bytes from the head of an OutQueue, or
+ * from its compressed bytes if those were written.
+ * Returns the number of messages which were completed, where compressed
+ * messages complete once the last of their compressed bytes is written.
+ */
+static long consume_bytes(OutQueue *queue, size_t written) {
+    long completed = 0;
+    queue->numBytes -= written;
+
+    if (compressed_pending(queue)) {
+        Compressor *comp = queue->compressor;
+        comp->outStart += written;
+        if (comp->outStart == comp->outEnd) {
+            comp->outStart = 0;
+            comp->outEnd = 0;
+            completed = queue->numCompressed;
+            queue->numCompressed = 0;
+        }
+        return completed;
+    }
+
+    while (written > 0) {
+        size_t left = queue->head->payload->length - queue->offset;
+        if (written < left) {
+            queue->offset += written;
+            break;
+        }
+        written -= left;
+        pop_message(queue);
+        completed++;
+    }
+
+    return completed;
+}
+
+/*
+ * Writes as many queued messages to a socket as it accepts without
+ * blocking, removing those fully written from the queue.
+ *
+ * Queued messages are gathered into a single vectored write (up to
+ * MAX_WRITE_IOVECS at a time), so a client with many pending messages
+ * costs one system call rather than one per message. sendmsg() is used as
+ * the non-blocking equivalent of writev(), as the sockets of clients with
+ * their own thread share blocking mode with that thread's reads.
+ *
+ * Messages queued after compression was negotiated are compressed together
+ * in batches just before they are written (see compress_messages()), so a
+ * batch costs one sync flush rather than one per message.
+ *
+ * Returns false if the socket had an error (i.e. the client disconnected),
+ * else true. The queue is empty afterwards if and only if numBytes is 0.
+ */
+bool out_queue_write(OutQueue *queue, int fd) {
+    struct iovec iov[MAX_WRITE_IOVECS];
+    long writes = 0;
+    long messages = 0;
+    long bytes = 0;
+    bool ok = true;
+
+    while (queue->head != NULL || compressed_pending(queue)) {
+        if (!compressed_pending(queue)) {
+            compress_messages(queue);
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = gather_messages(queue, iov);
+
+        ssize_t sent = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            ok = errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            if (errno != EINTR) {
+                trace_event(TRACE_WRITE_BLOCKED, queue->numBytes);
+            }
+            break;
+        }
+
+        writes++;
+        bytes += sent;
+        messages += consume_bytes(queue, sent);
+    }
+
+    if (writes > 0) {
+        add_stat(&queue->stats->writes, writes);
+        add_stat(&queue->stats->messages, messages);
+        add_stat(&queue->stats->bytes, bytes);
+    }
+    if (queue->numBytes <= queue->limits->lowWater) {
+        set_slow(queue, false);
+    }
+
+    return ok;
+}
+
+/*
+ * Compresses every message queued on an OutQueue from now on with a given
+ * Compressor, which the queue's owner frees. Messages already queued are
+ * written uncompressed ahead of the compressed stream.
+ */
+void compress_out_queue(OutQueue *queue, Compressor *compressor) {
+    queue->compressor = compressor;
+}
+
+/*
+ * Frees every message in an OutQueue and discards its unwritten compressed
+ * bytes, leaving it empty. An empty queue is not a slow consumer.
+ */
+void clear_out_queue(OutQueue *queue) {
+    while (queue->head != NULL) {
+        queue->numBytes -= queue->head->payload->length - queue->offset;
+        pop_message(queue);
+    }
+    if (compressed_pending(queue)) {
+        Compressor *comp = queue->compressor;
+        queue->numBytes -= comp->outEnd - comp->outStart;
+        comp->outStart = 0;
+        comp->outEnd = 0;
+    }
+    queue->numCompressed = 0;
+    set_slow(queue, false);
+}
@@ -0,0 +1,146 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "payload.h"
+#include "compress.h"
+
+typedef struct OutMessage OutMessage;
+
+/*
+ * Struct representing a single message waiting to be written to a client.
+ */
+struct OutMessage {
+    /* Next message in the queue */
+    OutMessage *next;
+    /* Bytes of the message, which may be shared with other queues */
+    Payload *payload;
+    /* Whether the message is compressed when written (see compressor) */
+    bool compressed;
+};
+
+/*
+ * Policies for handling a slow consumer, i.e. a client whose queue has grown
+ * past its high watermark.
+ */
+typedef enum {
+    /*
+     * Drop the oldest queued MSG: messages to make room for new messages,
+     * disconnecting the client if other commands alone overfill its queue
+     */
+    SLOW_DROP_OLDEST,
+    /* Disconnect the client, which has LEAVE: sent for it */
+    SLOW_DISCONNECT,
+    /* Drop new messages until the queue drains to its low watermark */
+    SLOW_PAUSE
+} SlowPolicy;
+
+/*
+ * Struct storing the watermarks and slow consumer policy shared by every
+ * queue of a server.
+ */
+typedef struct {
+    /* Number of queued bytes above which a client is a slow consumer */
+    size_t highWater;
+    /* Number of queued bytes a slow consumer must drain to to recover */
+    size_t lowWater;
+    /* How messages to slow consumers are handled */
+    SlowPolicy policy;
+} QueueLimits;
+
+/*
+ * Struct counting the writes made from OutQueues to their sockets and the
+ * slow consumers among them, shared by every queue of a server so the
+ * coalescing of messages into system calls and the health of clients can be
+ * observed. Updated atomically.
+ */
+typedef struct {
+    /* Number of system calls which wrote queued bytes to a socket */
+    long writes;
+    /*
+     * Number of messages written in full. Compressed messages count once
+     * all of the compressed bytes of their batch are written.
+     */
+    long messages;
+    /* Number of bytes written */
+    long bytes;
+    /* Number of queues which are currently slow consumers */
+    long slow;
+    /* Number of times a queue became a slow consumer */
+    long slowEvents;
+    /* Number of clients disconnected for being slow consumers */
+    long evicted;
+    /* Number of messages dropped from or not added to slow queues */
+    long dropped;
+} QueueStats;
+
+/*
+ * Outcomes of adding a message to an OutQueue
+ */
+typedef enum {
+    /* The message was queued */
+    PUSH_QUEUED,
+    /* The message was dropped */
+    PUSH_DROPPED,
+    /*
+     * The queue's client is a slow consumer which must be disconnected; the
+     * queue was cleared
+     */
+    PUSH_EVICT
+} PushResult;
+
+/*
+ * Struct representing a bounded FIFO queue of messages waiting to be written
+ * to a single client's socket.
+ *
+ * Messages are only ever appended to the queue, so a broadcast never waits
+ * on a slow client; the queue is drained by non-blocking writes when the
+ * client's socket can accept more bytes. (see eventLoop.c)
+ *
+ * A queue which grows past its high watermark becomes a slow consumer,
+ * handled according to its SlowPolicy, until it drains to its low
+ * watermark.
+ *
+ * Once its client negotiates compression, messages queued afterwards are
+ * compressed as they are written. Compressed bytes waiting to be written are
+ * counted in numBytes in place of the messages they came from.
+ */
+typedef struct {
+    /* Oldest message in the queue, which is written first */
+    OutMessage *head;
+    /* Newest message in the queue */
+    OutMessage *tail;
+    /* Number of bytes of the head message already written */
+    size_t offset;
+    /* Number of bytes waiting to be written */
+    size_t numBytes;
+    /* Number of messages in the queue */
+    int numMessages;
+    /* Whether the queue is currently a slow consumer */
+    bool slow;
+    /* Number of messages dropped from or not added to the queue */
+    long dropped;
+    /* Watermarks and slow consumer policy of the queue */
+    QueueLimits *limits;
+    /* Counters the queue's writes and slow consumer events are added to */
+    QueueStats *stats;
+    /*
+     * Compressor of the client's deflate stream, holding compressed bytes
+     * not yet written, or NULL if the client's output is not compressed
+     */
+    Compressor *compressor;
+    /*
+     * Number of messages the compressor's bytes waiting to be written were
+     * compressed from, counted as written once those bytes are
+     */
+    long numCompressed;
+} OutQueue;
+
+void init_out_queue(OutQueue *queue, QueueLimits *limits, QueueStats *stats);
+PushResult out_queue_push(OutQueue *queue, Payload *payload);
+bool out_queue_write(OutQueue *queue, int fd);
+void compress_out_queue(OutQueue *queue, Compressor *compressor);
+void clear_out_queue(OutQueue *queue);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "payload.h"
+#include "commands.h"
+#include "frame.h"
+
+/*
+ * Allocates a Payload of length bytes, to be filled in by the caller before
+ * it is shared.
+ *
+ * The caller holds the only reference to the new Payload.
+ */
+Payload *init_payload(size_t length) {
+    Payload *payload = (Payload *) malloc(sizeof(Payload) + length);
+    payload->length = length;
+    payload->refs = 1;
+    payload->framed = NULL;
+    payload->isFrame = false;
+
+    return payload;
+}
+
+/*
+ * Creates a Payload from a formatting string and a variable number of
+ * arguments in a similar manner to printf(), with a new line character
+ * appended.
+ *
+ * The caller holds the only reference to the new Payload.
+ */
+Payload *format_payload(char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    Payload *payload = vformat_payload(format, args);
+    va_end(args);
+
+    return payload;
+}
+
+/*
+ * Version of format_payload() taking a va_list of formatting arguments.
+ */
+Payload *vformat_payload(char *format, va_list args) {
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int length = vsnprintf(NULL, 0, format, argsCopy);
+    va_end(argsCopy);
+
+    // +2 accounts for the appended new line and '\0'
+    Payload *payload = init_payload(length + 2);
+    vsnprintf(payload->bytes, length + 1, format, args);
+    payload->bytes[length] = '\n';
+    payload->length = length + 1;
+
+    return payload;
+}
+
+/*
+ * Creates a Payload holding the frame of a command given as a CmdView, whose
+ * command number is that of CLIENT_COMMANDS. (see write_frame())
+ *
+ * The caller holds the only reference to the new Payload.
+ */
+Payload *frame_payload(CmdView *view) {
+    Payload *payload = init_payload(frame_size(view));
+    write_frame(payload->bytes, view);
+    payload->isFrame = true;
+
+    return payload;
+}
+
+/*
+ * Returns the frame of the message of a line Payload, framing it the first
+ * time it is needed. May be called from any thread; should two threads
+ * frame the same payload at once, one frame is kept and the other freed.
+ *
+ * The frame is owned by the line Payload; callers which keep it must take a
+ * reference of their own. Returns NULL if the line is not a valid command,
+ * which clients would ignore.
+ */
+Payload *get_framed_payload(Payload *payload) {
+    Payload *framed = __atomic_load_n(&payload->framed, __ATOMIC_ACQUIRE);
+    if (framed != NULL) {
+        return framed;
+    }
+
+    // The line is parsed from a copy, as parsing overwrites its ':'s
+    size_t length = payload->length - 1;
+    char *line = (char *) malloc(length + 1);
+    memcpy(line, payload->bytes, length);
+    line[length] = '\0';
+
+    CmdView view;
+    if (parse_cmd(line, length, CLIENT, &view)) {
+        framed = frame_payload(&view);
+        Payload *expected = NULL;
+        if (!__atomic_compare_exchange_n(&payload->framed, &expected, framed,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            unref_payload(framed);
+            framed = expected;
+        }
+    }
+    free(line);
+
+    return framed;
+}
+
+/*
+ * Takes an additional reference to a Payload.
+ * Safe to call concurrently with other reference changes.
+ */
+void ref_payload(Payload *payload) {
+    __atomic_add_fetch(&payload->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Releases a reference to a Payload, freeing it if it was the last.
+ * Safe to call concurrently with other reference changes.
+ */
+void unref_payload(Payload *payload) {
+    if (__atomic_sub_fetch(&payload->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (payload->framed != NULL) {
+            unref_payload(payload->framed);
+        }
+        free(payload);
+    }
+}
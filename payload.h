@@ -0,0 +1,46 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include "commands.h"
+
+typedef struct Payload Payload;
+
+/*
+ * Struct representing the wire bytes of a single message to clients.
+ *
+ * A Payload is formatted once and then shared, unmodified, by the output
+ * queue of every client it is sent to. It is reference counted and freed
+ * when the last queue holding it lets go of it.
+ *
+ * A message is formatted as a line, and is also framed (see frame.h) the
+ * first time it is sent to a client which negotiated framing; the frame is
+ * then shared by every such client in the same way.
+ */
+struct Payload {
+    /* Number of references held to the payload */
+    int refs;
+    /* Number of bytes in the payload */
+    size_t length;
+    /*
+     * Frame of the same message, or NULL if it has not been needed yet.
+     * The payload holds a reference to it.
+     */
+    Payload *framed;
+    /* Whether the payload is a frame rather than a line */
+    bool isFrame;
+    /* Bytes of the message, including its terminating new line if a line */
+    char bytes[];
+};
+
+Payload *init_payload(size_t length);
+Payload *format_payload(char *format, ...);
+Payload *vformat_payload(char *format, va_list args);
+Payload *frame_payload(CmdView *view);
+Payload *get_framed_payload(Payload *payload);
+void ref_payload(Payload *payload);
+void unref_payload(Payload *payload);
+
+#endif
@@ -0,0 +1,73 @@
+#include <stdbool.h>
+#include "rateLimit.h"
+
+/* Number of microseconds in a second */
+#define USEC_PER_SEC 1000000
+
+/*
+ * Initializes a TokenBucket which refills rate tokens per second and holds
+ * at most burst tokens. The bucket starts full.
+ *
+ * A rate of 0 creates a bucket which never runs out of tokens.
+ */
+void init_token_bucket(TokenBucket *bucket, long rate, long burst) {
+    bucket->interval = rate > 0 ? USEC_PER_SEC / rate : 0;
+    bucket->capacity = bucket->interval * (burst > 0 ? burst : 1);
+    bucket->fullAt = 0;
+}
+
+/*
+ * Returns the number of microseconds from a given time until a token could
+ * be taken from a bucket with the given fullAt time, or 0 if one can be
+ * taken immediately.
+ */
+static long long wait_for(TokenBucket *bucket, long long fullAt,
+        long long now) {
+    long long start = fullAt > now ? fullAt : now;
+    long long wait = start + bucket->interval - bucket->capacity - now;
+
+    return wait > 0 ? wait : 0;
+}
+
+/*
+ * Returns the number of microseconds from a given time until a token will be
+ * available in a bucket, or 0 if one is available now. No token is taken.
+ */
+long long bucket_wait(TokenBucket *bucket, long long now) {
+    if (bucket->interval == 0) {
+        return 0;
+    }
+
+    return wait_for(bucket,
+            __atomic_load_n(&bucket->fullAt, __ATOMIC_RELAXED), now);
+}
+
+/*
+ * Attempts to take a token from a bucket at a given time.
+ *
+ * Returns 0 if a token was taken. Otherwise no token is taken and the number
+ * of microseconds until one will be available is returned.
+ *
+ * Safe to call concurrently from multiple threads on the same bucket.
+ */
+long long take_token(TokenBucket *bucket, long long now) {
+    if (bucket->interval == 0) {
+        return 0;
+    }
+
+    long long fullAt = __atomic_load_n(&bucket->fullAt, __ATOMIC_RELAXED);
+    while (1) {
+        long long wait = wait_for(bucket, fullAt, now);
+        if (wait > 0) {
+            return wait;
+        }
+
+        long long start = fullAt > now ? fullAt : now;
+        // On failure fullAt is updated to the value another thread stored
+        if (__atomic_compare_exchange_n(&bucket->fullAt, &fullAt,
+                start + bucket->interval, false, __ATOMIC_RELAXED,
+                __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+}
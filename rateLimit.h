@@ -0,0 +1,28 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdbool.h>
+
+/*
+ * Struct representing a token bucket which refills at a fixed rate up to a
+ * maximum burst size.
+ *
+ * The bucket is stored as the "theoretical arrival time" of the generic cell
+ * rate algorithm: the time at which the bucket would be full again. This
+ * makes taking a token a single compare-and-swap, so one bucket can be shared
+ * by every thread of the server without a lock.
+ */
+typedef struct {
+    /* Microseconds it takes to refill a single token, 0 for no limit */
+    long long interval;
+    /* Microseconds it takes to refill the whole bucket (burst * interval) */
+    long long capacity;
+    /* Time (as returned by now_us()) at which the bucket is full again */
+    long long fullAt;
+} TokenBucket;
+
+void init_token_bucket(TokenBucket *bucket, long rate, long burst);
+long long bucket_wait(TokenBucket *bucket, long long now);
+long long take_token(TokenBucket *bucket, long long now);
+
+#endif
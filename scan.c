@@ -0,0 +1,172 @@
+#include <stdbool.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+/* Whether the SSE2 and AVX2 kernels are compiled */
+#define SCAN_X86
+#endif
+
+/*
+ * Bytes below this value (as a signed char, so including bytes 128-255) are
+ * unprintable. (see get_printable() in lineList.c)
+ */
+#define MIN_PRINTABLE 32
+
+/* Character unprintable bytes are replaced with */
+#define REPLACEMENT '?'
+
+/* ScanLevel in use, or -1 if not yet chosen */
+static int scanLevel = -1;
+
+/*
+ * Returns the widest ScanLevel supported by the CPU.
+ */
+static ScanLevel supported_scan_level(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SCAN_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return SCAN_SSE2;
+    }
+#endif
+    return SCAN_SCALAR;
+}
+
+/*
+ * Returns the ScanLevel used by the scanning kernels, choosing the widest
+ * supported by the CPU on first use.
+ */
+ScanLevel get_scan_level(void) {
+    int level = __atomic_load_n(&scanLevel, __ATOMIC_RELAXED);
+    if (level < 0) {
+        level = supported_scan_level();
+        __atomic_store_n(&scanLevel, level, __ATOMIC_RELAXED);
+    }
+
+    return (ScanLevel) level;
+}
+
+/*
+ * Sets the ScanLevel used by the scanning kernels, e.g. to compare them in a
+ * benchmark. A level the CPU does not support is lowered to the widest it
+ * does. Returns the level set.
+ */
+ScanLevel set_scan_level(ScanLevel level) {
+    ScanLevel supported = supported_scan_level();
+    if (level > supported) {
+        level = supported;
+    }
+    __atomic_store_n(&scanLevel, level, __ATOMIC_RELAXED);
+
+    return level;
+}
+
+/* Returns the name of a ScanLevel */
+const char *scan_level_name(ScanLevel level) {
+    switch (level) {
+        case SCAN_SSE2:
+            return "sse2";
+        case SCAN_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+/*
+ * Returns true if a byte is unprintable.
+ */
+static bool is_unprintable(char byte) {
+    return (signed char) byte < MIN_PRINTABLE;
+}
+
+/*
+ * Scalar kernel of copy_printable().
+ */
+static void copy_printable_scalar(char *dest, const char *src,
+        size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        dest[i] = is_unprintable(src[i]) ? REPLACEMENT : src[i];
+    }
+}
+
+#ifdef SCAN_X86
+/*
+ * SSE2 kernel of copy_printable(). Unprintable bytes are found with a signed
+ * comparison and replaced by masking, so blocks are copied without
+ * branching on their contents.
+ */
+__attribute__((target("sse2")))
+static void copy_printable_sse2(char *dest, const char *src, size_t length) {
+    __m128i minimum = _mm_set1_epi8(MIN_PRINTABLE);
+    __m128i replacement = _mm_set1_epi8(REPLACEMENT);
+    size_t i = 0;
+
+    for (; i + sizeof(__m128i) <= length; i += sizeof(__m128i)) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i unprintable = _mm_cmplt_epi8(block, minimum);
+        block = _mm_or_si128(_mm_and_si128(unprintable, replacement),
+                _mm_andnot_si128(unprintable, block));
+        _mm_storeu_si128((__m128i *) (dest + i), block);
+    }
+
+    copy_printable_scalar(dest + i, src + i, length - i);
+}
+
+/*
+ * AVX2 kernel of copy_printable(). The bytes after the last full block are
+ * copied 16 at a time and then singly.
+ *
+ * The tail is handled with VEX encoded 128 bit instructions rather than by
+ * calling the SSE2 kernel, as mixing in legacy SSE instructions after AVX
+ * ones stalls some CPUs.
+ */
+__attribute__((target("avx2")))
+static void copy_printable_avx2(char *dest, const char *src, size_t length) {
+    __m256i minimum = _mm256_set1_epi8(MIN_PRINTABLE);
+    __m256i replacement = _mm256_set1_epi8(REPLACEMENT);
+    size_t i = 0;
+
+    for (; i + sizeof(__m256i) <= length; i += sizeof(__m256i)) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i unprintable = _mm256_cmpgt_epi8(minimum, block);
+        block = _mm256_blendv_epi8(block, replacement, unprintable);
+        _mm256_storeu_si256((__m256i *) (dest + i), block);
+    }
+
+    if (i + sizeof(__m128i) <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i unprintable = _mm_cmplt_epi8(block,
+                _mm256_castsi256_si128(minimum));
+        block = _mm_blendv_epi8(block, _mm256_castsi256_si128(replacement),
+                unprintable);
+        _mm_storeu_si128((__m128i *) (dest + i), block);
+        i += sizeof(__m128i);
+    }
+
+    copy_printable_scalar(dest + i, src + i, length - i);
+}
+#endif
+
+/*
+ * Copies a given number of bytes from src to dest, replacing unprintable
+ * bytes (control codes, and bytes 128-255 as these are negative chars) with
+ * question marks. dest is not null terminated.
+ */
+void copy_printable(char *dest, const char *src, size_t length) {
+    switch (get_scan_level()) {
+#ifdef SCAN_X86
+        case SCAN_AVX2:
+            copy_printable_avx2(dest, src, length);
+            break;
+        case SCAN_SSE2:
+            copy_printable_sse2(dest, src, length);
+            break;
+#endif
+        default:
+            copy_printable_scalar(dest, src, length);
+            break;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Instruction sets the scanning kernels may use, in increasing order of
+ * width. The widest supported by the CPU is used unless set_scan_level() is
+ * called.
+ */
+typedef enum {
+    /* One byte at a time */
+    SCAN_SCALAR,
+    /* 16 bytes at a time */
+    SCAN_SSE2,
+    /* 32 bytes at a time */
+    SCAN_AVX2
+} ScanLevel;
+
+ScanLevel get_scan_level(void);
+ScanLevel set_scan_level(ScanLevel level);
+const char *scan_level_name(ScanLevel level);
+void copy_printable(char *dest, const char *src, size_t length);
+
+#endif
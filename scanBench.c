@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lineList.h"
+#include "scan.h"
+#include "timing.h"
+
+/*
+ * Microbenchmark of the byte scans done on every line.
+ *
+ * Usage: scanBench
+ *
+ * For message sizes from 16B to 64KB, times finding the new line ending a
+ * message and a colon at its end with the C library's memchr(), and
+ * replacing its unprintable bytes with the copy_printable() kernel of scan.c
+ * at each ScanLevel the CPU supports. The functions these replaced (a byte
+ * at a time loop, pattern_match_string() and the quadratic get_printable())
+ * are timed as a baseline.
+ *
+ * memchr() is used for finding bytes as it outran hand-written SSE2 and
+ * AVX2 kernels here at every message size.
+ *
+ * Each result is the mean nanoseconds per message and the throughput in
+ * MB/s.
+ */
+
+/* Smallest and largest message sizes benchmarked */
+#define MIN_SIZE 16
+#define MAX_SIZE 65536
+/* Each function is run repeatedly for at least this many nanoseconds */
+#define MIN_RUN_NS 50000000LL
+/* Every this many bytes of a message is an unprintable byte */
+#define UNPRINTABLE_EVERY 97
+
+/* Volatile sink so the benchmarked results are not optimised away */
+static volatile size_t sink;
+
+/*
+ * The get_printable() of lineList.c before the scanning kernels, which calls
+ * strlen() on every iteration.
+ */
+static char *legacy_get_printable(char *line) {
+    char *printableLine = calloc(strlen(line) + 1, sizeof(char));
+
+    for (int i = 0; i < strlen(line); ++i) {
+        if ((int) line[i] < 32) {
+            printableLine[i] = '?';
+        } else {
+            printableLine[i] = line[i];
+        }
+    }
+
+    return printableLine;
+}
+
+/*
+ * Finds a new line a byte at a time, as lines were framed before the
+ * scanning kernels.
+ */
+static size_t legacy_find_newline(char *message, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        if (message[i] == '\n') {
+            return i;
+        }
+    }
+
+    return length;
+}
+
+/*
+ * Functions benchmarked, each run once over a message of a given length.
+ * The message ends with ':' followed by '\n' and contains unprintable bytes.
+ */
+typedef enum {
+    NEWLINE_LEGACY,
+    NEWLINE_MEMCHR,
+    COLON_LEGACY,
+    COLON_MEMCHR,
+    PRINTABLE_LEGACY,
+    PRINTABLE_KERNEL
+} BenchFunction;
+
+/*
+ * Runs a BenchFunction once over a message of a given length, using out as
+ * scratch space of at least that length.
+ */
+static void run_once(BenchFunction function, char *message, size_t length,
+        char *out) {
+    switch (function) {
+        case NEWLINE_LEGACY:
+            sink += legacy_find_newline(message, length);
+            break;
+        case NEWLINE_MEMCHR:
+            sink += (char *) memchr(message, '\n', length) - message;
+            break;
+        case COLON_LEGACY:
+            // pattern_match_string() needs the message as a string
+            message[length - 1] = '\0';
+            sink += pattern_match_string(":", message);
+            message[length - 1] = '\n';
+            break;
+        case COLON_MEMCHR:
+            sink += (char *) memchr(message, ':', length) - message;
+            break;
+        case PRINTABLE_LEGACY:
+            message[length - 1] = '\0';
+            free(legacy_get_printable(message));
+            message[length - 1] = '\n';
+            break;
+        case PRINTABLE_KERNEL:
+            copy_printable(out, message, length);
+            sink += out[0];
+            break;
+    }
+}
+
+/*
+ * Times a BenchFunction over a message of a given length and prints the
+ * mean time per message and throughput.
+ */
+static void bench(const char *name, BenchFunction function, char *message,
+        size_t length, char *out) {
+    long long runs = 0;
+    long long batch = 1;
+    long long start = now_ns();
+    long long elapsed;
+
+    // Runs are batched, doubling in size, to keep clock reads out of short
+    // runs
+    do {
+        for (long long i = 0; i < batch; ++i) {
+            run_once(function, message, length, out);
+        }
+        runs += batch;
+        batch *= 2;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_RUN_NS);
+
+    double nsPerRun = (double) elapsed / runs;
+    printf("%-18s %6zu %12.1f ns %10.1f MB/s\n", name, length, nsPerRun,
+            length * 1000.0 / nsPerRun);
+}
+
+/*
+ * Fills a message of a given length with printable text containing an
+ * unprintable byte every UNPRINTABLE_EVERY bytes, ending in ":\n".
+ */
+static void fill_message(char *message, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        message[i] = 'a' + i % 26;
+        if (i % UNPRINTABLE_EVERY == UNPRINTABLE_EVERY - 1) {
+            message[i] = '\t';
+        }
+    }
+    message[length - 2] = ':';
+    message[length - 1] = '\n';
+}
+
+int main(int argc, char **argv) {
+    char *message = malloc(MAX_SIZE);
+    char *out = malloc(MAX_SIZE);
+    ScanLevel best = get_scan_level();
+
+    printf("%-18s %6s %15s %15s\n", "function", "bytes", "time", "rate");
+    for (size_t length = MIN_SIZE; length <= MAX_SIZE; length *= 4) {
+        fill_message(message, length);
+
+        bench("newline-bytewise", NEWLINE_LEGACY, message, length, out);
+        bench("newline-memchr", NEWLINE_MEMCHR, message, length, out);
+        bench("colon-pattern", COLON_LEGACY, message, length, out);
+        bench("colon-memchr", COLON_MEMCHR, message, length, out);
+        bench("printable-legacy", PRINTABLE_LEGACY, message, length, out);
+
+        for (ScanLevel level = SCAN_SCALAR; level <= best; level++) {
+            set_scan_level(level);
+            char name[32];
+            sprintf(name, "printable-%s", scan_level_name(level));
+            bench(name, PRINTABLE_KERNEL, message, length, out);
+        }
+        set_scan_level(best);
+        printf("\n");
+    }
+
+    free(message);
+    free(out);
+
+    return 0;
+}
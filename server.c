@@ -6,52 +6,87 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/resource.h>
 #include "commands.h"
 #include "clientThread.h"
 #include "clientList.h"
 #include "serverUtils.h"
+#include "serverConfig.h"
+#include "eventLoop.h"
+#include "adminSocket.h"
+#include "trace.h"
 #include "errors.h"
 
-char *setup_server(int argc, char **argv, int *actualPortNo, int *fdListen);
+char *setup_server(ServerConfig *config, int *actualPortNo, int *fdListen);
 int open_listen(char *port, int *actualPortNo);
+void raise_fd_limit();
 void suppress_sigpipe();
 
 int main(int argc, char **argv) {
     toggle_sighup(0, NULL);
     int actualPortNo;
     int fdListen;
+    bool invalidArgs = false;
+    ServerConfig *config = init_server_config(argc, argv, &invalidArgs);
+    if (invalidArgs) {
+        exit_with_msg(USAGE, SERVER);
+    }
     // Check server arguments validity and connect it to the given port
-    char *password = setup_server(argc, argv, &actualPortNo, &fdListen);
+    char *password = setup_server(config, &actualPortNo, &fdListen);
 
     // Emit connected port number
     fprintf(stderr, "%d\n", actualPortNo);
     fflush(stderr);
     ClientList *clients = init_client_list();
     set_password(clients, password);
+    set_config(clients, config);
 
     pthread_t threadId;
     pthread_create(&threadId, NULL, sighup_stats_handler, clients);
     pthread_detach(threadId);
 
+    if (config->tracePath != NULL) {
+        start_tracing(config->tracePath, config->traceEvents);
+    }
+    if (config->adminPath != NULL
+            && !start_admin_socket(clients, config->adminPath)) {
+        exit_with_msg(COMMS, SERVER);
+    }
+
     suppress_sigpipe();
 
+    if (config->eventLoop) {
+        raise_fd_limit();
+    }
+    EventLoopGroup *loops = start_event_loops(clients, config->loopThreads);
+
     while (1) {
         struct sockaddr_in fromAddr;
         socklen_t fromAddrSize = sizeof(struct sockaddr_in);
         int fd = accept(fdListen, (struct sockaddr *) &fromAddr,
                 &fromAddrSize);
-        spawn_client_thread(clients, fd);
+        if (fd < 0) {
+            continue;
+        }
+        trace_event(TRACE_ACCEPT, fd);
+
+        if (config->eventLoop) {
+            event_loop_add(loops, fd);
+        } else {
+            spawn_client_thread(clients, loops, fd);
+        }
     }
 
     return 0;
 }
 
 /*
- * Given the command line arguments with which a server was started, sets up 
- * the server by performing the following actions:
+ * Given the configuration parsed from the command line arguments with which
+ * a server was started, sets up the server by performing the following
+ * actions:
  *
- * - Verifies the validity of arguments and the given authfile;
- *   server is made to exit with communications error if any were invalid
+ * - Verifies the validity of the given authfile; server is made to exit with
+ *   a usage error if it was invalid
  *
  * - Attempts to connect the server to the specified port and open a listening
  *   socket on that port; server is made to exit with communications error on 
@@ -63,30 +98,17 @@ int main(int argc, char **argv) {
  *
  *   The retrieved password is then returned.
  */
-char *setup_server(int argc, char **argv, int *actualPortNo, int *fdListen) {
-    
-    // Usage error if the number of arguments to the server is incorrect
-    if (argc != 2 && argc != 3) {
-        exit_with_msg(USAGE, SERVER);
-    }
-
+char *setup_server(ServerConfig *config, int *actualPortNo, int *fdListen) {
     bool invalidAuthFile = false;
 
     // Retrieve password from given authfile; usage error on invalid authfile
-    char *password = get_password(argv[1], &invalidAuthFile);
+    char *password = get_password(config->authPath, &invalidAuthFile);
     if (invalidAuthFile) {
         exit_with_msg(USAGE, SERVER);
     }
 
-    // Default port is 0 - which gives an ephemeral port
-    char *port = "0";
-    // Retrive port if given as an argument
-    if (argc == 3) {
-        port = argv[2];
-    }
-
     // Try connecting to the given port; comms error if connection failed
-    if ((*fdListen = open_listen(port, actualPortNo)) < 0) {
+    if ((*fdListen = open_listen(config->port, actualPortNo)) < 0) {
         free(password);
         exit_with_msg(COMMS, SERVER);
     }
@@ -94,6 +116,19 @@ char *setup_server(int argc, char **argv, int *actualPortNo, int *fdListen) {
     return password;
 }
 
+/*
+ * Raises the limit on the number of file descriptors the server may have
+ * open to the maximum allowed, as event loop mode is intended to handle
+ * many thousands of simultaneous clients.
+ */
+void raise_fd_limit() {
+    struct rlimit limit;
+    if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
 /*
  * Create a listening socket and connects it to the given port.
  *
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "serverConfig.h"
+#include "trace.h"
+
+/* Prefix all server option arguments start with */
+#define OPTION_PREFIX "--"
+
+/* Largest value accepted for integer options */
+#define MAX_OPTION_VALUE 1000000000
+
+/*
+ * Parses a string as a non-negative integer.
+ * Returns the integer, or -1 if the string is not a valid integer.
+ */
+static long parse_non_negative(char *value) {
+    if (value == NULL || *value == '\0') {
+        return -1;
+    }
+
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0' || parsed < 0 || parsed > MAX_OPTION_VALUE) {
+        return -1;
+    }
+
+    return parsed;
+}
+
+/*
+ * Parses the name of a slow consumer policy ("drop", "disconnect" or
+ * "pause") into the SlowPolicy at policy.
+ * Returns true if the name was valid, else false.
+ */
+static bool parse_slow_policy(char *value, SlowPolicy *policy) {
+    if (value == NULL) {
+        return false;
+    } else if (!strcmp(value, "drop")) {
+        *policy = SLOW_DROP_OLDEST;
+    } else if (!strcmp(value, "disconnect")) {
+        *policy = SLOW_DISCONNECT;
+    } else if (!strcmp(value, "pause")) {
+        *policy = SLOW_PAUSE;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if the name part of an option argument (of a given length)
+ * matches a given option name.
+ */
+static bool option_is(char *name, size_t nameLen, char *option) {
+    return nameLen == strlen(option) && !strncmp(name, option, nameLen);
+}
+
+/*
+ * Applies a single "--name" or "--name=value" option argument to a
+ * ServerConfig.
+ *
+ * Returns true if the option was recognised and its value valid, else false.
+ */
+static bool apply_option(ServerConfig *config, char *option) {
+    char *name = option + strlen(OPTION_PREFIX);
+    char *value = strchr(name, '=');
+    size_t nameLen = value == NULL ? strlen(name) : value - name;
+    if (value != NULL) {
+        value++;
+    }
+
+    if (option_is(name, nameLen, "event-loop")) {
+        config->eventLoop = true;
+        return value == NULL;
+    } else if (option_is(name, nameLen, "loop-threads")) {
+        config->loopThreads = (int) parse_non_negative(value);
+        return config->loopThreads > 0;
+    } else if (option_is(name, nameLen, "handshake-timeout")) {
+        config->handshakeTimeout = parse_non_negative(value);
+        return config->handshakeTimeout >= 0;
+    } else if (option_is(name, nameLen, "rate")) {
+        config->clientRate = parse_non_negative(value);
+        return config->clientRate >= 0;
+    } else if (option_is(name, nameLen, "burst")) {
+        config->clientBurst = parse_non_negative(value);
+        return config->clientBurst > 0;
+    } else if (option_is(name, nameLen, "global-rate")) {
+        config->globalRate = parse_non_negative(value);
+        return config->globalRate >= 0;
+    } else if (option_is(name, nameLen, "global-burst")) {
+        config->globalBurst = parse_non_negative(value);
+        return config->globalBurst > 0;
+    } else if (option_is(name, nameLen, "queue-high")) {
+        config->queueHigh = parse_non_negative(value);
+        return config->queueHigh > 0;
+    } else if (option_is(name, nameLen, "queue-low")) {
+        config->queueLow = parse_non_negative(value);
+        return config->queueLow >= 0;
+    } else if (option_is(name, nameLen, "slow-policy")) {
+        return parse_slow_policy(value, &config->slowPolicy);
+    } else if (option_is(name, nameLen, "max-line")) {
+        config->maxLineLength = parse_non_negative(value);
+        return config->maxLineLength >= 0;
+    } else if (option_is(name, nameLen, "max-oversized")) {
+        config->maxOversized = (int) parse_non_negative(value);
+        return config->maxOversized >= 0;
+    } else if (option_is(name, nameLen, "compress")) {
+        config->compress = true;
+        return value == NULL;
+    } else if (option_is(name, nameLen, "compress-level")) {
+        config->compressLevel = (int) parse_non_negative(value);
+        return config->compressLevel >= 0
+                && config->compressLevel <= Z_BEST_COMPRESSION;
+    } else if (option_is(name, nameLen, "admin-socket")) {
+        config->adminPath = value;
+        return value != NULL && *value != '\0';
+    } else if (option_is(name, nameLen, "trace")) {
+        config->tracePath = value;
+        return value != NULL && *value != '\0';
+    } else if (option_is(name, nameLen, "trace-events")) {
+        config->traceEvents = (int) parse_non_negative(value);
+        return config->traceEvents > 0;
+    }
+
+    return false;
+}
+
+/*
+ * Creates a ServerConfig from the command line arguments a server was run
+ * with. Option arguments (starting with "--") may be given in any order
+ * before the authfile and optional port arguments.
+ *
+ * Sets the flag at invalidArgs to true if an unknown or malformed option was
+ * given or the number of positional arguments is incorrect.
+ *
+ * Returns a pointer to the new ServerConfig.
+ */
+ServerConfig *init_server_config(int argc, char **argv, bool *invalidArgs) {
+    ServerConfig *config = (ServerConfig *) calloc(1, sizeof(ServerConfig));
+    config->port = "0";
+    config->eventLoop = false;
+    config->loopThreads = DEFAULT_LOOP_THREADS;
+    config->handshakeTimeout = DEFAULT_HANDSHAKE_TIMEOUT;
+    config->clientRate = DEFAULT_CLIENT_RATE;
+    config->clientBurst = DEFAULT_CLIENT_BURST;
+    config->globalRate = 0;
+    config->globalBurst = 1;
+    config->queueHigh = DEFAULT_QUEUE_HIGH;
+    config->queueLow = DEFAULT_QUEUE_LOW;
+    config->slowPolicy = SLOW_DROP_OLDEST;
+    config->maxLineLength = DEFAULT_MAX_LINE;
+    config->maxOversized = DEFAULT_MAX_OVERSIZED;
+    config->compress = false;
+    config->compressLevel = DEFAULT_COMPRESS_LEVEL;
+    config->adminPath = NULL;
+    config->tracePath = NULL;
+    config->traceEvents = DEFAULT_TRACE_EVENTS;
+
+    int argNo = 1;
+    while (argNo < argc && !strncmp(argv[argNo], OPTION_PREFIX,
+            strlen(OPTION_PREFIX))) {
+        if (!apply_option(config, argv[argNo])) {
+            *invalidArgs = true;
+        }
+        argNo++;
+    }
+    if (config->queueLow > config->queueHigh) {
+        *invalidArgs = true;
+    }
+
+    // Remaining arguments are authfile and optionally the port
+    int positional = argc - argNo;
+    if (positional != 1 && positional != 2) {
+        *invalidArgs = true;
+        return config;
+    }
+
+    config->authPath = argv[argNo];
+    if (positional == 2) {
+        config->port = argv[argNo + 1];
+    }
+
+    return config;
+}
+
+/* Frees memory allocated to a ServerConfig */
+void free_server_config(ServerConfig *config) {
+    free(config);
+}
@@ -0,0 +1,124 @@
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <stdbool.h>
+#include "outQueue.h"
+#include "compress.h"
+
+/* Default number of event loop threads */
+#define DEFAULT_LOOP_THREADS 4
+/* Default time in ms clients have to complete authentication and naming */
+#define DEFAULT_HANDSHAKE_TIMEOUT 30000
+/* Default number of commands per second each client may send */
+#define DEFAULT_CLIENT_RATE 10
+/* Default number of commands a client may send at once after being idle */
+#define DEFAULT_CLIENT_BURST 5
+/* Default number of queued output bytes making a client a slow consumer */
+#define DEFAULT_QUEUE_HIGH 262144
+/* Default number of queued output bytes a slow consumer must drain to */
+#define DEFAULT_QUEUE_LOW 65536
+/* Default largest number of bytes in a line read from a client */
+#define DEFAULT_MAX_LINE 65536
+/* Default number of oversized lines after which a client is disconnected */
+#define DEFAULT_MAX_OVERSIZED 3
+
+/*
+ * Struct storing the configuration of a server as given by its command line
+ * arguments.
+ *
+ * Options are given as "--name" or "--name=value" arguments before the
+ * positional authfile and port arguments, i.e.
+ *
+ * server [--event-loop] [--loop-threads=N] [--handshake-timeout=MS]
+ *        [--rate=N] [--burst=N] [--global-rate=N] [--global-burst=N]
+ *        [--queue-high=BYTES] [--queue-low=BYTES]
+ *        [--slow-policy=drop|disconnect|pause] [--max-line=BYTES]
+ *        [--max-oversized=N] [--compress] [--compress-level=N]
+ *        [--admin-socket=PATH] [--trace=PATH] [--trace-events=N]
+ *        authfile [port]
+ *
+ * Commands over the --rate or --global-rate limits are deferred until their
+ * token is due. With --event-loop they wait in their loop without blocking
+ * it. Without it, the client's own thread sleeps, for at most 100ms at a
+ * time, and reads nothing from the client until the command is handled.
+ */
+typedef struct {
+    /* Path to the server's authfile */
+    char *authPath;
+    /* Port the server should listen on, "0" for an ephemeral port */
+    char *port;
+    /*
+     * Whether clients are handled by a fixed set of epoll driven event loop
+     * threads instead of a thread per client.
+     */
+    bool eventLoop;
+    /*
+     * Number of event loop threads to use. In thread-per-client mode the
+     * loops only write output queued for clients.
+     */
+    int loopThreads;
+    /*
+     * Time in milliseconds a client has from connecting to complete
+     * authentication and name negotiation before it is disconnected.
+     * 0 disables the deadline.
+     */
+    long handshakeTimeout;
+    /*
+     * Commands per second each client may send, 0 for no limit. Commands
+     * over the limit are deferred (see wait_command_token() in
+     * serverUtils.c and eventLoop.c).
+     */
+    long clientRate;
+    /* Commands a client may send in a burst after being idle */
+    long clientBurst;
+    /* Commands per second all clients together may send, 0 for no limit */
+    long globalRate;
+    /* Commands all clients together may send in a burst */
+    long globalBurst;
+    /*
+     * Number of bytes of output queued for a single client above which it is
+     * a slow consumer
+     */
+    long queueHigh;
+    /*
+     * Number of bytes of queued output a slow consumer must drain to before
+     * it is no longer one; at most queueHigh
+     */
+    long queueLow;
+    /* How messages to slow consumers are handled (see out_queue_push()) */
+    SlowPolicy slowPolicy;
+    /*
+     * Largest number of bytes in a line read from a client, excluding its
+     * new line, 0 for no limit. Longer lines are discarded.
+     */
+    long maxLineLength;
+    /*
+     * Number of oversized lines after which a client is disconnected, 0 to
+     * never disconnect clients for them
+     */
+    int maxOversized;
+    /*
+     * Whether clients which ask for compression of their output during
+     * their handshake get it (see compress.h)
+     */
+    bool compress;
+    /* zlib compression level (0-9) of compressed clients' output */
+    int compressLevel;
+    /*
+     * Path of the Unix domain socket stats are served on (see
+     * adminSocket.c), or NULL for none
+     */
+    char *adminPath;
+    /*
+     * Path the event trace is dumped to on SIGUSR1 (see trace.c), or NULL if
+     * events are not traced
+     */
+    char *tracePath;
+    /* Number of most recent events traced per thread */
+    int traceEvents;
+} ServerConfig;
+
+ServerConfig *init_server_config(int argc, char **argv, bool *invalidArgs);
+void free_server_config(ServerConfig *config);
+
+#endif
@@ -6,47 +6,42 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
 #include "serverUtils.h"
 #include "commands.h"
 #include "clientList.h"
 #include "clientThread.h"
 #include "lineList.h"
+#include "handshake.h"
+#include "eventLoop.h"
+#include "timing.h"
 #include "errors.h"
+#include "statsSnapshot.h"
+#include "textBuffer.h"
+#include "trace.h"
+#include "scan.h"
 
-/* 
- * As per the spec, client-handling threads sleep for 100ms or 100000usec in
- * between handling messages
- */
-#define CLIENT_SLEEP 100000
-
-/* 
- * The command numbers corresponding to commands a server can receive.
- * This correspond to the outputs of the function get_cmd_no() from commands.h
+/* Number of microseconds in a second */
+#define USEC_PER_SEC 1000000
+/*
+ * Longest time in microseconds a client's thread sleeps at once while its
+ * command is deferred by the rate limits, so a client whose connection broke
+ * meanwhile is noticed
  */
-typedef enum {
-    NAME,
-    AUTH,
-    SAY,
-    KICK,
-    LIST,
-    LEAVE
-} ServerCmdNumbers;
+#define MAX_TOKEN_SLEEP 100000
 
 /*
  * typedef for server command handling functions.
  * Used to declare the const array handlers below
  */
-typedef void (*ServerHandlerFunction)(ClientThreadData *, LineList *);
+typedef void (*ServerHandlerFunction)(ClientThreadData *, CmdView *);
 
-void name_negotiate(ClientList *clients, ClientThread *client);
-void authenticate_client(ClientList *clients, ClientThread *client);
 void *client_thread_handler(void *arg);
-void handle_cmd(ClientThreadData *data, char *cmd);
 
-void handle_say(ClientThreadData *data, LineList *cmdArgs);
-void handle_kick(ClientThreadData *data, LineList *cmdArgs);
-void handle_list(ClientThreadData *data, LineList *cmdArgs);
-void handle_leave(ClientThreadData *data, LineList *cmdArgs);
+void handle_say(ClientThreadData *data, CmdView *cmd);
+void handle_kick(ClientThreadData *data, CmdView *cmd);
+void handle_list(ClientThreadData *data, CmdView *cmd);
+void handle_leave(ClientThreadData *data, CmdView *cmd);
 
 /*
  * Array of pointers to functions for handling commands sent to the server by
@@ -55,73 +50,177 @@ void handle_leave(ClientThreadData *data, LineList *cmdArgs);
  * it.
  *
  * Each function takes as input a ClientThreadData struct containing data about
- * the client that the thread is handling and a LineList storing the arguments 
- * of a received command.
+ * the client that the thread is handling and a CmdView of a received command.
  *
- * Note that the two NULLs are padding in place of the NAME: and AUTH:
- * commands which are handled separately from the other commands.
+ * The array is generated from SERVER_COMMANDS and indexed by command number.
+ * Note that NAME:, AUTH: and ASSIGN: have NULL handlers as they are handled
+ * separately from the other commands.
  */
-const ServerHandlerFunction handlers[] = {
-        NULL,
-        NULL,
-        handle_say,
-        handle_kick,
-        handle_list,
-        handle_leave
-        };
+const ServerHandlerFunction handlers[] = {SERVER_COMMANDS(CMD_HANDLER)};
 
 /*
  * Given a file descriptor to a new client received from a listening socket,
- * spawns a new thread to handle that client. Then conducts authentication and 
- * name negotiation on that client.
+ * spawns a new thread to handle that client.
  *
- * Upon success of the above two procedures, adds a ClientNode containing
- * a ClientInstance storing information about the new client to an existing
- * ClientList. (see add_client() in clientList.c).
+ * Authentication and name negotiation are conducted by the new thread (see
+ * run_handshake()), so a slow or silent client never delays the server
+ * accepting further clients.
  *
- * Moreover, ENTER:<name> commands are then sent to all clients and a 
- * "(<name> has entered the chat)" is message emitted to stdout.
+ * Messages to the client are written by one of the given event loops, so
+ * neither the new thread nor threads broadcasting to the client block on it.
  */
-void spawn_client_thread(ClientList *clients, int fdClient) {
-    // dup() the clients file descriptor to separate read/write fds
-    int fdWrite = dup(fdClient);
-    FILE *readFrom = fdopen(fdClient, "r");
-    FILE *writeTo = fdopen(fdWrite, "w");
-
-    ClientThread *client = init_client_thread(readFrom, writeTo);
-    authenticate_client(clients, client);
-    if (get_active_status(client)) {
-        name_negotiate(clients, client);
-    } else {
-        free_client_thread(client);
-        return;
-    }
+void spawn_client_thread(ClientList *clients, EventLoopGroup *loops,
+        int fdClient) {
+    // The thread reads the socket directly, while its event loop writes
+    // the same socket (see event_conn_attach())
+    Connection *reader = init_connection(fdClient, &clients->lineLimits);
 
-    add_client(clients, client);
-    
     // Create ClientThreadData struct to pass to the client handler thread
     ClientThreadData *data = (ClientThreadData *)
             malloc(sizeof(ClientThreadData));
     data->clients = clients;
-    data->client = client;
+    data->client = init_client_thread(reader);
+    event_conn_attach(loops, fdClient, data->client);
+    init_client_rate(clients, data->client);
 
     pthread_t threadId;
     pthread_create(&threadId, NULL, client_thread_handler, data);
     pthread_detach(threadId);
+}
+
+/*
+ * Conducts authentication and name negotiation with a client from its own
+ * handling thread by feeding each line it sends to handshake_step().
+ *
+ * Reads from the client time out at the handshake's deadline, after which
+ * the handshake fails.
+ *
+ * Returns true if the client completed the handshake and was added to the
+ * ClientList, else false.
+ */
+bool run_handshake(ClientList *clients, ClientThread *client) {
+    Handshake shake;
+    start_handshake(&shake, clients, client);
+
+    while (shake.state != HANDSHAKE_DONE && shake.state != HANDSHAKE_FAILED) {
+        set_client_read_timeout(client, handshake_remaining(&shake,
+                now_ms()));
+        bool isLineEmpty = false;
+        size_t length;
+        char *clientReply = read_client_line(client, &length, &isLineEmpty);
+
+        if (isLineEmpty || handshake_remaining(&shake, now_ms()) == 0) {
+            shake.state = HANDSHAKE_FAILED;
+        } else {
+            handshake_step(&shake, clients, client, clientReply, length);
+        }
+    }
+
+    set_client_read_timeout(client, -1);
+
+    return shake.state == HANDSHAKE_DONE;
+}
 
-    // Send ENTER commands and emit stdout message
-    char *name = get_printable(client->name);
+/*
+ * Sends ENTER:<name> commands to all clients for a client which has just been
+ * added to the server and emits "(<name> has entered the chat)" to stdout.
+ */
+void announce_entry(ClientList *clients, ClientThread *client) {
+    char *name = client->printableName;
     send_all_clients(clients, "ENTER:%s", name);
     printf("(%s has entered the chat)\n", name);
     fflush(stdout);
-    free(name);
+}
+
+/*
+ * Sends LEAVE:<name> commands to all clients for a client which is leaving
+ * the server and emits "(<name> has left the chat)" to stdout.
+ *
+ * This is not done for clients with null names (which should not occur
+ * except in very edge cases)
+ */
+void announce_exit(ClientList *clients, ClientThread *client) {
+    if (client->name != NULL) {
+        char *name = client->printableName;
+        send_all_clients(clients, "LEAVE:%s", name);
+        printf("(%s has left the chat)\n", name);
+        fflush(stdout);
+    }
+}
+
+/*
+ * Sets up the rate limit of a newly connected client from the server's
+ * configuration.
+ */
+void init_client_rate(ClientList *clients, ClientThread *client) {
+    init_token_bucket(&client->bucket, clients->config->clientRate,
+            clients->config->clientBurst);
+}
+
+/*
+ * Attempts to take a token from both a client's own token bucket and the
+ * server wide token bucket at a given time, allowing the client's next
+ * command to be handled.
+ *
+ * Returns 0 if the command may be handled now. Otherwise no token is taken
+ * from either bucket and the number of microseconds until the command should
+ * be retried is returned.
+ */
+long long take_command_token(ClientList *clients, ClientThread *client,
+        long long now) {
+    // Check the client's own bucket first so a client over its own limit
+    // never uses up the server wide budget
+    long long wait = bucket_wait(&client->bucket, now);
+    if (wait == 0) {
+        wait = take_token(&clients->globalBucket, now);
+    }
+    if (wait == 0) {
+        // Only this client's handler takes from its bucket, so this succeeds
+        take_token(&client->bucket, now);
+    }
+
+    return wait;
+}
+
+/*
+ * Waits until a client's next command may be handled under the server's
+ * rate limits. Commands within the limits are handled immediately.
+ *
+ * A client with its own thread has nothing else for that thread to do while
+ * its command is deferred, so the thread sleeps until the token is due, for
+ * at most MAX_TOKEN_SLEEP at a time. Nothing more is read from the client
+ * meanwhile. (Event loop clients are deferred without a thread each; see
+ * eventLoop.c)
+ *
+ * Returns true once the command may be handled, or false if the client was
+ * deactivated or its connection broke (e.g. it was evicted as a slow
+ * consumer) while waiting, in which case the command should be dropped and
+ * the client's disconnection is left to its next read.
+ */
+bool wait_command_token(ClientList *clients, ClientThread *client) {
+    long long wait;
+    while ((wait = take_command_token(clients, client, now_us())) > 0) {
+        if (!get_active_status(client) || event_conn_broken(client->conn)) {
+            return false;
+        }
+        if (wait > MAX_TOKEN_SLEEP) {
+            wait = MAX_TOKEN_SLEEP;
+        }
+        struct timespec delay;
+        delay.tv_sec = wait / USEC_PER_SEC;
+        delay.tv_nsec = (wait % USEC_PER_SEC) * 1000;
+        nanosleep(&delay, NULL);
+    }
+
+    return true;
 }
 
 /*
  * Function used by client handling server threads to communicate with a client
  *
- * Handles client messages with a 100ms sleep between handling consecutive
- * messages.
+ * Conducts the client's handshake, then on success sends ENTER: commands for
+ * it and handles client messages as permitted by the server's rate limits.
+ * (see wait_command_token())
  *
  * Upon a client exiting the server, appropriate LEAVE: commands are broadcast 
  * to the other clients and a "(... has left the chat)" message emitted to 
@@ -132,183 +231,109 @@ void *client_thread_handler(void *arg) {
     ClientThreadData *data = (ClientThreadData *) arg;
     ClientThread *client = data->client;
     ClientList *clients = data->clients;
+
+    if (!run_handshake(clients, client)) {
+        free_client_thread(client);
+        free(data);
+        return 0;
+    }
+    announce_entry(clients, client);
     
     while(get_active_status(client)) {
-        usleep(CLIENT_SLEEP);
         bool isLineEmpty = false;
-        char *clientMsg = read_client_line(client, &isLineEmpty);
+        size_t length;
+        char *clientMsg = read_client_line(client, &length, &isLineEmpty);
+        long long readAt = now_ns();
 
         // Deactivate the client if the EOF was read from the client
         if (isLineEmpty) {
             disable_client(client);
-            free(clientMsg);
             continue;
         }
 
-        handle_cmd(data, clientMsg);
+        if (wait_command_token(clients, client)) {
+            handle_cmd(data, clientMsg, length, readAt);
+        }
     }
 
     // Send LEAVE: message to all clients and emit leaving message to stdout.
-    // This is not done for clients with null names (which should not occur
-    // except in very edge cases)
-    if (client->name != NULL) {
-        char *name = get_printable(client->name);
-        send_all_clients(clients, "LEAVE:%s", name);
-        printf("(%s has left the chat)\n", name);
-        fflush(stdout);
-        free(name);
-    }
+    announce_exit(clients, client);
 
     // Free memory allocated to handling the client and remove the client
-    // from the linked list of clients
+    // from the linked list of clients. This thread has nothing else to do,
+    // so it waits for readers still at the client instead of leaving it to
+    // a later pass.
     remove_client(clients, client);
+    sync_removed_clients(clients);
     free(data);
 
     return 0;
 }
 
 /*
- * Handles password authentication of a client.
+ * Handles a command in string form of a given length sent to the server by a
+ * client, which was read from the client's socket at a given time (as
+ * returned by now_ns()).
  *
- * Does nothing if the server requires no authentication, otherwise:
+ * The command is parsed in place (see parse_client_cmd()) and is not freed.
  *
- * Sends an AUTH: command to a client and waits for a reply.
+ * The time from the command being read to it being dispatched, and the time
+ * its handler takes, are recorded in the server's latency histograms.
  *
- * If the client responded with an AUTH:<password> command, checks if the
- * password matches that of the server and if so the client is allowed to
- * continue to name negotiation.
+ * Note that the commands NAME:, AUTH: and ASSIGN: are handled separately by
+ * the client's handshake. (see handshake.c)
  *
- * Otherwise, if the client responded with an incorrected password or any
- * response that wasn't a valid AUTH: command, communications with that client
- * are immediately terminated.
+ * All invalid commands are silently ignored.
  */
-void authenticate_client(ClientList *clients, ClientThread *client) {
-    bool authenticated = false;
-    // Authentication is successful by default if the server requires no 
-    // authentication
-    if (clients->password == NULL) {
-        authenticated = true;
-    } else {
-        /*
-         * Send AUTH: to the client and get its response
-         */
-        send_client(client, "AUTH:");
-        char *clientReply = read_client_line(client, NULL);
-        LineList *cmdArgs = cmd_to_lines(clientReply, SERVER);
-
-        // Check for a valid AUTH: command
-        if (cmdArgs != NULL && cmdArgs->numLines > 1 
-                && get_cmd_no(cmdArgs->lines[0], SERVER) == AUTH) {
-            // Update server stats
-            clients->stats[AUTH_COUNT]++;
-            // Check password
-            if (!strcmp(clients->password, cmdArgs->lines[1])) {
-                authenticated = true;
-            }
+void handle_cmd(ClientThreadData *data, char *cmd, size_t length,
+        long long readAt) {
+    CmdView view;
+
+    if (parse_client_cmd(data->client, cmd, length, &view)) {
+        int cmdNo = view.cmdNo;
+        // Only attempt to handle commands with handlers, as NAME:, AUTH:
+        // and ASSIGN: are not handled in this function
+        if (handlers[cmdNo] != NULL) {
+            ClientList *clients = data->clients;
+            long long start = now_ns();
+            histogram_record(&clients->dispatchLatency, start - readAt);
+            trace_event(TRACE_CMD_START, cmdNo);
+            handlers[cmdNo](data, &view);
+            trace_event(TRACE_CMD_END, cmdNo);
+            histogram_record(&clients->handlerLatency, now_ns() - start);
         }
-
-        free_line_list(cmdArgs);
-        free(clientReply);
-    }
-
-    // Send OK: to the client on successful authentication
-    if (authenticated) {
-        send_client(client, "OK:");
-    } else {
-        // Else terminate communications with the client
-        disable_client(client);
     }
 }
 
 /*
- * Performs name negotiation on a client.
- * Sends WHO: to a client and waits for a NAME:<name> reply.
- * If there isn't already another client in a given list of clients with that
- * name the following things are done:
- * - the client's name is set to the given name
- * - an OK: command is sent to the client
- * - a ENTER:<name> command is sent to all clients in the server where name is
- *   the name that was just set
- * - name negotiation is then ended
- *
- * Otherwise the server sends the NAME_TAKEN: command to the client and the
- * process is repeated.
+ * Copies a field of a command from a framed client into a new string,
+ * replacing non-printable characters with question marks (see
+ * copy_printable()). The whole field is copied, as frames may hold null
+ * bytes. If keepNewLines is true, new lines are kept rather than replaced.
  *
- * If the client responds with an invalid command (i.e. not a NAME:), then
- * the connection with the client is immediately terminated.
+ * The returned string should be freed by the caller.
  */
-void name_negotiate(ClientList *clients, ClientThread *client) {
-    bool isLineEmpty = false;
-
-    while (1) {
-        /*
-         * Send WHO: to the client then get its response
-         */
-        send_client(client, "WHO:");
-        char *clientReply = read_client_line(client, &isLineEmpty);
-
-        if (isLineEmpty) {
-            disable_client(client);
-            break;
-        }
-
-        LineList *cmdArgs = cmd_to_lines(clientReply, SERVER);
-        free(clientReply);
-
-        // Check the client's reply was a valid NAME: command
-        if (cmdArgs != NULL && get_cmd_no(cmdArgs->lines[0], SERVER) == NAME) {
-            char *name = cmdArgs->lines[1];
-            // Update server stats
-            clients->stats[NAME_COUNT]++;
-            // Check if the given name was empty, and if not, if the name is
-            // already taken
-            if (cmdArgs->numLines > 1 &&
-                    get_client_by_name(clients, name) == NULL) {
-                // Set name and end name negotation if the name is not in use
-                set_client_name(client, name);
-                send_client(client, "OK:");
-                free_line_list(cmdArgs);
-                break;
-            }
-            
-            send_client(client, "NAME_TAKEN:");
-        } else {
-            disable_client(client);
-            break;
+static char *copy_printable_field(CmdField *field, bool keepNewLines) {
+    char *copy = (char *) malloc(field->length + 1);
+    size_t start = 0;
+
+    while (start < field->length) {
+        char *newLine = keepNewLines ? memchr(field->start + start, '\n',
+                field->length - start) : NULL;
+        size_t end = newLine == NULL ? field->length : newLine - field->start;
+        copy_printable(copy + start, field->start + start, end - start);
+        if (newLine != NULL) {
+            copy[end++] = '\n';
         }
-
-        free_line_list(cmdArgs);
+        start = end;
     }
-}
+    copy[field->length] = '\0';
 
-/*
- * Handles a command in string form sent to the server by a client.
- *
- * Note that the commands NAME: and AUTH: are handled separately by
- * name_negotiate and authenticate_client
- * respectively.
- *
- * All invalid commands are silently ignored.
- */
-void handle_cmd(ClientThreadData *data, char *cmd) {
-    LineList *cmdArgs = cmd_to_lines(cmd, SERVER);
-
-    free(cmd);
-    if (cmdArgs != NULL) {
-        int cmdNo = get_cmd_no(cmdArgs->lines[0], SERVER);
-        // Only attempt to handle functions with command numbers greater than
-        // one as 0, 1 correspond to NAME: and AUTH: which are not handled in
-        // this function
-        if (cmdNo > AUTH) {
-            handlers[cmdNo](data, cmdArgs);
-        }
-    } else {
-        free_line_list(cmdArgs);
-    }
+    return copy;
 }
 
 /*
- * Handler for the SAY: command from a client given a LineList containing
+ * Handler for the SAY: command from a client given a CmdView of
  * the arguments for that command.
  *
  * Rebroadcasts the message as a MSG:<name>:<contents> command to all clients 
@@ -318,27 +343,55 @@ void handle_cmd(ClientThreadData *data, char *cmd) {
  *
  * The message is also emitted to stdout in the format bob: a message
  *
+ * The MSG: command is formatted once and the same bytes are queued for every
+ * client. (see broadcast_payload())
+ *
+ * Framed clients may send new lines, which are kept in the frame sent to
+ * clients receiving frames rather than framing the printable line.
+ *
  * Note that empty message bodies are valid
  */
-void handle_say(ClientThreadData *data, LineList *cmdArgs) {
+void handle_say(ClientThreadData *data, CmdView *cmd) {
     // Update stats
-    data->clients->stats[SAY_COUNT]++;
-    data->client->stats[SAY_COUNT]++;
-
-    char *name = get_printable(data->client->name);
-    if (cmdArgs->numLines > 1) {
-        char *msg = get_printable(cmdArgs->lines[1]);
-        send_all_clients(data->clients, "MSG:%s:%s", name, msg);
+    stat_add(&data->clients->stats, SAY_COUNT, 1);
+    stat_add(&data->client->stats, SAY_COUNT, 1);
+
+    char *name = data->client->printableName;
+    bool framed = data->client->framed;
+    Payload *payload;
+    if (cmd->numFields > 1) {
+        CmdField *body = &cmd->fields[1];
+        char *msg = framed ? copy_printable_field(body, false)
+                : get_printable(body->start);
+        payload = format_payload("MSG:%s:%s", name, msg);
         printf("%s: %s\n", name, msg);
+
+        if (framed) {
+            bool hasNewLine = memchr(body->start, '\n', body->length) != NULL;
+            char *text = hasNewLine ? copy_printable_field(body, true) : msg;
+
+            CmdView view;
+            view.cmdNo = get_cmd_no("MSG", strlen("MSG"), CLIENT);
+            view.numFields = 3;
+            view.fields[1].start = name;
+            view.fields[1].length = strlen(name);
+            view.fields[2].start = text;
+            view.fields[2].length = body->length;
+            payload->framed = frame_payload(&view);
+
+            if (hasNewLine) {
+                free(text);
+            }
+        }
         free(msg);
     } else {
-        send_all_clients(data->clients, "MSG:%s", name);
+        payload = format_payload("MSG:%s", name);
         printf("%s:\n", name);
     }
+    broadcast_payload(data->clients, payload);
+    unref_payload(payload);
 
     fflush(stdout);
-    free(name);
-    free_line_list(cmdArgs);
 }
 
 /*
@@ -349,24 +402,25 @@ void handle_say(ClientThreadData *data, LineList *cmdArgs) {
  *
  * Otherwise, this function does nothing.
  */
-void handle_kick(ClientThreadData *data, LineList *cmdArgs) {
-    char *name = cmdArgs->lines[1];
+void handle_kick(ClientThreadData *data, CmdView *cmd) {
+    char *name = cmd->fields[1].start;
     ClientList *clients = data->clients;
 
     // Update stats
-    clients->stats[KICK_COUNT]++;
-    data->client->stats[KICK_COUNT]++;
+    stat_add(&clients->stats, KICK_COUNT, 1);
+    stat_add(&data->client->stats, KICK_COUNT, 1);
 
+    // The read keeps the kicked client from being freed while it is sent to
+    int readSlot = begin_client_read(clients);
     ClientThread *client = get_client_by_name(clients, name);
     if (client != NULL) {
         send_client(client, "KICK:");
     }
-
-    free_line_list(cmdArgs);
+    end_client_read(clients, readSlot);
 }
 
 /*
- * Handler for the LIST: command from a client given a LineList containing
+ * Handler for the LIST: command from a client given a CmdView of
  * the arguments for that command.
  *
  * Broadcasts the command LIST:<namesLine> to every client where <namesLine> is
@@ -374,37 +428,27 @@ void handle_kick(ClientThreadData *data, LineList *cmdArgs) {
  * as per the given spec.
  *
  * The string "(current chatters: <namesLine>)" is emitted to stdout.
+ *
+ * The LIST: command is cached by the ClientList between joins and leaves
+ * (see get_list_payload()), so it is not rebuilt for each request.
  */
-void handle_list(ClientThreadData *data, LineList *cmdArgs) {
+void handle_list(ClientThreadData *data, CmdView *cmd) {
     ClientList *clients = data->clients;
 
     // Update stats
-    clients->stats[LIST_COUNT]++;
-    data->client->stats[LIST_COUNT]++;
-
-    // Get a LineList of the names of every client
-    LineList *names = get_names(clients);
-    char *namesLine = (char *) calloc(1, sizeof(char));
-
-    for (int i = 0; i < names->numLines; ++i) {
-        // Append each client name to namesLine
-        char *name = get_printable(names->lines[i]);
-        add_to_string(&namesLine, name);
-        free(name);
-        // Append a comma for all but the last name
-        if (i < (names->numLines - 1)) {
-            add_to_string(&namesLine, ",");
-        }
-    }
+    stat_add(&clients->stats, LIST_COUNT, 1);
+    stat_add(&data->client->stats, LIST_COUNT, 1);
 
     // Emit and send required commands/messages
-    send_all_clients(clients, "LIST:%s", namesLine);
-    printf("(current chatters: %s)\n", namesLine);
+    Payload *payload = get_list_payload(clients);
+    broadcast_payload(clients, payload);
+    // The names line lies between "LIST:" and the new line
+    int namesLength = payload->length - strlen("LIST:\n");
+    printf("(current chatters: %.*s)\n", namesLength,
+            payload->bytes + strlen("LIST:"));
     fflush(stdout);
 
-    free(namesLine);
-    free_line_list(names);
-    free_line_list(cmdArgs);
+    unref_payload(payload);
 }
 
 /*
@@ -412,17 +456,17 @@ void handle_list(ClientThreadData *data, LineList *cmdArgs) {
  * Just sets the isActive flag of the client being handled to false as sending
  * leave messages etc. are handled after the fact in client_thread_handler
  */
-void handle_leave(ClientThreadData *data, LineList *cmdArgs) {
+void handle_leave(ClientThreadData *data, CmdView *cmd) {
     // Update server stats
-    data->clients->stats[LEAVE_COUNT]++;
+    stat_add(&data->clients->stats, LEAVE_COUNT, 1);
 
     disable_client(data->client);
-    free_line_list(cmdArgs);
 }
 
 /*
  * If mode is 0:
- *      - SIGHUP is ignored/masked on the calling thread.
+ *      - SIGHUP is ignored/masked on the calling thread, as is SIGUSR1,
+ *        which is waited for by the trace dumping thread. (see trace.c)
  *        Note that in this case, the sig argument is ignored.
  *
  * If mode is non-zero:
@@ -438,6 +482,7 @@ void toggle_sighup(int mode, int *sig) {
     if (mode) {
         sigwait(&set, sig);
     } else {
+        sigaddset(&set, SIGUSR1);
         pthread_sigmask(SIG_SETMASK, &set, NULL);
     }
 }
@@ -445,7 +490,13 @@ void toggle_sighup(int mode, int *sig) {
 /*
  * Thread function which waits for the server to be sent a SIGHUP signal.
  * On receiving this signal, it prints server statistics to stderr then waits
- * again for the another SIGHUP.
+ * again for the another SIGHUP. (see format_stats_dump())
+ *
+ * The statistics are copied into a snapshot first (see
+ * take_stats_snapshot()), which never takes the ClientList's lock, and are
+ * formatted from the snapshot into a growable buffer, so a dump of
+ * thousands of clients neither stalls joins, leaves and broadcasts nor takes
+ * quadratic time.
  */
 void *sighup_stats_handler(void *arg) {
     ClientList *clients = (ClientList *) arg;
@@ -455,32 +506,14 @@ void *sighup_stats_handler(void *arg) {
         // Block until next sighup
         toggle_sighup(1, &sig);
 
-        char *stats = calloc(1, sizeof(char));
-
-        pthread_mutex_lock(clients->lock);
-        add_to_string(&stats, "@CLIENTS@\n");
-
-        ClientNode *currentNode = clients->head;
-        while (currentNode != NULL) {
-            // Iterate over clients in the server and add their stat lines to
-            // stats.
-            char *clientStats = client_stat_line(currentNode->client);
-            add_to_string(&stats, clientStats);
-            free(clientStats);
-
-            currentNode = currentNode->next;
-        }
-
-        // Get the server stats
-        add_to_string(&stats, "@SERVER@\n");
-        char *serverStats = server_stat_line(clients);
-        add_to_string(&stats, serverStats);
-        free(serverStats);
-
-        pthread_mutex_unlock(clients->lock);
+        StatsSnapshot *snapshot = take_stats_snapshot(clients);
+        TextBuffer stats;
+        init_text_buffer(&stats);
+        format_stats_dump(&stats, snapshot);
+        free_stats_snapshot(snapshot);
 
-        fprintf(stderr, stats);
+        fwrite(stats.text, sizeof(char), stats.length, stderr);
         fflush(stderr);
-        free(stats);
+        free_text_buffer(&stats);
     }
 }
@@ -2,6 +2,10 @@
 #define SERVERUTILS_H
 
 #include "clientList.h"
+#include "commands.h"
+
+/* Set of event loop threads clients are written by (see eventLoop.h) */
+typedef struct EventLoopGroup EventLoopGroup;
 
 /*
  * Struct containing data to be passed to each thread of the server for
@@ -16,7 +20,25 @@ typedef struct {
     ClientThread *client;
 } ClientThreadData;
 
-void spawn_client_thread(ClientList *clients, int fdClient);
+/* 
+ * The command numbers corresponding to commands a server can receive.
+ * This correspond to the outputs of the function get_cmd_no() from commands.h
+ * and is generated from SERVER_COMMANDS.
+ */
+typedef enum {
+    SERVER_COMMANDS(CMD_NUMBER)
+} ServerCmdNumbers;
+
+void spawn_client_thread(ClientList *clients, EventLoopGroup *loops,
+        int fdClient);
+void announce_entry(ClientList *clients, ClientThread *client);
+void announce_exit(ClientList *clients, ClientThread *client);
+bool run_handshake(ClientList *clients, ClientThread *client);
+void init_client_rate(ClientList *clients, ClientThread *client);
+long long take_command_token(ClientList *clients, ClientThread *client,
+        long long now);
+void handle_cmd(ClientThreadData *data, char *cmd, size_t length,
+        long long readAt);
 void toggle_sighup(int mode, int *sig);
 void *sighup_stats_handler(void *arg);
 
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <string.h>
+#include "statCounters.h"
+
+/* Shard number of the calling thread, or -1 if it has not been given one */
+static __thread int threadShard = -1;
+/* Shard number the next thread to count anything is given */
+static int nextShard = 0;
+
+/*
+ * Initializes a StatCounters with a given number of shards, with every
+ * counter 0.
+ */
+void init_stat_counters(StatCounters *counters, int numShards) {
+    void *shards;
+    if (posix_memalign(&shards, CACHE_LINE, numShards * sizeof(StatShard))) {
+        shards = NULL;
+        numShards = 0;
+    } else {
+        memset(shards, 0, numShards * sizeof(StatShard));
+    }
+    counters->shards = (StatShard *) shards;
+    counters->numShards = numShards;
+}
+
+/* Frees memory allocated to a StatCounters */
+void free_stat_counters(StatCounters *counters) {
+    free(counters->shards);
+    counters->shards = NULL;
+    counters->numShards = 0;
+}
+
+/*
+ * Returns the shard number of the calling thread, giving it the next one
+ * round robin if it has none yet.
+ */
+static int get_thread_shard(void) {
+    if (threadShard < 0) {
+        threadShard = __atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED)
+                & 0xffff;
+    }
+
+    return threadShard;
+}
+
+/*
+ * Adds an amount to one of the counters of a StatCounters, in the calling
+ * thread's shard. Safe to call concurrently from multiple threads.
+ */
+void stat_add(StatCounters *counters, int stat, long long amount) {
+    if (counters->numShards == 0) {
+        return;
+    }
+    StatShard *shard = &counters->shards[counters->numShards == 1 ? 0
+            : get_thread_shard() % counters->numShards];
+    __atomic_add_fetch(&shard->counts[stat], amount, __ATOMIC_RELAXED);
+}
+
+/*
+ * Returns the value of one of the counters of a StatCounters, summed over
+ * all of its shards.
+ */
+long long stat_total(StatCounters *counters, int stat) {
+    long long total = 0;
+    for (int i = 0; i < counters->numShards; ++i) {
+        total += __atomic_load_n(&counters->shards[i].counts[stat],
+                __ATOMIC_RELAXED);
+    }
+
+    return total;
+}
@@ -0,0 +1,38 @@
+#ifndef STATCOUNTERS_H
+#define STATCOUNTERS_H
+
+/* Size in bytes of a cache line, which each shard of counters fills */
+#define CACHE_LINE 64
+/* Largest number of counters a StatCounters can hold */
+#define MAX_STAT_COUNTERS (CACHE_LINE / sizeof(long long))
+/* Number of shards the counters of a whole server are spread over */
+#define SERVER_STAT_SHARDS 16
+
+/*
+ * Struct representing one cache line sized shard of a set of counters.
+ */
+typedef struct {
+    long long counts[MAX_STAT_COUNTERS];
+} __attribute__((aligned(CACHE_LINE))) StatShard;
+
+/*
+ * Struct representing a set of 64-bit counters which many threads add to.
+ *
+ * Each counter is split over a number of shards, each on its own cache line,
+ * and each thread adds to the shard of its own, so threads counting at the
+ * same time do not contend for the same cache line. A counter's value is the
+ * sum of its shards, taken when it is read.
+ */
+typedef struct {
+    /* Array of shards, numShards long */
+    StatShard *shards;
+    /* Number of shards; a single shard suits counters with one writer */
+    int numShards;
+} StatCounters;
+
+void init_stat_counters(StatCounters *counters, int numShards);
+void free_stat_counters(StatCounters *counters);
+void stat_add(StatCounters *counters, int stat, long long amount);
+long long stat_total(StatCounters *counters, int stat);
+
+#endif
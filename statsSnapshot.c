@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "statsSnapshot.h"
+#include "eventLoop.h"
+
+/* Number of clients a snapshot has room for before it first grows */
+#define INITIAL_CLIENTS 16
+
+/*
+ * Copies the statistics and output queue state of a client into a
+ * ClientSnapshot, holding the client's locks only while doing so.
+ */
+static void snapshot_client(ClientThread *client, ClientSnapshot *snapshot) {
+    pthread_mutex_lock(client->lock);
+    snapshot->name = (char *) calloc(strlen(client->name) + 1, sizeof(char));
+    strcpy(snapshot->name, client->name);
+    for (int i = 0; i < CLIENT_STAT_NUM; ++i) {
+        snapshot->commands[i] = stat_total(&client->stats, i);
+    }
+
+    EventConn *conn = client->conn;
+    pthread_mutex_lock(conn->lock);
+    snapshot->queuedBytes = conn->queue.numBytes;
+    snapshot->queuedMessages = conn->queue.numMessages;
+    snapshot->dropped = conn->queue.dropped;
+    snapshot->slow = conn->queue.slow;
+    pthread_mutex_unlock(conn->lock);
+    pthread_mutex_unlock(client->lock);
+}
+
+/*
+ * Summarises the values recorded in a Histogram into a LatencySnapshot.
+ */
+static void snapshot_latency(Histogram *histogram,
+        LatencySnapshot *snapshot) {
+    snapshot->count = histogram_count(histogram);
+    snapshot->sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+    snapshot->p50 = histogram_percentile(histogram, 50);
+    snapshot->p90 = histogram_percentile(histogram, 90);
+    snapshot->p99 = histogram_percentile(histogram, 99);
+    snapshot->p999 = histogram_percentile(histogram, 99.9);
+    snapshot->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+/*
+ * Takes a snapshot of the statistics of a server.
+ *
+ * The ClientList is read without taking its lock (see begin_client_read()),
+ * and each client's own locks are held only while its counters are copied,
+ * so taking a snapshot never stalls joins, leaves or broadcasts.
+ *
+ * Returns the snapshot, to be freed with free_stats_snapshot().
+ */
+StatsSnapshot *take_stats_snapshot(ClientList *clients) {
+    StatsSnapshot *snapshot = (StatsSnapshot *) calloc(1,
+            sizeof(StatsSnapshot));
+    int capacity = INITIAL_CLIENTS;
+    snapshot->clients = (ClientSnapshot *) malloc(capacity
+            * sizeof(ClientSnapshot));
+
+    int readSlot = begin_client_read(clients);
+    for (ClientNode *node = first_client_node(clients); node != NULL;
+            node = next_client_node(node)) {
+        if (snapshot->numClients == capacity) {
+            capacity *= 2;
+            snapshot->clients = (ClientSnapshot *) realloc(snapshot->clients,
+                    capacity * sizeof(ClientSnapshot));
+        }
+        snapshot_client(node->client,
+                &snapshot->clients[snapshot->numClients++]);
+    }
+    end_client_read(clients, readSlot);
+
+    snapshot->connections = count_open_clients();
+    for (int i = 0; i < SERVER_STAT_NUM; ++i) {
+        snapshot->commands[i] = stat_total(&clients->stats, i);
+    }
+
+    QueueStats *queues = &clients->queueStats;
+    snapshot->queues.writes = __atomic_load_n(&queues->writes,
+            __ATOMIC_RELAXED);
+    snapshot->queues.messages = __atomic_load_n(&queues->messages,
+            __ATOMIC_RELAXED);
+    snapshot->queues.bytes = __atomic_load_n(&queues->bytes,
+            __ATOMIC_RELAXED);
+    snapshot->queues.slow = __atomic_load_n(&queues->slow, __ATOMIC_RELAXED);
+    snapshot->queues.slowEvents = __atomic_load_n(&queues->slowEvents,
+            __ATOMIC_RELAXED);
+    snapshot->queues.evicted = __atomic_load_n(&queues->evicted,
+            __ATOMIC_RELAXED);
+    snapshot->queues.dropped = __atomic_load_n(&queues->dropped,
+            __ATOMIC_RELAXED);
+
+    LineStats *lines = &clients->lineStats;
+    snapshot->lines.oversized = __atomic_load_n(&lines->oversized,
+            __ATOMIC_RELAXED);
+    snapshot->lines.discardedBytes = __atomic_load_n(&lines->discardedBytes,
+            __ATOMIC_RELAXED);
+    snapshot->lines.disconnected = __atomic_load_n(&lines->disconnected,
+            __ATOMIC_RELAXED);
+
+    CompressStats *compress = &clients->compressStats;
+    snapshot->compress.streams = __atomic_load_n(&compress->streams,
+            __ATOMIC_RELAXED);
+    snapshot->compress.dictStreams = __atomic_load_n(&compress->dictStreams,
+            __ATOMIC_RELAXED);
+    snapshot->compress.bytesIn = __atomic_load_n(&compress->bytesIn,
+            __ATOMIC_RELAXED);
+    snapshot->compress.bytesOut = __atomic_load_n(&compress->bytesOut,
+            __ATOMIC_RELAXED);
+    snapshot->compress.cpuNanos = __atomic_load_n(&compress->cpuNanos,
+            __ATOMIC_RELAXED);
+
+    snapshot_latency(&clients->dispatchLatency, &snapshot->dispatch);
+    snapshot_latency(&clients->handlerLatency, &snapshot->handler);
+    snapshot_latency(&clients->fanoutLatency, &snapshot->fanout);
+
+    return snapshot;
+}
+
+/* Frees memory allocated to a StatsSnapshot */
+void free_stats_snapshot(StatsSnapshot *snapshot) {
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        free(snapshot->clients[i].name);
+    }
+    free(snapshot->clients);
+    free(snapshot);
+}
+
+/*
+ * Appends the saved statistics of a client to a TextBuffer.
+ *
+ * The format of the line is:
+ *
+ * "<name>:SAY:<#SAY>:KICK:<#KICK>:LIST:<#LIST>\n"
+ *
+ * where name is the name of the client and #SAY etc. are the number of times
+ * the client has called the respective commands.
+ *
+ * i.e. for a client John who's sent SAY, KICK and LIST each 3 times, its stat
+ * line should be:
+ *
+ * "John:SAY:3:KICK:3:LIST:3"
+ */
+static void client_stat_line(TextBuffer *buffer, ClientSnapshot *client) {
+    text_buffer_printf(buffer, "%s:SAY:%lld:KICK:%lld:LIST:%lld\n",
+            client->name, client->commands[SAY_COUNT],
+            client->commands[KICK_COUNT], client->commands[LIST_COUNT]);
+}
+
+/*
+ * Appends the server's command statistics to a TextBuffer.
+ * The format of the line (ignore spaces) is:
+ *
+ * "server:AUTH:<#AUTH>:NAME:<#NAME>:SAY:<#SAY>:KICK:<#KICK>:LIST:<#LIST>:
+ * LEAVE:<#LEAVE>\n"
+ *
+ * where #SAY etc. are the number of times any client has called the
+ * respective commands.
+ */
+static void server_stat_line(TextBuffer *buffer, StatsSnapshot *snapshot) {
+    long long *commands = snapshot->commands;
+    text_buffer_printf(buffer,
+            "server:AUTH:%lld:NAME:%lld:SAY:%lld:KICK:%lld:LIST:%lld:"
+            "LEAVE:%lld\n", commands[AUTH_COUNT], commands[NAME_COUNT],
+            commands[SAY_COUNT], commands[KICK_COUNT], commands[LIST_COUNT],
+            commands[LEAVE_COUNT]);
+}
+
+/*
+ * Appends the state of a client's output queue to a TextBuffer.
+ *
+ * The format of the line is:
+ *
+ * "<name>:QUEUED:<bytes>:MESSAGES:<#messages>:DROPPED:<#dropped>:SLOW:<0|1>\n"
+ *
+ * where bytes and #messages are the amount of output waiting to be written
+ * to the client, #dropped is the number of messages dropped by the slow
+ * consumer policy and SLOW is 1 if the client is currently a slow consumer.
+ */
+static void client_queue_stat_line(TextBuffer *buffer,
+        ClientSnapshot *client) {
+    text_buffer_printf(buffer, "%s:QUEUED:%zu:MESSAGES:%d:DROPPED:%ld:"
+            "SLOW:%d\n", client->name, client->queuedBytes,
+            client->queuedMessages, client->dropped, client->slow);
+}
+
+/*
+ * Appends the slow consumer counters of all clients' output queues to a
+ * TextBuffer. The format of the line (ignore spaces) is:
+ *
+ * "queues:SLOW:<#SLOW>:SLOW_EVENTS:<#SLOW_EVENTS>:EVICTED:<#EVICTED>:
+ * DROPPED:<#DROPPED>\n"
+ *
+ * where #SLOW is the number of clients which are currently slow consumers,
+ * #SLOW_EVENTS the number of times a client became one and #EVICTED and
+ * #DROPPED the number of clients and messages the slow consumer policy
+ * disconnected and dropped.
+ */
+static void queue_stat_line(TextBuffer *buffer, QueueStats *queues) {
+    text_buffer_printf(buffer, "queues:SLOW:%ld:SLOW_EVENTS:%ld:EVICTED:%ld:"
+            "DROPPED:%ld\n", queues->slow, queues->slowEvents,
+            queues->evicted, queues->dropped);
+}
+
+/*
+ * Appends the counters of writes of clients' queued output to a TextBuffer.
+ * The format of the line (ignore spaces) is:
+ *
+ * "writer:WRITES:<#WRITES>:MESSAGES:<#MESSAGES>:BYTES:<#BYTES>:
+ * PER_WRITE:<messages per write>\n"
+ *
+ * where messages per write is given to two decimal places, and is how many
+ * messages were coalesced into each write system call on average.
+ */
+static void write_stat_line(TextBuffer *buffer, QueueStats *queues) {
+    text_buffer_printf(buffer, "writer:WRITES:%ld:MESSAGES:%ld:BYTES:%ld:"
+            "PER_WRITE:%.2f\n", queues->writes, queues->messages,
+            queues->bytes, queues->writes > 0
+            ? (double) queues->messages / queues->writes : 0.0);
+}
+
+/*
+ * Appends the counters of oversized lines discarded from clients to a
+ * TextBuffer. The format of the line (ignore spaces) is:
+ *
+ * "lines:OVERSIZED:<#OVERSIZED>:DISCARDED_BYTES:<bytes>:
+ * DISCONNECTED:<#DISCONNECTED>\n"
+ *
+ * where #OVERSIZED is the number of lines discarded for being longer than
+ * the maximum line length, bytes the number of bytes discarded with them
+ * and #DISCONNECTED the number of clients disconnected for sending too many.
+ */
+static void line_stat_line(TextBuffer *buffer, LineStats *lines) {
+    text_buffer_printf(buffer, "lines:OVERSIZED:%ld:DISCARDED_BYTES:%ld:"
+            "DISCONNECTED:%ld\n", lines->oversized, lines->discardedBytes,
+            lines->disconnected);
+}
+
+/*
+ * Appends the counters of compressed output to a TextBuffer. The format of
+ * the line (ignore spaces) is:
+ *
+ * "compress:STREAMS:<#STREAMS>:DICT:<#DICT>:IN:<bytes in>:OUT:<bytes out>:
+ * RATIO:<ratio>:NS_PER_BYTE:<ns per byte>\n"
+ *
+ * where #STREAMS is the number of clients which negotiated compression,
+ * #DICT how many of them used a preset dictionary, ratio the bytes of
+ * output compressed per compressed byte written and ns per byte the CPU
+ * time spent compressing each byte of output, both to two decimal places.
+ */
+static void compress_stat_line(TextBuffer *buffer, CompressStats *compress) {
+    text_buffer_printf(buffer, "compress:STREAMS:%ld:DICT:%ld:IN:%ld:OUT:%ld:"
+            "RATIO:%.2f:NS_PER_BYTE:%.2f\n", compress->streams,
+            compress->dictStreams, compress->bytesIn, compress->bytesOut,
+            compress->bytesOut > 0
+            ? (double) compress->bytesIn / compress->bytesOut : 0.0,
+            compress->bytesIn > 0
+            ? (double) compress->cpuNanos / compress->bytesIn : 0.0);
+}
+
+/*
+ * Appends a latency summary with a given name to a TextBuffer. The format of
+ * the line (ignore spaces) is:
+ *
+ * "<name>:COUNT:<#COUNT>:P50:<p50>:P90:<p90>:P99:<p99>:P999:<p99.9>:
+ * MAX:<max>\n"
+ */
+static void latency_stat_line(TextBuffer *buffer, char *name,
+        LatencySnapshot *latency) {
+    text_buffer_printf(buffer, "%s:COUNT:%lld:P50:%lld:P90:%lld:P99:%lld:"
+            "P999:%lld:MAX:%lld\n", name, latency->count, latency->p50,
+            latency->p90, latency->p99, latency->p999, latency->max);
+}
+
+/*
+ * Formats a StatsSnapshot as the stats dump a server emits on SIGHUP:
+ *
+ * - @CLIENTS@ followed by the stat line of each client
+ * - @SERVER@ followed by the server's stat line
+ * - @QUEUES@ followed by the queue state of each client, then the slow
+ *   consumer counters of all queues
+ * - @WRITER@ followed by the counters of writes of queued output
+ * - @LINES@ followed by the counters of oversized lines discarded
+ * - @COMPRESS@ followed by the counters of compressed output
+ * - @LATENCY@ followed by percentiles of the time in nanoseconds from
+ *   commands being read to being dispatched ("dispatch"), taken by command
+ *   handlers ("handler") and taken to queue each broadcast for every client
+ *   ("fanout")
+ */
+void format_stats_dump(TextBuffer *buffer, StatsSnapshot *snapshot) {
+    text_buffer_append(buffer, "@CLIENTS@\n");
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        client_stat_line(buffer, &snapshot->clients[i]);
+    }
+
+    text_buffer_append(buffer, "@SERVER@\n");
+    server_stat_line(buffer, snapshot);
+
+    text_buffer_append(buffer, "@QUEUES@\n");
+    for (int i = 0; i < snapshot->numClients; ++i) {
+        client_queue_stat_line(buffer, &snapshot->clients[i]);
+    }
+    queue_stat_line(buffer, &snapshot->queues);
+
+    text_buffer_append(buffer, "@WRITER@\n");
+    write_stat_line(buffer, &snapshot->queues);
+
+    text_buffer_append(buffer, "@LINES@\n");
+    line_stat_line(buffer, &snapshot->lines);
+
+    text_buffer_append(buffer, "@COMPRESS@\n");
+    compress_stat_line(buffer, &snapshot->compress);
+
+    text_buffer_append(buffer, "@LATENCY@\n");
+    latency_stat_line(buffer, "dispatch", &snapshot->dispatch);
+    latency_stat_line(buffer, "handler", &snapshot->handler);
+    latency_stat_line(buffer, "fanout", &snapshot->fanout);
+}
@@ -0,0 +1,78 @@
+#ifndef STATSSNAPSHOT_H
+#define STATSSNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "clientList.h"
+#include "clientThread.h"
+#include "histogram.h"
+#include "outQueue.h"
+#include "lineLimit.h"
+#include "textBuffer.h"
+
+/*
+ * Struct storing a copy of the statistics of a single client.
+ */
+typedef struct {
+    /* Name of the client */
+    char *name;
+    /* Number of SAY:, KICK: and LIST: commands sent by the client */
+    long long commands[CLIENT_STAT_NUM];
+    /* Number of bytes of output waiting to be written to the client */
+    size_t queuedBytes;
+    /* Number of messages waiting to be written to the client */
+    int queuedMessages;
+    /* Number of messages to the client dropped as it was a slow consumer */
+    long dropped;
+    /* Whether the client is currently a slow consumer */
+    bool slow;
+} ClientSnapshot;
+
+/*
+ * Struct storing a summary of the values recorded in a Histogram.
+ */
+typedef struct {
+    /* Number of values recorded */
+    long long count;
+    /* Sum of the values recorded */
+    long long sum;
+    /* Values at the 50th, 90th, 99th and 99.9th percentiles */
+    long long p50;
+    long long p90;
+    long long p99;
+    long long p999;
+    /* Largest value recorded */
+    long long max;
+} LatencySnapshot;
+
+/*
+ * Struct storing a copy of the statistics of a server taken at one moment,
+ * which can then be formatted at leisure without holding any of the
+ * server's locks.
+ */
+typedef struct {
+    /* Array of the clients in the server, in name order */
+    ClientSnapshot *clients;
+    /* Number of clients in the server (i.e. done with their handshake) */
+    int numClients;
+    /* Number of client connections open, including those still handshaking */
+    long connections;
+    /* Number of each command handled by the server (see StatIndices) */
+    long long commands[SERVER_STAT_NUM];
+    /* Counters of the writes and slow consumers of all clients' queues */
+    QueueStats queues;
+    /* Counters of the oversized lines discarded from all clients */
+    LineStats lines;
+    /* Counters of the output compressed for all compressed clients */
+    CompressStats compress;
+    /* Summaries of the server's latency histograms (see ClientList) */
+    LatencySnapshot dispatch;
+    LatencySnapshot handler;
+    LatencySnapshot fanout;
+} StatsSnapshot;
+
+StatsSnapshot *take_stats_snapshot(ClientList *clients);
+void free_stats_snapshot(StatsSnapshot *snapshot);
+void format_stats_dump(TextBuffer *buffer, StatsSnapshot *snapshot);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include "suffixTable.h"
+#include "nameIndex.h"
+
+/* Number of buckets a SuffixTable starts with */
+#define INITIAL_BUCKETS 64
+
+/*
+ * Returns a pointer to the chain of the bucket a base name belongs in.
+ */
+static SuffixEntry **bucket_of(SuffixTable *table, char *base) {
+    return &table->buckets[hash_name(base) & (table->numBuckets - 1)];
+}
+
+/*
+ * Initializes an empty SuffixTable.
+ */
+void init_suffix_table(SuffixTable *table) {
+    table->numBuckets = INITIAL_BUCKETS;
+    table->buckets = (SuffixEntry **) calloc(table->numBuckets,
+            sizeof(SuffixEntry *));
+    table->count = 0;
+}
+
+/*
+ * Frees memory allocated to a SuffixTable and all of its entries.
+ */
+void free_suffix_table(SuffixTable *table) {
+    for (size_t i = 0; i < table->numBuckets; ++i) {
+        SuffixEntry *entry = table->buckets[i];
+        while (entry != NULL) {
+            SuffixEntry *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = NULL;
+    table->numBuckets = 0;
+    table->count = 0;
+}
+
+/*
+ * Doubles the number of buckets of a SuffixTable and rehashes its entries
+ * into them.
+ */
+static void grow_suffix_table(SuffixTable *table) {
+    SuffixEntry **oldBuckets = table->buckets;
+    size_t oldNumBuckets = table->numBuckets;
+
+    table->numBuckets *= 2;
+    table->buckets = (SuffixEntry **) calloc(table->numBuckets,
+            sizeof(SuffixEntry *));
+
+    for (size_t i = 0; i < oldNumBuckets; ++i) {
+        SuffixEntry *entry = oldBuckets[i];
+        while (entry != NULL) {
+            SuffixEntry *next = entry->next;
+            SuffixEntry **bucket = bucket_of(table, entry->base);
+            entry->next = *bucket;
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    free(oldBuckets);
+}
+
+/*
+ * Returns the entry of a base name in a SuffixTable, held for one more
+ * client, adding an entry starting at -1 (the bare base name) if the base
+ * name has none yet.
+ *
+ * The client should release the entry with release_suffix_entry() when it
+ * leaves.
+ */
+SuffixEntry *hold_suffix_entry(SuffixTable *table, char *base) {
+    for (SuffixEntry *entry = *bucket_of(table, base); entry != NULL;
+            entry = entry->next) {
+        if (!strcmp(entry->base, base)) {
+            entry->numClients++;
+            return entry;
+        }
+    }
+
+    if (table->count >= table->numBuckets) {
+        grow_suffix_table(table);
+    }
+
+    SuffixEntry *entry = (SuffixEntry *) malloc(sizeof(SuffixEntry)
+            + strlen(base) + 1);
+    strcpy(entry->base, base);
+    entry->nextSuffix = -1;
+    entry->numClients = 1;
+    SuffixEntry **bucket = bucket_of(table, base);
+    entry->next = *bucket;
+    *bucket = entry;
+    table->count++;
+
+    return entry;
+}
+
+/*
+ * Releases a client's hold on an entry of a SuffixTable, removing and
+ * freeing the entry if no other client holds it.
+ */
+void release_suffix_entry(SuffixTable *table, SuffixEntry *entry) {
+    if (--entry->numClients > 0) {
+        return;
+    }
+
+    SuffixEntry **link = bucket_of(table, entry->base);
+    while (*link != entry) {
+        link = &(*link)->next;
+    }
+    *link = entry->next;
+    table->count--;
+    free(entry);
+}
@@ -0,0 +1,50 @@
+#ifndef SUFFIXTABLE_H
+#define SUFFIXTABLE_H
+
+#include <stddef.h>
+
+typedef struct SuffixEntry SuffixEntry;
+
+/*
+ * Struct representing the next name suffix to try for a single base name.
+ */
+struct SuffixEntry {
+    /* Next entry in the same bucket */
+    SuffixEntry *next;
+    /*
+     * Suffix the next name assigned for the base name starts searching from,
+     * where -1 is the bare base name and 0, 1, 2... are appended to it
+     */
+    int nextSuffix;
+    /* Number of clients holding the entry, i.e. named after the base name */
+    int numClients;
+    /* Base name the entry counts suffixes for */
+    char base[];
+};
+
+/*
+ * Struct representing a hash table of the next suffix to assign for each base
+ * name clients have asked to be named after, so a server can assign unique
+ * names without trying every taken suffix again for each new client.
+ *
+ * Each client assigned a name holds the entry of its base name until it
+ * leaves. An entry is freed once no client holds it, so the table only grows
+ * with the number of connected clients, and suffixes are searched from the
+ * bare base name again once every client named after it has left. The table
+ * doubles in size when it holds more entries than it has buckets.
+ */
+typedef struct {
+    /* Array of the first entry of each bucket's chain */
+    SuffixEntry **buckets;
+    /* Number of buckets; always a power of two */
+    size_t numBuckets;
+    /* Number of entries in the table */
+    size_t count;
+} SuffixTable;
+
+void init_suffix_table(SuffixTable *table);
+void free_suffix_table(SuffixTable *table);
+SuffixEntry *hold_suffix_entry(SuffixTable *table, char *base);
+void release_suffix_entry(SuffixTable *table, SuffixEntry *entry);
+
+#endif
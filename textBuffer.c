@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "textBuffer.h"
+
+/* Number of bytes allocated to a new TextBuffer */
+#define INITIAL_CAPACITY 256
+
+/*
+ * Initializes an empty TextBuffer.
+ */
+void init_text_buffer(TextBuffer *buffer) {
+    buffer->capacity = INITIAL_CAPACITY;
+    buffer->text = (char *) calloc(buffer->capacity, sizeof(char));
+    buffer->length = 0;
+}
+
+/*
+ * Frees memory allocated to a TextBuffer's string.
+ */
+void free_text_buffer(TextBuffer *buffer) {
+    free(buffer->text);
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+/*
+ * Grows a TextBuffer, if required, so that it can hold a given number more
+ * bytes and a null terminator.
+ */
+static void reserve(TextBuffer *buffer, size_t extra) {
+    size_t needed = buffer->length + extra + 1;
+    if (needed <= buffer->capacity) {
+        return;
+    }
+
+    while (buffer->capacity < needed) {
+        buffer->capacity *= 2;
+    }
+    buffer->text = (char *) realloc(buffer->text, buffer->capacity);
+}
+
+/*
+ * Appends a string to the end of a TextBuffer.
+ */
+void text_buffer_append(TextBuffer *buffer, const char *text) {
+    size_t length = strlen(text);
+    reserve(buffer, length);
+    memcpy(buffer->text + buffer->length, text, length + 1);
+    buffer->length += length;
+}
+
+/*
+ * Appends a string to the end of a TextBuffer, given as a formatting string
+ * and a variable number of arguments in the same manner as printf().
+ */
+void text_buffer_printf(TextBuffer *buffer, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer->text + buffer->length,
+            buffer->capacity - buffer->length, format, args);
+    va_end(args);
+
+    if (length < 0) {
+        buffer->text[buffer->length] = '\0';
+        return;
+    }
+    // Format again once there is room if the text was cut short
+    if (buffer->length + length >= buffer->capacity) {
+        reserve(buffer, length);
+        va_start(args, format);
+        vsnprintf(buffer->text + buffer->length,
+                buffer->capacity - buffer->length, format, args);
+        va_end(args);
+    }
+    buffer->length += length;
+}
@@ -0,0 +1,26 @@
+#ifndef TEXTBUFFER_H
+#define TEXTBUFFER_H
+
+#include <stddef.h>
+
+/*
+ * Struct representing a growable string which text is appended to.
+ *
+ * The buffer's capacity doubles whenever an append does not fit, so building
+ * a string from many small pieces takes time linear in its final length.
+ */
+typedef struct {
+    /* The string built so far; always null terminated */
+    char *text;
+    /* Length of the string, excluding the null terminator */
+    size_t length;
+    /* Number of bytes allocated to text */
+    size_t capacity;
+} TextBuffer;
+
+void init_text_buffer(TextBuffer *buffer);
+void free_text_buffer(TextBuffer *buffer);
+void text_buffer_append(TextBuffer *buffer, const char *text);
+void text_buffer_printf(TextBuffer *buffer, const char *format, ...);
+
+#endif
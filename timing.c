@@ -0,0 +1,52 @@
+#include <time.h>
+#include "timing.h"
+
+/* Number of nanoseconds in a millisecond */
+#define NSEC_PER_MSEC 1000000
+/* Number of nanoseconds in a microsecond */
+#define NSEC_PER_USEC 1000
+
+/*
+ * Returns the current time of the monotonic clock in milliseconds.
+ * Only differences between values returned by this function are meaningful.
+ */
+long long now_ms() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (long long) time.tv_sec * 1000 + time.tv_nsec / NSEC_PER_MSEC;
+}
+
+/*
+ * Returns the current time of the monotonic clock in microseconds.
+ * Only differences between values returned by this function are meaningful.
+ */
+long long now_us() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (long long) time.tv_sec * 1000000 + time.tv_nsec / NSEC_PER_USEC;
+}
+
+/*
+ * Returns the current time of the monotonic clock in nanoseconds.
+ * Only differences between values returned by this function are meaningful.
+ */
+long long now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (long long) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/*
+ * Returns the CPU time consumed by the calling thread in nanoseconds.
+ * Only differences between values returned on the same thread are
+ * meaningful.
+ */
+long long thread_cpu_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+
+    return (long long) time.tv_sec * 1000000000 + time.tv_nsec;
+}
@@ -0,0 +1,9 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+long long now_ms();
+long long now_us();
+long long now_ns();
+long long thread_cpu_ns();
+
+#endif
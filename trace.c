@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include "trace.h"
+#include "timing.h"
+
+typedef struct TraceRing TraceRing;
+
+/*
+ * Struct representing the ring of most recent events recorded by a single
+ * thread.
+ *
+ * Only the owning thread writes to a ring, so recording is a plain store of
+ * the event followed by a release store of head; a dump reads rings without
+ * stopping their threads and discards any events which may have been
+ * overwritten while it was copying them.
+ */
+struct TraceRing {
+    /* Next ring in the list of all rings */
+    TraceRing *next;
+    /* Whether the ring is owned by a running thread */
+    int inUse;
+    /* Number of events ever recorded in the ring */
+    unsigned long head;
+    /* The last ringCapacity events recorded */
+    TraceEvent events[];
+};
+
+/* Whether events are being recorded */
+bool traceEnabled = false;
+
+/* Number of events each ring holds; always a power of two */
+static unsigned long ringCapacity;
+/* Path trace files are dumped to */
+static char *tracePath;
+/* List of the rings of every thread which has recorded an event */
+static TraceRing *rings = NULL;
+/* Key whose destructor releases a thread's ring when the thread exits */
+static pthread_key_t ringKey;
+/* Ring of the calling thread, or NULL until it records its first event */
+static __thread TraceRing *threadRing = NULL;
+/* Kernel thread id of the calling thread */
+static __thread int threadId = 0;
+
+/*
+ * Releases a thread's ring when it exits, so the ring can be reused by a new
+ * thread rather than one being allocated per client thread ever run.
+ */
+static void release_ring(void *ring) {
+    __atomic_store_n(&((TraceRing *) ring)->inUse, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the calling thread's ring, claiming a released ring or creating a
+ * new one if the thread has none.
+ */
+static TraceRing *get_ring(void) {
+    if (threadRing != NULL) {
+        return threadRing;
+    }
+    threadId = (int) syscall(SYS_gettid);
+
+    TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&ring->inUse, &unused, 1, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (ring == NULL) {
+        ring = (TraceRing *) calloc(1, sizeof(TraceRing)
+                + ringCapacity * sizeof(TraceEvent));
+        ring->inUse = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        // On failure ring->next is updated to the new head of the list
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, false,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            ;
+        }
+    }
+
+    pthread_setspecific(ringKey, ring);
+    threadRing = ring;
+
+    return ring;
+}
+
+/*
+ * Records an event with a given argument in the calling thread's ring,
+ * overwriting its oldest event if it is full. Use trace_event() rather than
+ * calling this directly, so nothing is done when tracing is disabled.
+ */
+void trace_record(TraceType type, long long arg) {
+    TraceRing *ring = get_ring();
+    unsigned long head = ring->head;
+    TraceEvent *event = &ring->events[head & (ringCapacity - 1)];
+
+    event->time = now_ns();
+    event->arg = arg;
+    event->thread = threadId;
+    event->type = type;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies the events of a ring which are certain not to have been overwritten
+ * during the copy to the end of an array, returning the number copied.
+ */
+static unsigned long copy_ring(TraceRing *ring, TraceEvent *copy) {
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long start = head > ringCapacity ? head - ringCapacity : 0;
+    for (unsigned long i = start; i < head; ++i) {
+        copy[i - start] = ring->events[i & (ringCapacity - 1)];
+    }
+
+    // The owner may have overwritten the oldest events meanwhile, and may
+    // be part way through writing the slot after its new head
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    unsigned long newHead = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    unsigned long safe = newHead >= ringCapacity
+            ? newHead - ringCapacity + 1 : 0;
+    if (safe <= start) {
+        return head - start;
+    }
+    if (safe >= head) {
+        return 0;
+    }
+    memmove(copy, copy + (safe - start), (head - safe) * sizeof(TraceEvent));
+
+    return head - safe;
+}
+
+/*
+ * Writes the events in every ring to the trace file, replacing its previous
+ * contents. Returns false if the file could not be written.
+ */
+static bool dump_trace(void) {
+    FILE *file = fopen(tracePath, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.eventSize = sizeof(TraceEvent);
+    header.numEvents = 0;
+    fwrite(&header, sizeof(TraceHeader), 1, file);
+
+    TraceEvent *copy = (TraceEvent *) malloc(ringCapacity
+            * sizeof(TraceEvent));
+    TraceRing *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->next) {
+        unsigned long copied = copy_ring(ring, copy);
+        fwrite(copy, sizeof(TraceEvent), copied, file);
+        header.numEvents += copied;
+    }
+    free(copy);
+
+    // Fill in the number of events now it is known
+    rewind(file);
+    fwrite(&header, sizeof(TraceHeader), 1, file);
+
+    return !fclose(file);
+}
+
+/*
+ * Thread function which dumps the trace to its file each time the server is
+ * sent SIGUSR1.
+ */
+static void *trace_dump_handler(void *arg) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    int sig;
+
+    while (1) {
+        sigwait(&set, &sig);
+        if (!dump_trace()) {
+            fprintf(stderr, "trace: could not write %s\n", tracePath);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Enables tracing: from now on each thread records events in a ring of its
+ * own holding its most recent eventsPerThread events (rounded up to a power
+ * of two), and each SIGUSR1 sent to the server dumps every ring to the file
+ * at a given path. (see traceDecode.c)
+ *
+ * SIGUSR1 must be blocked in every thread. (see toggle_sighup())
+ * Returns false if the arguments were invalid.
+ */
+bool start_tracing(char *path, int eventsPerThread) {
+    if (path == NULL || eventsPerThread <= 0) {
+        return false;
+    }
+
+    ringCapacity = 1;
+    while (ringCapacity < (unsigned long) eventsPerThread) {
+        ringCapacity *= 2;
+    }
+    tracePath = path;
+    pthread_key_create(&ringKey, release_ring);
+    traceEnabled = true;
+
+    pthread_t dumpThread;
+    pthread_create(&dumpThread, NULL, trace_dump_handler, NULL);
+    pthread_detach(dumpThread);
+
+    return true;
+}
+
+/* Names of each TraceType, as shown in decoded traces */
+static const char *traceTypeNames[] = {
+        "accept",
+        "auth ok",
+        "auth fail",
+        "name assigned",
+        "command",
+        "command",
+        "broadcast",
+        "broadcast",
+        "write blocked"
+        };
+
+/*
+ * Returns the name of a TraceType, or NULL if it is not a valid type.
+ */
+const char *trace_type_name(int type) {
+    if (type < 0 || type >= TRACE_TYPE_COUNT) {
+        return NULL;
+    }
+
+    return traceTypeNames[type];
+}
@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bytes a trace file starts with */
+#define TRACE_MAGIC "CHATTRC1"
+/* Default number of events kept per thread */
+#define DEFAULT_TRACE_EVENTS 65536
+
+/*
+ * Types of events recorded in a trace. Those ending in _START and _END
+ * bracket a span of time; the others are instants.
+ */
+typedef enum {
+    /* A client connection was accepted; arg is its socket */
+    TRACE_ACCEPT,
+    /* A client sent the correct password */
+    TRACE_AUTH_OK,
+    /* A client sent a wrong password or an invalid AUTH: reply */
+    TRACE_AUTH_FAIL,
+    /* A client was named; arg is 1 if the server assigned the name */
+    TRACE_NAME_ASSIGNED,
+    /* A command's handler started; arg is its command number */
+    TRACE_CMD_START,
+    /* A command's handler returned; arg is its command number */
+    TRACE_CMD_END,
+    /* A broadcast started queueing a message for every client */
+    TRACE_BROADCAST_START,
+    /* A broadcast finished; arg is the number of clients it reached */
+    TRACE_BROADCAST_END,
+    /* A socket stopped accepting output; arg is the bytes still queued */
+    TRACE_WRITE_BLOCKED,
+    /* Number of event types */
+    TRACE_TYPE_COUNT
+} TraceType;
+
+/*
+ * Struct representing a single traced event, as stored in memory and in
+ * trace files.
+ */
+typedef struct {
+    /* Time of the event (as returned by now_ns()) */
+    int64_t time;
+    /* Event specific argument (see TraceType) */
+    int64_t arg;
+    /* Id of the thread which recorded the event */
+    int32_t thread;
+    /* TraceType of the event */
+    int32_t type;
+} TraceEvent;
+
+/*
+ * Struct representing the header of a trace file, which is followed by the
+ * events of every thread, each thread's in order.
+ */
+typedef struct {
+    /* TRACE_MAGIC, without a null terminator */
+    char magic[8];
+    /* Size in bytes of each TraceEvent */
+    int32_t eventSize;
+    /* Number of events following the header */
+    int32_t numEvents;
+} TraceHeader;
+
+/* Whether events are being recorded (see start_tracing()) */
+extern bool traceEnabled;
+
+bool start_tracing(char *path, int eventsPerThread);
+void trace_record(TraceType type, long long arg);
+const char *trace_type_name(int type);
+
+/*
+ * Records an event in the calling thread's trace ring if tracing is enabled.
+ * When it is not, this costs a single predictable branch.
+ */
+static inline void trace_event(TraceType type, long long arg) {
+    if (__builtin_expect(traceEnabled, 0)) {
+        trace_record(type, arg);
+    }
+}
+
+#endif
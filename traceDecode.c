@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+/*
+ * Trace decoder for the server.
+ *
+ * Usage: traceDecode tracefile
+ *
+ * Reads a trace file dumped by a server run with --trace (see trace.c) and
+ * writes it to stdout as Chrome trace event JSON, which can be loaded into
+ * chrome://tracing or Perfetto to view what each server thread was doing
+ * on a timeline. Times are in microseconds from the first event.
+ */
+
+/*
+ * Compares two TraceEvents by time, for qsort().
+ */
+int compare_events(const void *first, const void *second) {
+    const TraceEvent *a = (const TraceEvent *) first;
+    const TraceEvent *b = (const TraceEvent *) second;
+
+    return (a->time > b->time) - (a->time < b->time);
+}
+
+/*
+ * Returns the Chrome trace phase of an event type: "B" to begin a span, "E"
+ * to end one or "i" for an instant.
+ */
+const char *event_phase(int type) {
+    switch (type) {
+        case TRACE_CMD_START:
+        case TRACE_BROADCAST_START:
+            return "B";
+        case TRACE_CMD_END:
+        case TRACE_BROADCAST_END:
+            return "E";
+        default:
+            return "i";
+    }
+}
+
+/*
+ * Reads the events of a trace file. Returns the array of events and sets
+ * *numEvents to their number, or returns NULL if the file is not a valid
+ * trace.
+ */
+TraceEvent *read_trace(FILE *file, int *numEvents) {
+    TraceHeader header;
+    if (fread(&header, sizeof(TraceHeader), 1, file) != 1
+            || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic))
+            || header.eventSize != sizeof(TraceEvent)
+            || header.numEvents < 0) {
+        return NULL;
+    }
+
+    TraceEvent *events = (TraceEvent *) malloc((header.numEvents + 1)
+            * sizeof(TraceEvent));
+    if (fread(events, sizeof(TraceEvent), header.numEvents, file)
+            != (size_t) header.numEvents) {
+        free(events);
+        return NULL;
+    }
+    *numEvents = header.numEvents;
+
+    return events;
+}
+
+/*
+ * Writes a single event as a Chrome trace event object, with its time
+ * relative to a given start time.
+ */
+void write_event(TraceEvent *event, long long start) {
+    const char *phase = event_phase(event->type);
+    printf("{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,"
+            "\"tid\":%d", trace_type_name(event->type), phase,
+            (event->time - start) / 1000.0, event->thread);
+    if (!strcmp(phase, "i")) {
+        printf(",\"s\":\"t\"");
+    }
+    printf(",\"args\":{\"arg\":%lld}}", (long long) event->arg);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: traceDecode tracefile\n");
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "r");
+    if (file == NULL) {
+        fprintf(stderr, "traceDecode: cannot open %s\n", argv[1]);
+        return 1;
+    }
+    int numEvents;
+    TraceEvent *events = read_trace(file, &numEvents);
+    fclose(file);
+    if (events == NULL) {
+        fprintf(stderr, "traceDecode: %s is not a valid trace\n", argv[1]);
+        return 1;
+    }
+
+    qsort(events, numEvents, sizeof(TraceEvent), compare_events);
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    bool first = true;
+    for (int i = 0; i < numEvents; ++i) {
+        if (trace_type_name(events[i].type) == NULL) {
+            continue;
+        }
+        printf(first ? "\n" : ",\n");
+        write_event(&events[i], events[0].time);
+        first = false;
+    }
+    printf("\n]}\n");
+
+    free(events);
+
+    return 0;
+}